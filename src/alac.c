@@ -52,8 +52,14 @@ static const int host_bigendian = 0;
                    v = (((v) & 0x00FF) << 0x08) | \
                        (((v) & 0xFF00) >> 0x08); } while (0)
 
-struct {signed int x:24;} se_struct_24;
-#define SignExtend24(val) (se_struct_24.x = val)
+/* shifts instead of storing through a shared bit-field, decoders on other threads may run at once */
+#define SignExtend24(val) ((int32_t)((uint32_t)(val) << 8) >> 8)
+
+#if defined(__GNUC__)
+    #define ALAC_ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+    #define ALAC_ALWAYS_INLINE static inline
+#endif
 
 void alac_free(alac_file *alac) {
     if (alac->predicterror_buffer_a)
@@ -133,86 +139,79 @@ void alac_set_info(alac_file *alac, char *inputbuffer)
 
 }
 
-/* stream reading */
+/* stream reading
+ *
+ * the upcoming bits of the stream are cached in a 64 bit word, msb first,
+ * which is refilled with one unaligned big endian load. reads past the end
+ * of the input return zeros.
+ */
 
-/* supports reading 1 to 16 bits, in big endian format */
-static uint32_t readbits_16(alac_file *alac, int bits)
+static inline uint64_t load_be64(const unsigned char *input)
 {
-    uint32_t result;
-    int new_accumulator;
-
-    result = (alac->input_buffer[0] << 16) |
-             (alac->input_buffer[1] << 8) |
-             (alac->input_buffer[2]);
-
-    /* shift left by the number of bits we've already read,
-     * so that the top 'n' bits of the 24 bits we read will
-     * be the return bits */
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result & 0x00ffffff;
-
-    /* and then only want the top 'n' bits from that, where
-     * n is 'bits' */
-    result = result >> (24 - bits);
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + bits);
-
-    /* increase the buffer pointer if we've read over n bytes. */
-    alac->input_buffer += (new_accumulator >> 3);
-
-    /* and the remainder goes back into the bit accumulator */
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
-
+    uint64_t result;
+#if defined(__GNUC__)
+    memcpy(&result, input, 8);
+    if (!host_bigendian)
+        result = __builtin_bswap64(result);
+#else
+    int i;
+    result = 0;
+    for (i = 0; i < 8; i++)
+        result = (result << 8) | input[i];
+#endif
     return result;
 }
 
-/* supports reading 1 to 32 bits, in big endian format */
-static uint32_t readbits(alac_file *alac, int bits)
+/* tops the cache up to at least 57 bits */
+static inline void refill(alac_file *alac)
 {
-    int32_t result = 0;
-
-    if (bits > 16)
+    if (alac->input_buffer_end - alac->input_buffer >= 8)
     {
-        bits -= 16;
-        result = readbits_16(alac, 16) << bits;
+        /* whole bytes only, the bits of a partial byte are loaded again next time */
+        int bytes = (63 - alac->input_bitcount) >> 3;
+
+        alac->input_bitcache |= load_be64(alac->input_buffer) >> alac->input_bitcount;
+        alac->input_buffer += bytes;
+        alac->input_bitcount += bytes << 3;
+        return;
     }
 
-    result |= readbits_16(alac, bits);
+    while (alac->input_bitcount <= 56)
+    {
+        uint64_t byte = 0;
 
-    return result;
+        if (alac->input_buffer < alac->input_buffer_end)
+            byte = *alac->input_buffer++;
+        alac->input_bitcache |= byte << (56 - alac->input_bitcount);
+        alac->input_bitcount += 8;
+    }
 }
 
-/* reads a single bit */
-static int readbit(alac_file *alac)
+/* supports peeking 0 to 32 bits, which must be in the cache */
+static inline uint32_t peekbits(uint64_t cache, int bits)
 {
-    int result;
-    int new_accumulator;
-
-    result = alac->input_buffer[0];
-
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result >> 7 & 1;
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + 1);
-
-    alac->input_buffer += (new_accumulator / 8);
-
-    alac->input_buffer_bitaccumulator = (new_accumulator % 8);
+    /* shifting twice, as shifting by 64 is undefined */
+    return (uint32_t)((cache >> 1) >> (63 - bits));
+}
 
-    return result;
+static inline void skipbits(alac_file *alac, int bits)
+{
+    alac->input_bitcache <<= bits;
+    alac->input_bitcount -= bits;
 }
 
-static void unreadbits(alac_file *alac, int bits)
+/* supports reading 0 to 32 bits, in big endian format */
+static inline uint32_t readbits(alac_file *alac, int bits)
 {
-    int new_accumulator = (alac->input_buffer_bitaccumulator - bits);
+    uint32_t result;
+
+    if (alac->input_bitcount < bits)
+        refill(alac);
 
-    alac->input_buffer += (new_accumulator >> 3);
+    result = peekbits(alac->input_bitcache, bits);
+    skipbits(alac, bits);
 
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
-    if (alac->input_buffer_bitaccumulator < 0)
-        alac->input_buffer_bitaccumulator *= -1;
+    return result;
 }
 
 /* various implementations of count_leading_zero:
@@ -242,6 +241,8 @@ static int count_leading_zeros(int32_t input)
  */
 static int count_leading_zeros(int input)
 {
+    /* 0 is undefined for the builtin, the rice history can reach it */
+    if (!input) return 32;
     return __builtin_clz(input);
 }
 #elif defined(_MSC_VER) && defined(_M_IX86)
@@ -306,26 +307,45 @@ found:
 }
 #endif
 
+#if defined(__GNUC__)
+static int count_leading_zeros_64(uint64_t input)
+{
+    return __builtin_clzll(input);
+}
+#else
+static int count_leading_zeros_64(uint64_t input)
+{
+    if (input >> 32)
+        return count_leading_zeros((int)(input >> 32));
+    return 32 + count_leading_zeros((int)input);
+}
+#endif
+
 #define RICE_THRESHOLD 8 // maximum number of bits for a rice prefix.
 
-static int32_t entropy_decode_value(alac_file* alac,
+ALAC_ALWAYS_INLINE int32_t entropy_decode_value(alac_file* alac,
                              int readSampleSize,
                              int k,
                              int rice_kmodifier_mask)
 {
-    int32_t x = 0; // decoded value
+    int32_t x; // decoded value
+
+    // enough for the prefix and up to 32 more bits
+    if (alac->input_bitcount < RICE_THRESHOLD + 1 + 32)
+        refill(alac);
 
     // read x, number of 1s before 0 represent the rice value.
-    while (x <= RICE_THRESHOLD && readbit(alac))
-    {
-        x++;
-    }
+    // the low bit stops the count in a cache full of 1s, only the first
+    // RICE_THRESHOLD + 1 count anyway.
+    x = count_leading_zeros_64(~alac->input_bitcache | 1);
 
     if (x > RICE_THRESHOLD)
     {
         // read the number from the bit stream (raw value)
         int32_t value;
 
+        skipbits(alac, RICE_THRESHOLD + 1);
+
         value = readbits(alac, readSampleSize);
 
         // mask value
@@ -335,31 +355,36 @@ static int32_t entropy_decode_value(alac_file* alac,
     }
     else
     {
+        int bits = x + 1; // the 1s and the terminating 0
+
         if (k != 1)
         {
-            int extraBits = readbits(alac, k);
+            int extraBits = peekbits(alac->input_bitcache << bits, k);
 
             // x = x * (2^k - 1)
             x *= (((1 << k) - 1) & rice_kmodifier_mask);
 
-            if (extraBits > 1)
-                x += extraBits - 1;
-            else
-                unreadbits(alac, 1);
+            // an extra value below 2 takes only k - 1 bits.
+            // written to become conditional moves, the branch is unpredictable.
+            x += (extraBits > 1) ? extraBits - 1 : 0;
+            bits += (extraBits > 1) ? k : k - 1;
         }
+
+        skipbits(alac, bits);
     }
 
     return x;
 }
 
-static void entropy_rice_decode(alac_file* alac,
-                         int32_t* outputBuffer,
-                         int outputSize,
-                         int readSampleSize,
-                         int rice_initialhistory,
-                         int rice_kmodifier,
-                         int rice_historymult,
-                         int rice_kmodifier_mask)
+/* inlined into every caller, so constant arguments specialise it */
+ALAC_ALWAYS_INLINE void entropy_rice_decode_inline(alac_file* alac,
+                                int32_t* outputBuffer,
+                                int outputSize,
+                                int readSampleSize,
+                                int rice_initialhistory,
+                                int rice_kmodifier,
+                                int rice_historymult,
+                                int rice_kmodifier_mask)
 {
     int             outputCount;
     int             history = rice_initialhistory;
@@ -407,11 +432,12 @@ static void entropy_rice_decode(alac_file* alac,
             // note: blockSize is always 16bit
             blockSize = entropy_decode_value(alac, 16, k, rice_kmodifier_mask);
 
-            // got blockSize 0s
+            // got blockSize 0s, a corrupt size must not run past the buffer
             if (blockSize > 0)
             {
-                memset(&outputBuffer[outputCount + 1], 0, blockSize * sizeof(*outputBuffer));
-                outputCount += blockSize;
+                int zeros = (blockSize < outputSize - outputCount - 1) ? blockSize : outputSize - outputCount - 1;
+                memset(&outputBuffer[outputCount + 1], 0, zeros * sizeof(*outputBuffer));
+                outputCount += zeros;
             }
 
             if (blockSize > 0xFFFF)
@@ -422,292 +448,63 @@ static void entropy_rice_decode(alac_file* alac,
     }
 }
 
-#define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
-
-#define SIGN_ONLY(v) \
-                     ((v < 0) ? (-1) : \
-                                ((v > 0) ? (1) : \
-                                           (0)))
-
-static void predictor_decompress_fir_adapt(int32_t *error_buffer,
-                                           int32_t *buffer_out,
-                                           int output_size,
-                                           int readsamplesize,
-                                           int16_t *predictor_coef_table,
-                                           int predictor_coef_num,
-                                           int predictor_quantitization)
+static void entropy_rice_decode(alac_file* alac,
+                         int32_t* outputBuffer,
+                         int outputSize,
+                         int readSampleSize,
+                         int rice_initialhistory,
+                         int rice_kmodifier,
+                         int rice_historymult,
+                         int rice_kmodifier_mask)
 {
-    int i;
-
-    /* first sample always copies */
-    *buffer_out = *error_buffer;
-
-    if (!predictor_coef_num)
-    {
-        if (output_size <= 1) return;
-        memcpy(buffer_out+1, error_buffer+1, (output_size-1) * 4);
-        return;
-    }
-
-    if (predictor_coef_num == 0x1f) /* 11111 - max value of predictor_coef_num */
-    { /* second-best case scenario for fir decompression,
-       * error describes a small difference from the previous sample only
-       */
-        if (output_size <= 1) return;
-        for (i = 0; i < output_size - 1; i++)
-        {
-            int32_t prev_value;
-            int32_t error_value;
-
-            prev_value = buffer_out[i];
-            error_value = error_buffer[i+1];
-            buffer_out[i+1] = SIGN_EXTENDED32((prev_value + error_value), readsamplesize);
-        }
-        return;
-    }
-
-    /* read warm-up samples */
-    if (predictor_coef_num > 0)
-    {
-        int i;
-        for (i = 0; i < predictor_coef_num; i++)
-        {
-            int32_t val;
-
-            val = buffer_out[i] + error_buffer[i+1];
-
-            val = SIGN_EXTENDED32(val, readsamplesize);
-
-            buffer_out[i+1] = val;
-        }
-    }
-
-#if 0
-    /* 4 and 8 are very common cases (the only ones i've seen). these
-     * should be unrolled and optimised
-     */
-    if (predictor_coef_num == 4)
-    {
-        /* FIXME: optimised general case */
-        return;
-    }
-
-    if (predictor_coef_table == 8)
-    {
-        /* FIXME: optimised general case */
-        return;
-    }
-#endif
-
-
-    /* general case */
-    if (predictor_coef_num > 0)
-    {
-        for (i = predictor_coef_num + 1;
-             i < output_size;
-             i++)
-        {
-            int j;
-            int sum = 0;
-            int outval;
-            int error_val = error_buffer[i];
-
-            for (j = 0; j < predictor_coef_num; j++)
-            {
-                sum += (buffer_out[predictor_coef_num-j] - buffer_out[0]) *
-                       predictor_coef_table[j];
-            }
-
-            outval = (1 << (predictor_quantitization-1)) + sum;
-            outval = outval >> predictor_quantitization;
-            outval = outval + buffer_out[0] + error_val;
-            outval = SIGN_EXTENDED32(outval, readsamplesize);
-
-            buffer_out[predictor_coef_num+1] = outval;
-
-            if (error_val > 0)
-            {
-                int predictor_num = predictor_coef_num - 1;
-
-                while (predictor_num >= 0 && error_val > 0)
-                {
-                    int val = buffer_out[0] - buffer_out[predictor_coef_num - predictor_num];
-                    int sign = SIGN_ONLY(val);
-
-                    predictor_coef_table[predictor_num] -= sign;
-
-                    val *= sign; /* absolute value */
-
-                    error_val -= ((val >> predictor_quantitization) *
-                                  (predictor_coef_num - predictor_num));
-
-                    predictor_num--;
-                }
-            }
-            else if (error_val < 0)
-            {
-                int predictor_num = predictor_coef_num - 1;
-
-                while (predictor_num >= 0 && error_val < 0)
-                {
-                    int val = buffer_out[0] - buffer_out[predictor_coef_num - predictor_num];
-                    int sign = - SIGN_ONLY(val);
-
-                    predictor_coef_table[predictor_num] -= sign;
-
-                    val *= sign; /* neg value */
-
-                    error_val -= ((val >> predictor_quantitization) *
-                                  (predictor_coef_num - predictor_num));
+    entropy_rice_decode_inline(alac, outputBuffer, outputSize, readSampleSize,
+                               rice_initialhistory, rice_kmodifier,
+                               rice_historymult, rice_kmodifier_mask);
+}
 
-                    predictor_num--;
-                }
-            }
+#define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
 
-            buffer_out++;
-        }
-    }
+static int output_bytes(alac_file *alac, int outputsamples)
+{
+    if (alac->output_format == ALAC_OUTPUT_PLANAR_FLOAT)
+        return outputsamples * alac->numchannels * sizeof(float);
+    return outputsamples * alac->bytespersample;
 }
 
-static void deinterlace_16(int32_t *buffer_a, int32_t *buffer_b,
-                    int16_t *buffer_out,
-                    int numchannels, int numsamples,
-                    uint8_t interlacing_shift,
-                    uint8_t interlacing_leftweight)
+/* full scale of the stream maps to [-1, 1) */
+static float output_scale(alac_file *alac)
 {
-    int i;
-    if (numsamples <= 0) return;
-
-    /* weighted interlacing */
-    if (interlacing_leftweight)
-    {
-        for (i = 0; i < numsamples; i++)
-        {
-            int32_t difference, midright;
-            int16_t left;
-            int16_t right;
-
-            midright = buffer_a[i];
-            difference = buffer_b[i];
-
-
-            right = midright - ((difference * interlacing_leftweight) >> interlacing_shift);
-            left = right + difference;
-
-            /* output is always little endian */
-            if (host_bigendian)
-            {
-                _Swap16(left);
-                _Swap16(right);
-            }
-
-            buffer_out[i*numchannels] = left;
-            buffer_out[i*numchannels + 1] = right;
-        }
-
-        return;
-    }
-
-    /* otherwise basic interlacing took place */
-    for (i = 0; i < numsamples; i++)
-    {
-        int16_t left, right;
-
-        left = buffer_a[i];
-        right = buffer_b[i];
-
-        /* output is always little endian */
-        if (host_bigendian)
-        {
-            _Swap16(left);
-            _Swap16(right);
-        }
-
-        buffer_out[i*numchannels] = left;
-        buffer_out[i*numchannels + 1] = right;
-    }
+    return 1.0f / (float)(1u << (alac->setinfo_sample_size - 1));
 }
 
-static void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
-                    int uncompressed_bytes,
-                    int32_t *uncompressed_bytes_buffer_a, int32_t *uncompressed_bytes_buffer_b,
-                    void *buffer_out,
-                    int numchannels, int numsamples,
-                    uint8_t interlacing_shift,
-                    uint8_t interlacing_leftweight)
+/* a mono frame goes to every plane */
+static void output_planar_float_mono(alac_file *alac, float *outbuffer,
+                                     int outputsamples, int uncompressed_bytes)
 {
-    int i;
-    if (numsamples <= 0) return;
+    const float scale = output_scale(alac);
+    int i, c;
 
-    /* weighted interlacing */
-    if (interlacing_leftweight)
+    for (i = 0; i < outputsamples; i++)
     {
-        for (i = 0; i < numsamples; i++)
-        {
-            int32_t difference, midright;
-            int32_t left;
-            int32_t right;
-
-            midright = buffer_a[i];
-            difference = buffer_b[i];
-
-            right = midright - ((difference * interlacing_leftweight) >> interlacing_shift);
-            left = right + difference;
-
-            if (uncompressed_bytes)
-            {
-                uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
-                left <<= (uncompressed_bytes * 8);
-                right <<= (uncompressed_bytes * 8);
-
-                left |= uncompressed_bytes_buffer_a[i] & mask;
-                right |= uncompressed_bytes_buffer_b[i] & mask;
-            }
-
-            ((uint8_t*)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
-
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
-            ((uint8_t*)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
-        }
-
-        return;
-    }
-
-    /* otherwise basic interlacing took place */
-    for (i = 0; i < numsamples; i++)
-    {
-        int32_t left, right;
-
-        left = buffer_a[i];
-        right = buffer_b[i];
+        int32_t sample = alac->outputsamples_buffer_a[i];
 
         if (uncompressed_bytes)
         {
-            uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
-            left <<= (uncompressed_bytes * 8);
-            right <<= (uncompressed_bytes * 8);
-
-            left |= uncompressed_bytes_buffer_a[i] & mask;
-            right |= uncompressed_bytes_buffer_b[i] & mask;
+            uint32_t mask;
+            sample = sample << (uncompressed_bytes * 8);
+            mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
+            sample |= alac->uncompressed_bytes_buffer_a[i] & mask;
         }
 
-        ((uint8_t*)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
-
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
-        ((uint8_t*)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
-
+        outbuffer[i] = (float)sample * scale;
     }
 
+    for (c = 1; c < alac->numchannels; c++)
+        memcpy(outbuffer + c * outputsamples, outbuffer, outputsamples * sizeof(float));
 }
 
 void alac_decode_frame(alac_file *alac,
-                       unsigned char *inbuffer,
+                       unsigned char *inbuffer, int inputsize,
                        void *outbuffer, int *outputsize)
 {
     int channels;
@@ -715,11 +512,13 @@ void alac_decode_frame(alac_file *alac,
 
     /* setup the stream */
     alac->input_buffer = inbuffer;
-    alac->input_buffer_bitaccumulator = 0;
+    alac->input_buffer_end = inbuffer + inputsize;
+    alac->input_bitcache = 0;
+    alac->input_bitcount = 0;
 
     channels = readbits(alac, 3);
 
-    *outputsize = outputsamples * alac->bytespersample;
+    *outputsize = output_bytes(alac, outputsamples);
 
     switch(channels)
     {
@@ -750,7 +549,7 @@ void alac_decode_frame(alac_file *alac,
             /* now read the number of samples,
              * as a 32bit integer */
             outputsamples = readbits(alac, 32);
-            *outputsize = outputsamples * alac->bytespersample;
+            *outputsize = output_bytes(alac, outputsamples);
         }
 
         readsamplesize = alac->setinfo_sample_size - (uncompressed_bytes * 8);
@@ -800,13 +599,14 @@ void alac_decode_frame(alac_file *alac,
 
             if (prediction_type == 0)
             { /* adaptive fir */
-                predictor_decompress_fir_adapt(alac->predicterror_buffer_a,
-                                               alac->outputsamples_buffer_a,
-                                               outputsamples,
-                                               readsamplesize,
-                                               predictor_coef_table,
-                                               predictor_coef_num,
-                                               prediction_quantitization);
+                alac_fir_predict(alac->fir_run,
+                                 alac->predicterror_buffer_a,
+                                 alac->outputsamples_buffer_a,
+                                 outputsamples,
+                                 readsamplesize,
+                                 predictor_coef_table,
+                                 predictor_coef_num,
+                                 prediction_quantitization);
             }
             else
             {
@@ -854,6 +654,12 @@ void alac_decode_frame(alac_file *alac,
             uncompressed_bytes = 0; // always 0 for uncompressed
         }
 
+        if (alac->output_format == ALAC_OUTPUT_PLANAR_FLOAT)
+        {
+            output_planar_float_mono(alac, outbuffer, outputsamples, uncompressed_bytes);
+            break;
+        }
+
         switch(alac->setinfo_sample_size)
         {
         case 16:
@@ -927,7 +733,7 @@ void alac_decode_frame(alac_file *alac,
             /* now read the number of samples,
              * as a 32bit integer */
             outputsamples = readbits(alac, 32);
-            *outputsize = outputsamples * alac->bytespersample;
+            *outputsize = output_bytes(alac, outputsamples);
         }
 
         readsamplesize = alac->setinfo_sample_size - (uncompressed_bytes * 8) + 1;
@@ -1000,13 +806,14 @@ void alac_decode_frame(alac_file *alac,
 
             if (prediction_type_a == 0)
             { /* adaptive fir */
-                predictor_decompress_fir_adapt(alac->predicterror_buffer_a,
-                                               alac->outputsamples_buffer_a,
-                                               outputsamples,
-                                               readsamplesize,
-                                               predictor_coef_table_a,
-                                               predictor_coef_num_a,
-                                               prediction_quantitization_a);
+                alac_fir_predict(alac->fir_run,
+                                 alac->predicterror_buffer_a,
+                                 alac->outputsamples_buffer_a,
+                                 outputsamples,
+                                 readsamplesize,
+                                 predictor_coef_table_a,
+                                 predictor_coef_num_a,
+                                 prediction_quantitization_a);
             }
             else
             { /* see mono case */
@@ -1025,13 +832,14 @@ void alac_decode_frame(alac_file *alac,
 
             if (prediction_type_b == 0)
             { /* adaptive fir */
-                predictor_decompress_fir_adapt(alac->predicterror_buffer_b,
-                                               alac->outputsamples_buffer_b,
-                                               outputsamples,
-                                               readsamplesize,
-                                               predictor_coef_table_b,
-                                               predictor_coef_num_b,
-                                               prediction_quantitization_b);
+                alac_fir_predict(alac->fir_run,
+                                 alac->predicterror_buffer_b,
+                                 alac->outputsamples_buffer_b,
+                                 outputsamples,
+                                 readsamplesize,
+                                 predictor_coef_table_b,
+                                 predictor_coef_num_b,
+                                 prediction_quantitization_b);
             }
             else
             {
@@ -1083,31 +891,68 @@ void alac_decode_frame(alac_file *alac,
             interlacing_leftweight = 0;
         }
 
+        if (alac->output_format == ALAC_OUTPUT_PLANAR_FLOAT)
+        {
+            float *planes = outbuffer;
+
+            alac->deinterlace_float(alac->outputsamples_buffer_a,
+                                    alac->outputsamples_buffer_b,
+                                    uncompressed_bytes,
+                                    alac->uncompressed_bytes_buffer_a,
+                                    alac->uncompressed_bytes_buffer_b,
+                                    planes,
+                                    planes + outputsamples,
+                                    outputsamples,
+                                    interlacing_shift,
+                                    interlacing_leftweight,
+                                    output_scale(alac));
+            break;
+        }
+
         switch(alac->setinfo_sample_size)
         {
         case 16:
         {
-            deinterlace_16(alac->outputsamples_buffer_a,
-                           alac->outputsamples_buffer_b,
-                           (int16_t*)outbuffer,
-                           alac->numchannels,
-                           outputsamples,
-                           interlacing_shift,
-                           interlacing_leftweight);
+            if (alac->numchannels == 2 && !host_bigendian)
+                alac->deinterlace_16(alac->outputsamples_buffer_a,
+                                     alac->outputsamples_buffer_b,
+                                     (int16_t*)outbuffer,
+                                     outputsamples,
+                                     interlacing_shift,
+                                     interlacing_leftweight);
+            else
+                alac_deinterlace_16_reference(alac->outputsamples_buffer_a,
+                                              alac->outputsamples_buffer_b,
+                                              (int16_t*)outbuffer,
+                                              alac->numchannels,
+                                              outputsamples,
+                                              interlacing_shift,
+                                              interlacing_leftweight);
             break;
         }
         case 24:
         {
-            deinterlace_24(alac->outputsamples_buffer_a,
-                           alac->outputsamples_buffer_b,
-                           uncompressed_bytes,
-                           alac->uncompressed_bytes_buffer_a,
-                           alac->uncompressed_bytes_buffer_b,
-                           (int16_t*)outbuffer,
-                           alac->numchannels,
-                           outputsamples,
-                           interlacing_shift,
-                           interlacing_leftweight);
+            if (alac->numchannels == 2)
+                alac->deinterlace_24(alac->outputsamples_buffer_a,
+                                     alac->outputsamples_buffer_b,
+                                     uncompressed_bytes,
+                                     alac->uncompressed_bytes_buffer_a,
+                                     alac->uncompressed_bytes_buffer_b,
+                                     (uint8_t*)outbuffer,
+                                     outputsamples,
+                                     interlacing_shift,
+                                     interlacing_leftweight);
+            else
+                alac_deinterlace_24_reference(alac->outputsamples_buffer_a,
+                                              alac->outputsamples_buffer_b,
+                                              uncompressed_bytes,
+                                              alac->uncompressed_bytes_buffer_a,
+                                              alac->uncompressed_bytes_buffer_b,
+                                              outbuffer,
+                                              alac->numchannels,
+                                              outputsamples,
+                                              interlacing_shift,
+                                              interlacing_leftweight);
             break;
         }
         case 20:
@@ -1123,6 +968,152 @@ void alac_decode_frame(alac_file *alac,
     }
 }
 
+/* RAOP profile, what AirPlay senders use: stereo, 16 bit, 352 samples per frame
+ * and rice parameters 40/10/14. They are constants here, so the entropy decoder
+ * is specialised for them. Frames of any other shape go to alac_decode_frame.
+ */
+#define RAOP_FRAME_SAMPLES          352
+#define RAOP_SAMPLE_SIZE            16
+#define RAOP_RICE_HISTORYMULT       40
+#define RAOP_RICE_INITIALHISTORY    10
+#define RAOP_RICE_KMODIFIER         14
+
+static void decode_frame_raop(alac_file *alac,
+                              unsigned char *inbuffer, int inputsize,
+                              void *outbuffer, int *outputsize)
+{
+    uint32_t header;
+
+    uint8_t interlacing_shift;
+    uint8_t interlacing_leftweight;
+
+    int16_t predictor_coef_table_a[32];
+    int predictor_coef_num_a;
+    int prediction_type_a;
+    int prediction_quantitization_a;
+    int ricemodifier_a;
+
+    int16_t predictor_coef_table_b[32];
+    int predictor_coef_num_b;
+    int prediction_type_b;
+    int prediction_quantitization_b;
+    int ricemodifier_b;
+
+    int i;
+
+    /* setup the stream */
+    alac->input_buffer = inbuffer;
+    alac->input_buffer_end = inbuffer + inputsize;
+    alac->input_bitcache = 0;
+    alac->input_bitcount = 0;
+
+    /* 2 channels (3 bits), unknown (16), no sample count (1),
+     * no uncompressed bytes (2), compressed (1)
+     */
+    header = readbits(alac, 23);
+    if ((header >> 20) != 1 || (header & 0xF) != 0)
+    {
+        alac_decode_frame(alac, inbuffer, inputsize, outbuffer, outputsize);
+        return;
+    }
+
+    interlacing_shift = readbits(alac, 8);
+    interlacing_leftweight = readbits(alac, 8);
+
+    /******** channel 1 ***********/
+    prediction_type_a = readbits(alac, 4);
+    prediction_quantitization_a = readbits(alac, 4);
+
+    ricemodifier_a = readbits(alac, 3);
+    predictor_coef_num_a = readbits(alac, 5);
+
+    for (i = 0; i < predictor_coef_num_a; i++)
+    {
+        predictor_coef_table_a[i] = (int16_t)readbits(alac, 16);
+    }
+
+    /******** channel 2 *********/
+    prediction_type_b = readbits(alac, 4);
+    prediction_quantitization_b = readbits(alac, 4);
+
+    ricemodifier_b = readbits(alac, 3);
+    predictor_coef_num_b = readbits(alac, 5);
+
+    for (i = 0; i < predictor_coef_num_b; i++)
+    {
+        predictor_coef_table_b[i] = (int16_t)readbits(alac, 16);
+    }
+
+    /* only the adaptive fir is known */
+    if (prediction_type_a != 0 || prediction_type_b != 0)
+    {
+        alac_decode_frame(alac, inbuffer, inputsize, outbuffer, outputsize);
+        return;
+    }
+
+    *outputsize = RAOP_FRAME_SAMPLES * 2 * sizeof(int16_t);
+
+    entropy_rice_decode_inline(alac,
+                               alac->predicterror_buffer_a,
+                               RAOP_FRAME_SAMPLES,
+                               RAOP_SAMPLE_SIZE + 1,
+                               RAOP_RICE_INITIALHISTORY,
+                               RAOP_RICE_KMODIFIER,
+                               ricemodifier_a * RAOP_RICE_HISTORYMULT / 4,
+                               (1 << RAOP_RICE_KMODIFIER) - 1);
+
+    alac_fir_predict(alac->fir_run,
+                     alac->predicterror_buffer_a,
+                     alac->outputsamples_buffer_a,
+                     RAOP_FRAME_SAMPLES,
+                     RAOP_SAMPLE_SIZE + 1,
+                     predictor_coef_table_a,
+                     predictor_coef_num_a,
+                     prediction_quantitization_a);
+
+    entropy_rice_decode_inline(alac,
+                               alac->predicterror_buffer_b,
+                               RAOP_FRAME_SAMPLES,
+                               RAOP_SAMPLE_SIZE + 1,
+                               RAOP_RICE_INITIALHISTORY,
+                               RAOP_RICE_KMODIFIER,
+                               ricemodifier_b * RAOP_RICE_HISTORYMULT / 4,
+                               (1 << RAOP_RICE_KMODIFIER) - 1);
+
+    alac_fir_predict(alac->fir_run,
+                     alac->predicterror_buffer_b,
+                     alac->outputsamples_buffer_b,
+                     RAOP_FRAME_SAMPLES,
+                     RAOP_SAMPLE_SIZE + 1,
+                     predictor_coef_table_b,
+                     predictor_coef_num_b,
+                     prediction_quantitization_b);
+
+    alac->deinterlace_16(alac->outputsamples_buffer_a,
+                         alac->outputsamples_buffer_b,
+                         (int16_t*)outbuffer,
+                         RAOP_FRAME_SAMPLES,
+                         interlacing_shift,
+                         interlacing_leftweight);
+}
+
+alac_decode_frame_fn alac_select_decoder(alac_file *alac)
+{
+    if (!host_bigendian &&
+        alac->numchannels == 2 &&
+        alac->bytespersample == 2 * sizeof(int16_t) &&
+        alac->output_format == ALAC_OUTPUT_INTERLEAVED &&
+        alac->setinfo_max_samples_per_frame == RAOP_FRAME_SAMPLES &&
+        alac->setinfo_sample_size == RAOP_SAMPLE_SIZE &&
+        alac->setinfo_rice_historymult == RAOP_RICE_HISTORYMULT &&
+        alac->setinfo_rice_initialhistory == RAOP_RICE_INITIALHISTORY &&
+        alac->setinfo_rice_kmodifier == RAOP_RICE_KMODIFIER)
+    {
+        return decode_frame_raop;
+    }
+    return alac_decode_frame;
+}
+
 alac_file *alac_create(int samplesize, int numchannels)
 {
     alac_file *newfile = malloc(sizeof(alac_file));
@@ -1132,6 +1123,10 @@ alac_file *alac_create(int samplesize, int numchannels)
     newfile->samplesize = samplesize;
     newfile->numchannels = numchannels;
     newfile->bytespersample = (samplesize / 8) * numchannels;
+    newfile->fir_run = alac_fir_best_kernel().run;
+    newfile->deinterlace_16 = alac_deinterlace_best_kernel().deinterlace_16;
+    newfile->deinterlace_24 = alac_deinterlace_best_kernel().deinterlace_24;
+    newfile->deinterlace_float = alac_deinterlace_best_kernel().deinterlace_float;
 
     return newfile;
 }
@@ -3,30 +3,54 @@
 
 #include <stdint.h>
 
+#include "alac_fir.h"
+#include "alac_deinterlace.h"
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
 typedef struct alac_file alac_file;
 
+/* alac_file.output_format */
+#define ALAC_OUTPUT_INTERLEAVED     0 /* samplesize bits, interleaved, little endian */
+#define ALAC_OUTPUT_PLANAR_FLOAT    1 /* float in [-1, 1), one plane per channel, back to back */
+
 alac_file *alac_create(int samplesize, int numchannels);
 void alac_decode_frame(alac_file *alac,
-                       unsigned char *inbuffer,
+                       unsigned char *inbuffer, int inputsize,
                        void *outbuffer, int *outputsize);
+typedef void (*alac_decode_frame_fn)(alac_file *alac,
+                                     unsigned char *inbuffer, int inputsize,
+                                     void *outbuffer, int *outputsize);
+/* Decoder specialised for the stream set up in alac if there is one, else
+ * alac_decode_frame. Call after setting it up, frames it does not expect
+ * go to alac_decode_frame.
+ */
+alac_decode_frame_fn alac_select_decoder(alac_file *alac);
 void alac_set_info(alac_file *alac, char *inputbuffer);
 void alac_allocate_buffers(alac_file *alac);
 void alac_free(alac_file *alac);
 
 struct alac_file
 {
-    unsigned char *input_buffer;
-    int input_buffer_bitaccumulator; /* used so we can do arbitary
-                                        bit reads */
+    unsigned char *input_buffer; /* next byte to load into the bit cache */
+    unsigned char *input_buffer_end;
+    uint64_t input_bitcache; /* upcoming bits, msb first, so we can do
+                                arbitary bit reads */
+    int input_bitcount; /* valid bits in input_bitcache */
 
     int samplesize;
     int numchannels;
     int bytespersample;
+    int output_format; /* ALAC_OUTPUT_*, interleaved by default */
 
+    /* predictor general case, fastest kernel for this cpu */
+    alac_fir_run_fn fir_run;
+    /* stereo output, fastest kernels for this cpu */
+    alac_deinterlace_16_fn deinterlace_16;
+    alac_deinterlace_24_fn deinterlace_24;
+    alac_deinterlace_float_fn deinterlace_float;
 
     /* buffers */
     int32_t *predicterror_buffer_a;
@@ -0,0 +1,785 @@
+/*
+ * ALAC (Apple Lossless Audio Codec) decoder
+ * Copyright (c) 2005 David Hammerton
+ * All rights reserved.
+ *
+ * Stereo deinterlacing, with vectorized kernels.
+ *
+ * http://crazney.net/programs/itunes/alac.html
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "alac_deinterlace.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define ALAC_DEINTERLACE_X86
+    #include <immintrin.h>
+#endif
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)) && !defined(__ARM_BIG_ENDIAN)
+    #define ALAC_DEINTERLACE_NEON
+    #include <arm_neon.h>
+#endif
+
+static const int host_bigendian = 0;
+
+#define _Swap16(v) do { \
+                   v = (((v) & 0x00FF) << 0x08) | \
+                       (((v) & 0xFF00) >> 0x08); } while (0)
+
+/* The vector kernels do 8 or 16 frames at a time and leave the rest to the
+ * reference. Stores are unaligned, which costs nothing on the cache line
+ * aligned RtpBuffer slots.
+ */
+
+static void deinterlace_16_scalar(const int32_t *buffer_a,
+                                  const int32_t *buffer_b,
+                                  int16_t *buffer_out,
+                                  int numsamples,
+                                  uint8_t interlacing_shift,
+                                  uint8_t interlacing_leftweight)
+{
+    alac_deinterlace_16_reference(buffer_a, buffer_b, buffer_out, 2, numsamples,
+                                  interlacing_shift, interlacing_leftweight);
+}
+
+static void deinterlace_24_scalar(const int32_t *buffer_a,
+                                  const int32_t *buffer_b,
+                                  int uncompressed_bytes,
+                                  const int32_t *uncompressed_bytes_buffer_a,
+                                  const int32_t *uncompressed_bytes_buffer_b,
+                                  uint8_t *buffer_out,
+                                  int numsamples,
+                                  uint8_t interlacing_shift,
+                                  uint8_t interlacing_leftweight)
+{
+    alac_deinterlace_24_reference(buffer_a, buffer_b, uncompressed_bytes,
+                                  uncompressed_bytes_buffer_a, uncompressed_bytes_buffer_b,
+                                  buffer_out, 2, numsamples,
+                                  interlacing_shift, interlacing_leftweight);
+}
+
+static void deinterlace_float_scalar(const int32_t *buffer_a,
+                                     const int32_t *buffer_b,
+                                     int uncompressed_bytes,
+                                     const int32_t *uncompressed_bytes_buffer_a,
+                                     const int32_t *uncompressed_bytes_buffer_b,
+                                     float *buffer_out_a,
+                                     float *buffer_out_b,
+                                     int numsamples,
+                                     uint8_t interlacing_shift,
+                                     uint8_t interlacing_leftweight,
+                                     float scale)
+{
+    alac_deinterlace_float_reference(buffer_a, buffer_b, uncompressed_bytes,
+                                     uncompressed_bytes_buffer_a, uncompressed_bytes_buffer_b,
+                                     buffer_out_a, buffer_out_b, numsamples,
+                                     interlacing_shift, interlacing_leftweight, scale);
+}
+
+#ifdef ALAC_DEINTERLACE_X86
+/* left and right of 4 frames to 8 interleaved int16, truncated like the casts */
+__attribute__((target("sse4.1")))
+static inline __m128i pack_16_sse41(__m128i left, __m128i right)
+{
+    __m128i low = _mm_unpacklo_epi32(left, right);
+    __m128i high = _mm_unpackhi_epi32(left, right);
+
+    low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+    high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+    return _mm_packs_epi32(low, high);
+}
+
+/* right = mid - ((difference * weight) >> shift), left = right + difference */
+__attribute__((target("sse4.1")))
+static inline void unmix_sse41(__m128i *left, __m128i *right,
+                               __m128i weight, __m128i shift)
+{
+    __m128i difference = *right;
+
+    *right = _mm_sub_epi32(*left, _mm_sra_epi32(_mm_mullo_epi32(difference, weight), shift));
+    *left = _mm_add_epi32(*right, difference);
+}
+
+/* sample << shift | (uncompressed & mask) */
+__attribute__((target("sse4.1")))
+static inline __m128i merge_sse41(__m128i samples, const int32_t *uncompressed,
+                                  __m128i shift, __m128i mask)
+{
+    return _mm_or_si128(_mm_sll_epi32(samples, shift),
+                        _mm_and_si128(_mm_loadu_si128((const __m128i *)uncompressed), mask));
+}
+
+__attribute__((target("sse4.1")))
+static void deinterlace_16_sse41(const int32_t *buffer_a,
+                                 const int32_t *buffer_b,
+                                 int16_t *buffer_out,
+                                 int numsamples,
+                                 uint8_t interlacing_shift,
+                                 uint8_t interlacing_leftweight)
+{
+    const __m128i weight = _mm_set1_epi32(interlacing_leftweight);
+    const __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        __m128i left0 = _mm_loadu_si128((const __m128i *)(buffer_a + i));
+        __m128i left1 = _mm_loadu_si128((const __m128i *)(buffer_a + i + 4));
+        __m128i right0 = _mm_loadu_si128((const __m128i *)(buffer_b + i));
+        __m128i right1 = _mm_loadu_si128((const __m128i *)(buffer_b + i + 4));
+
+        if (interlacing_leftweight)
+        {
+            unmix_sse41(&left0, &right0, weight, shift);
+            unmix_sse41(&left1, &right1, weight, shift);
+        }
+
+        _mm_storeu_si128((__m128i *)(buffer_out + 2*i), pack_16_sse41(left0, right0));
+        _mm_storeu_si128((__m128i *)(buffer_out + 2*i + 8), pack_16_sse41(left1, right1));
+    }
+
+    alac_deinterlace_16_reference(buffer_a + i, buffer_b + i, buffer_out + 2*i, 2, numsamples - i,
+                                  interlacing_shift, interlacing_leftweight);
+}
+
+/* low 3 bytes of 4 samples into the low 12 bytes */
+__attribute__((target("sse4.1")))
+static inline __m128i compact_24_sse41(__m128i samples)
+{
+    const __m128i bytes = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    return _mm_shuffle_epi8(samples, bytes);
+}
+
+__attribute__((target("sse4.1")))
+static void deinterlace_24_sse41(const int32_t *buffer_a,
+                                 const int32_t *buffer_b,
+                                 int uncompressed_bytes,
+                                 const int32_t *uncompressed_bytes_buffer_a,
+                                 const int32_t *uncompressed_bytes_buffer_b,
+                                 uint8_t *buffer_out,
+                                 int numsamples,
+                                 uint8_t interlacing_shift,
+                                 uint8_t interlacing_leftweight)
+{
+    const __m128i weight = _mm_set1_epi32(interlacing_leftweight);
+    const __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    const __m128i uncompressed_shift = _mm_cvtsi32_si128(uncompressed_bytes * 8);
+    const __m128i uncompressed_mask = _mm_set1_epi32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        __m128i left0 = _mm_loadu_si128((const __m128i *)(buffer_a + i));
+        __m128i left1 = _mm_loadu_si128((const __m128i *)(buffer_a + i + 4));
+        __m128i right0 = _mm_loadu_si128((const __m128i *)(buffer_b + i));
+        __m128i right1 = _mm_loadu_si128((const __m128i *)(buffer_b + i + 4));
+        __m128i packed0, packed1, packed2, packed3;
+
+        if (interlacing_leftweight)
+        {
+            unmix_sse41(&left0, &right0, weight, shift);
+            unmix_sse41(&left1, &right1, weight, shift);
+        }
+
+        if (uncompressed_bytes)
+        {
+            left0 = merge_sse41(left0, uncompressed_bytes_buffer_a + i, uncompressed_shift, uncompressed_mask);
+            left1 = merge_sse41(left1, uncompressed_bytes_buffer_a + i + 4, uncompressed_shift, uncompressed_mask);
+            right0 = merge_sse41(right0, uncompressed_bytes_buffer_b + i, uncompressed_shift, uncompressed_mask);
+            right1 = merge_sse41(right1, uncompressed_bytes_buffer_b + i + 4, uncompressed_shift, uncompressed_mask);
+        }
+
+        /* 8 frames are 48 bytes, stitched from four groups of 12 */
+        packed0 = compact_24_sse41(_mm_unpacklo_epi32(left0, right0));
+        packed1 = compact_24_sse41(_mm_unpackhi_epi32(left0, right0));
+        packed2 = compact_24_sse41(_mm_unpacklo_epi32(left1, right1));
+        packed3 = compact_24_sse41(_mm_unpackhi_epi32(left1, right1));
+
+        _mm_storeu_si128((__m128i *)(buffer_out + 6*i),
+                         _mm_or_si128(packed0, _mm_slli_si128(packed1, 12)));
+        _mm_storeu_si128((__m128i *)(buffer_out + 6*i + 16),
+                         _mm_or_si128(_mm_srli_si128(packed1, 4), _mm_slli_si128(packed2, 8)));
+        _mm_storeu_si128((__m128i *)(buffer_out + 6*i + 32),
+                         _mm_or_si128(_mm_srli_si128(packed2, 8), _mm_slli_si128(packed3, 4)));
+    }
+
+    alac_deinterlace_24_reference(buffer_a + i, buffer_b + i, uncompressed_bytes,
+                                  uncompressed_bytes_buffer_a + i, uncompressed_bytes_buffer_b + i,
+                                  buffer_out + 6*i, 2, numsamples - i,
+                                  interlacing_shift, interlacing_leftweight);
+}
+
+__attribute__((target("sse4.1")))
+static void deinterlace_float_sse41(const int32_t *buffer_a,
+                                    const int32_t *buffer_b,
+                                    int uncompressed_bytes,
+                                    const int32_t *uncompressed_bytes_buffer_a,
+                                    const int32_t *uncompressed_bytes_buffer_b,
+                                    float *buffer_out_a,
+                                    float *buffer_out_b,
+                                    int numsamples,
+                                    uint8_t interlacing_shift,
+                                    uint8_t interlacing_leftweight,
+                                    float scale)
+{
+    const __m128i weight = _mm_set1_epi32(interlacing_leftweight);
+    const __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    const __m128i uncompressed_shift = _mm_cvtsi32_si128(uncompressed_bytes * 8);
+    const __m128i uncompressed_mask = _mm_set1_epi32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    const __m128 factor = _mm_set1_ps(scale);
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        __m128i left0 = _mm_loadu_si128((const __m128i *)(buffer_a + i));
+        __m128i left1 = _mm_loadu_si128((const __m128i *)(buffer_a + i + 4));
+        __m128i right0 = _mm_loadu_si128((const __m128i *)(buffer_b + i));
+        __m128i right1 = _mm_loadu_si128((const __m128i *)(buffer_b + i + 4));
+
+        if (interlacing_leftweight)
+        {
+            unmix_sse41(&left0, &right0, weight, shift);
+            unmix_sse41(&left1, &right1, weight, shift);
+        }
+
+        if (uncompressed_bytes)
+        {
+            left0 = merge_sse41(left0, uncompressed_bytes_buffer_a + i, uncompressed_shift, uncompressed_mask);
+            left1 = merge_sse41(left1, uncompressed_bytes_buffer_a + i + 4, uncompressed_shift, uncompressed_mask);
+            right0 = merge_sse41(right0, uncompressed_bytes_buffer_b + i, uncompressed_shift, uncompressed_mask);
+            right1 = merge_sse41(right1, uncompressed_bytes_buffer_b + i + 4, uncompressed_shift, uncompressed_mask);
+        }
+
+        _mm_storeu_ps(buffer_out_a + i, _mm_mul_ps(_mm_cvtepi32_ps(left0), factor));
+        _mm_storeu_ps(buffer_out_a + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(left1), factor));
+        _mm_storeu_ps(buffer_out_b + i, _mm_mul_ps(_mm_cvtepi32_ps(right0), factor));
+        _mm_storeu_ps(buffer_out_b + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(right1), factor));
+    }
+
+    alac_deinterlace_float_reference(buffer_a + i, buffer_b + i, uncompressed_bytes,
+                                     uncompressed_bytes_buffer_a + i, uncompressed_bytes_buffer_b + i,
+                                     buffer_out_a + i, buffer_out_b + i, numsamples - i,
+                                     interlacing_shift, interlacing_leftweight, scale);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pack_16_avx2(__m256i left, __m256i right)
+{
+    /* within each half like pack_16_sse41, which keeps the frames in order */
+    __m256i low = _mm256_unpacklo_epi32(left, right);
+    __m256i high = _mm256_unpackhi_epi32(left, right);
+
+    low = _mm256_srai_epi32(_mm256_slli_epi32(low, 16), 16);
+    high = _mm256_srai_epi32(_mm256_slli_epi32(high, 16), 16);
+    return _mm256_packs_epi32(low, high);
+}
+
+__attribute__((target("avx2")))
+static inline void unmix_avx2(__m256i *left, __m256i *right,
+                              __m256i weight, __m128i shift)
+{
+    __m256i difference = *right;
+
+    *right = _mm256_sub_epi32(*left, _mm256_sra_epi32(_mm256_mullo_epi32(difference, weight), shift));
+    *left = _mm256_add_epi32(*right, difference);
+}
+
+__attribute__((target("avx2")))
+static void deinterlace_16_avx2(const int32_t *buffer_a,
+                                const int32_t *buffer_b,
+                                int16_t *buffer_out,
+                                int numsamples,
+                                uint8_t interlacing_shift,
+                                uint8_t interlacing_leftweight)
+{
+    const __m256i weight = _mm256_set1_epi32(interlacing_leftweight);
+    const __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    int i;
+
+    for (i = 0; i + 16 <= numsamples; i += 16)
+    {
+        __m256i left0 = _mm256_loadu_si256((const __m256i *)(buffer_a + i));
+        __m256i left1 = _mm256_loadu_si256((const __m256i *)(buffer_a + i + 8));
+        __m256i right0 = _mm256_loadu_si256((const __m256i *)(buffer_b + i));
+        __m256i right1 = _mm256_loadu_si256((const __m256i *)(buffer_b + i + 8));
+
+        if (interlacing_leftweight)
+        {
+            unmix_avx2(&left0, &right0, weight, shift);
+            unmix_avx2(&left1, &right1, weight, shift);
+        }
+
+        _mm256_storeu_si256((__m256i *)(buffer_out + 2*i), pack_16_avx2(left0, right0));
+        _mm256_storeu_si256((__m256i *)(buffer_out + 2*i + 16), pack_16_avx2(left1, right1));
+    }
+
+    deinterlace_16_sse41(buffer_a + i, buffer_b + i, buffer_out + 2*i, numsamples - i,
+                         interlacing_shift, interlacing_leftweight);
+}
+__attribute__((target("avx2")))
+static void deinterlace_float_avx2(const int32_t *buffer_a,
+                                   const int32_t *buffer_b,
+                                   int uncompressed_bytes,
+                                   const int32_t *uncompressed_bytes_buffer_a,
+                                   const int32_t *uncompressed_bytes_buffer_b,
+                                   float *buffer_out_a,
+                                   float *buffer_out_b,
+                                   int numsamples,
+                                   uint8_t interlacing_shift,
+                                   uint8_t interlacing_leftweight,
+                                   float scale)
+{
+    const __m256i weight = _mm256_set1_epi32(interlacing_leftweight);
+    const __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    const __m128i uncompressed_shift = _mm_cvtsi32_si128(uncompressed_bytes * 8);
+    const __m256i uncompressed_mask = _mm256_set1_epi32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    const __m256 factor = _mm256_set1_ps(scale);
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        __m256i left = _mm256_loadu_si256((const __m256i *)(buffer_a + i));
+        __m256i right = _mm256_loadu_si256((const __m256i *)(buffer_b + i));
+
+        if (interlacing_leftweight)
+        {
+            unmix_avx2(&left, &right, weight, shift);
+        }
+
+        if (uncompressed_bytes)
+        {
+            left = _mm256_or_si256(_mm256_sll_epi32(left, uncompressed_shift),
+                                   _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(uncompressed_bytes_buffer_a + i)), uncompressed_mask));
+            right = _mm256_or_si256(_mm256_sll_epi32(right, uncompressed_shift),
+                                    _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(uncompressed_bytes_buffer_b + i)), uncompressed_mask));
+        }
+
+        _mm256_storeu_ps(buffer_out_a + i, _mm256_mul_ps(_mm256_cvtepi32_ps(left), factor));
+        _mm256_storeu_ps(buffer_out_b + i, _mm256_mul_ps(_mm256_cvtepi32_ps(right), factor));
+    }
+
+    alac_deinterlace_float_reference(buffer_a + i, buffer_b + i, uncompressed_bytes,
+                                     uncompressed_bytes_buffer_a + i, uncompressed_bytes_buffer_b + i,
+                                     buffer_out_a + i, buffer_out_b + i, numsamples - i,
+                                     interlacing_shift, interlacing_leftweight, scale);
+}
+#endif
+
+#ifdef ALAC_DEINTERLACE_NEON
+static inline void unmix_neon(int32x4_t *left, int32x4_t *right,
+                              int32x4_t weight, int32x4_t shift)
+{
+    int32x4_t difference = *right;
+
+    /* shifting left by -shift is an arithmetic shift right */
+    *right = vsubq_s32(*left, vshlq_s32(vmulq_s32(difference, weight), shift));
+    *left = vaddq_s32(*right, difference);
+}
+
+/* sample << shift | (uncompressed & mask) */
+static inline int32x4_t merge_neon(int32x4_t samples, const int32_t *uncompressed,
+                                   int32x4_t shift, int32x4_t mask)
+{
+    return vorrq_s32(vshlq_s32(samples, shift), vandq_s32(vld1q_s32(uncompressed), mask));
+}
+
+static void deinterlace_16_neon(const int32_t *buffer_a,
+                                const int32_t *buffer_b,
+                                int16_t *buffer_out,
+                                int numsamples,
+                                uint8_t interlacing_shift,
+                                uint8_t interlacing_leftweight)
+{
+    const int32x4_t weight = vdupq_n_s32(interlacing_leftweight);
+    const int32x4_t shift = vdupq_n_s32(-interlacing_shift);
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        int32x4_t left0 = vld1q_s32(buffer_a + i);
+        int32x4_t left1 = vld1q_s32(buffer_a + i + 4);
+        int32x4_t right0 = vld1q_s32(buffer_b + i);
+        int32x4_t right1 = vld1q_s32(buffer_b + i + 4);
+        int16x8x2_t frames;
+
+        if (interlacing_leftweight)
+        {
+            unmix_neon(&left0, &right0, weight, shift);
+            unmix_neon(&left1, &right1, weight, shift);
+        }
+
+        /* narrowing truncates like the casts, the store interleaves */
+        frames.val[0] = vcombine_s16(vmovn_s32(left0), vmovn_s32(left1));
+        frames.val[1] = vcombine_s16(vmovn_s32(right0), vmovn_s32(right1));
+        vst2q_s16(buffer_out + 2*i, frames);
+    }
+
+    alac_deinterlace_16_reference(buffer_a + i, buffer_b + i, buffer_out + 2*i, 2, numsamples - i,
+                                  interlacing_shift, interlacing_leftweight);
+}
+
+/* byte number byte of 16 samples */
+static inline uint8x16_t byte_plane_neon(const int32x4x2_t *frames0, const int32x4x2_t *frames1, int byte)
+{
+    const int32x4_t shift = vdupq_n_s32(-8 * byte);
+    uint16x8_t low = vcombine_u16(vmovn_u32(vshlq_u32(vreinterpretq_u32_s32(frames0->val[0]), shift)),
+                                  vmovn_u32(vshlq_u32(vreinterpretq_u32_s32(frames0->val[1]), shift)));
+    uint16x8_t high = vcombine_u16(vmovn_u32(vshlq_u32(vreinterpretq_u32_s32(frames1->val[0]), shift)),
+                                   vmovn_u32(vshlq_u32(vreinterpretq_u32_s32(frames1->val[1]), shift)));
+
+    return vcombine_u8(vmovn_u16(low), vmovn_u16(high));
+}
+
+static void deinterlace_24_neon(const int32_t *buffer_a,
+                                const int32_t *buffer_b,
+                                int uncompressed_bytes,
+                                const int32_t *uncompressed_bytes_buffer_a,
+                                const int32_t *uncompressed_bytes_buffer_b,
+                                uint8_t *buffer_out,
+                                int numsamples,
+                                uint8_t interlacing_shift,
+                                uint8_t interlacing_leftweight)
+{
+    const int32x4_t weight = vdupq_n_s32(interlacing_leftweight);
+    const int32x4_t shift = vdupq_n_s32(-interlacing_shift);
+    const int32x4_t uncompressed_shift = vdupq_n_s32(uncompressed_bytes * 8);
+    const int32x4_t uncompressed_mask = vdupq_n_s32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        int32x4_t left0 = vld1q_s32(buffer_a + i);
+        int32x4_t left1 = vld1q_s32(buffer_a + i + 4);
+        int32x4_t right0 = vld1q_s32(buffer_b + i);
+        int32x4_t right1 = vld1q_s32(buffer_b + i + 4);
+        int32x4x2_t frames0, frames1;
+        uint8x16x3_t planes;
+
+        if (interlacing_leftweight)
+        {
+            unmix_neon(&left0, &right0, weight, shift);
+            unmix_neon(&left1, &right1, weight, shift);
+        }
+
+        if (uncompressed_bytes)
+        {
+            left0 = merge_neon(left0, uncompressed_bytes_buffer_a + i, uncompressed_shift, uncompressed_mask);
+            left1 = merge_neon(left1, uncompressed_bytes_buffer_a + i + 4, uncompressed_shift, uncompressed_mask);
+            right0 = merge_neon(right0, uncompressed_bytes_buffer_b + i, uncompressed_shift, uncompressed_mask);
+            right1 = merge_neon(right1, uncompressed_bytes_buffer_b + i + 4, uncompressed_shift, uncompressed_mask);
+        }
+
+        /* samples in output order, split into their 3 bytes, which the store interleaves */
+        frames0 = vzipq_s32(left0, right0);
+        frames1 = vzipq_s32(left1, right1);
+        planes.val[0] = byte_plane_neon(&frames0, &frames1, 0);
+        planes.val[1] = byte_plane_neon(&frames0, &frames1, 1);
+        planes.val[2] = byte_plane_neon(&frames0, &frames1, 2);
+        vst3q_u8(buffer_out + 6*i, planes);
+    }
+
+    alac_deinterlace_24_reference(buffer_a + i, buffer_b + i, uncompressed_bytes,
+                                  uncompressed_bytes_buffer_a + i, uncompressed_bytes_buffer_b + i,
+                                  buffer_out + 6*i, 2, numsamples - i,
+                                  interlacing_shift, interlacing_leftweight);
+}
+static void deinterlace_float_neon(const int32_t *buffer_a,
+                                   const int32_t *buffer_b,
+                                   int uncompressed_bytes,
+                                   const int32_t *uncompressed_bytes_buffer_a,
+                                   const int32_t *uncompressed_bytes_buffer_b,
+                                   float *buffer_out_a,
+                                   float *buffer_out_b,
+                                   int numsamples,
+                                   uint8_t interlacing_shift,
+                                   uint8_t interlacing_leftweight,
+                                   float scale)
+{
+    const int32x4_t weight = vdupq_n_s32(interlacing_leftweight);
+    const int32x4_t shift = vdupq_n_s32(-interlacing_shift);
+    const int32x4_t uncompressed_shift = vdupq_n_s32(uncompressed_bytes * 8);
+    const int32x4_t uncompressed_mask = vdupq_n_s32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    int i;
+
+    for (i = 0; i + 8 <= numsamples; i += 8)
+    {
+        int32x4_t left0 = vld1q_s32(buffer_a + i);
+        int32x4_t left1 = vld1q_s32(buffer_a + i + 4);
+        int32x4_t right0 = vld1q_s32(buffer_b + i);
+        int32x4_t right1 = vld1q_s32(buffer_b + i + 4);
+
+        if (interlacing_leftweight)
+        {
+            unmix_neon(&left0, &right0, weight, shift);
+            unmix_neon(&left1, &right1, weight, shift);
+        }
+
+        if (uncompressed_bytes)
+        {
+            left0 = merge_neon(left0, uncompressed_bytes_buffer_a + i, uncompressed_shift, uncompressed_mask);
+            left1 = merge_neon(left1, uncompressed_bytes_buffer_a + i + 4, uncompressed_shift, uncompressed_mask);
+            right0 = merge_neon(right0, uncompressed_bytes_buffer_b + i, uncompressed_shift, uncompressed_mask);
+            right1 = merge_neon(right1, uncompressed_bytes_buffer_b + i + 4, uncompressed_shift, uncompressed_mask);
+        }
+
+        vst1q_f32(buffer_out_a + i, vmulq_n_f32(vcvtq_f32_s32(left0), scale));
+        vst1q_f32(buffer_out_a + i + 4, vmulq_n_f32(vcvtq_f32_s32(left1), scale));
+        vst1q_f32(buffer_out_b + i, vmulq_n_f32(vcvtq_f32_s32(right0), scale));
+        vst1q_f32(buffer_out_b + i + 4, vmulq_n_f32(vcvtq_f32_s32(right1), scale));
+    }
+
+    alac_deinterlace_float_reference(buffer_a + i, buffer_b + i, uncompressed_bytes,
+                                     uncompressed_bytes_buffer_a + i, uncompressed_bytes_buffer_b + i,
+                                     buffer_out_a + i, buffer_out_b + i, numsamples - i,
+                                     interlacing_shift, interlacing_leftweight, scale);
+}
+#endif
+
+int alac_deinterlace_kernels(alac_deinterlace_kernel *kernels, int max)
+{
+    int count = 0;
+
+    if (count < max)
+    {
+        kernels[count].name = "scalar";
+        kernels[count].deinterlace_16 = deinterlace_16_scalar;
+        kernels[count].deinterlace_24 = deinterlace_24_scalar;
+        kernels[count++].deinterlace_float = deinterlace_float_scalar;
+    }
+#ifdef ALAC_DEINTERLACE_X86
+    __builtin_cpu_init();
+    if (count < max && __builtin_cpu_supports("sse4.1"))
+    {
+        kernels[count].name = "sse4.1";
+        kernels[count].deinterlace_16 = deinterlace_16_sse41;
+        kernels[count].deinterlace_24 = deinterlace_24_sse41;
+        kernels[count++].deinterlace_float = deinterlace_float_sse41;
+    }
+    if (count < max && __builtin_cpu_supports("avx2"))
+    {
+        /* 24 bit output gains nothing from the wider registers */
+        kernels[count].name = "avx2";
+        kernels[count].deinterlace_16 = deinterlace_16_avx2;
+        kernels[count].deinterlace_24 = deinterlace_24_sse41;
+        kernels[count++].deinterlace_float = deinterlace_float_avx2;
+    }
+#endif
+#ifdef ALAC_DEINTERLACE_NEON
+    if (count < max)
+    {
+        kernels[count].name = "neon";
+        kernels[count].deinterlace_16 = deinterlace_16_neon;
+        kernels[count].deinterlace_24 = deinterlace_24_neon;
+        kernels[count++].deinterlace_float = deinterlace_float_neon;
+    }
+#endif
+    return count;
+}
+
+alac_deinterlace_kernel alac_deinterlace_best_kernel(void)
+{
+    alac_deinterlace_kernel kernels[4];
+    int count = alac_deinterlace_kernels(kernels, 4);
+
+    return kernels[count - 1];
+}
+
+void alac_deinterlace_16_reference(const int32_t *buffer_a, const int32_t *buffer_b,
+                                   int16_t *buffer_out,
+                                   int numchannels, int numsamples,
+                                   uint8_t interlacing_shift,
+                                   uint8_t interlacing_leftweight)
+{
+    int i;
+    if (numsamples <= 0) return;
+
+    /* weighted interlacing */
+    if (interlacing_leftweight)
+    {
+        for (i = 0; i < numsamples; i++)
+        {
+            int32_t difference, midright;
+            int16_t left;
+            int16_t right;
+
+            midright = buffer_a[i];
+            difference = buffer_b[i];
+
+
+            right = midright - ((difference * interlacing_leftweight) >> interlacing_shift);
+            left = right + difference;
+
+            /* output is always little endian */
+            if (host_bigendian)
+            {
+                _Swap16(left);
+                _Swap16(right);
+            }
+
+            buffer_out[i*numchannels] = left;
+            buffer_out[i*numchannels + 1] = right;
+        }
+
+        return;
+    }
+
+    /* otherwise basic interlacing took place */
+    for (i = 0; i < numsamples; i++)
+    {
+        int16_t left, right;
+
+        left = buffer_a[i];
+        right = buffer_b[i];
+
+        /* output is always little endian */
+        if (host_bigendian)
+        {
+            _Swap16(left);
+            _Swap16(right);
+        }
+
+        buffer_out[i*numchannels] = left;
+        buffer_out[i*numchannels + 1] = right;
+    }
+}
+
+void alac_deinterlace_24_reference(const int32_t *buffer_a, const int32_t *buffer_b,
+                                   int uncompressed_bytes,
+                                   const int32_t *uncompressed_bytes_buffer_a, const int32_t *uncompressed_bytes_buffer_b,
+                                   void *buffer_out,
+                                   int numchannels, int numsamples,
+                                   uint8_t interlacing_shift,
+                                   uint8_t interlacing_leftweight)
+{
+    int i;
+    if (numsamples <= 0) return;
+
+    /* weighted interlacing */
+    if (interlacing_leftweight)
+    {
+        for (i = 0; i < numsamples; i++)
+        {
+            int32_t difference, midright;
+            int32_t left;
+            int32_t right;
+
+            midright = buffer_a[i];
+            difference = buffer_b[i];
+
+            right = midright - ((difference * interlacing_leftweight) >> interlacing_shift);
+            left = right + difference;
+
+            if (uncompressed_bytes)
+            {
+                uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
+                left <<= (uncompressed_bytes * 8);
+                right <<= (uncompressed_bytes * 8);
+
+                left |= uncompressed_bytes_buffer_a[i] & mask;
+                right |= uncompressed_bytes_buffer_b[i] & mask;
+            }
+
+            ((uint8_t*)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
+            ((uint8_t*)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
+            ((uint8_t*)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
+
+            ((uint8_t*)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
+            ((uint8_t*)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
+            ((uint8_t*)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
+        }
+
+        return;
+    }
+
+    /* otherwise basic interlacing took place */
+    for (i = 0; i < numsamples; i++)
+    {
+        int32_t left, right;
+
+        left = buffer_a[i];
+        right = buffer_b[i];
+
+        if (uncompressed_bytes)
+        {
+            uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
+            left <<= (uncompressed_bytes * 8);
+            right <<= (uncompressed_bytes * 8);
+
+            left |= uncompressed_bytes_buffer_a[i] & mask;
+            right |= uncompressed_bytes_buffer_b[i] & mask;
+        }
+
+        ((uint8_t*)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
+        ((uint8_t*)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
+        ((uint8_t*)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
+
+        ((uint8_t*)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
+        ((uint8_t*)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
+        ((uint8_t*)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
+
+    }
+
+}
+
+void alac_deinterlace_float_reference(const int32_t *buffer_a, const int32_t *buffer_b,
+                                      int uncompressed_bytes,
+                                      const int32_t *uncompressed_bytes_buffer_a, const int32_t *uncompressed_bytes_buffer_b,
+                                      float *buffer_out_a, float *buffer_out_b,
+                                      int numsamples,
+                                      uint8_t interlacing_shift,
+                                      uint8_t interlacing_leftweight,
+                                      float scale)
+{
+    int i;
+
+    for (i = 0; i < numsamples; i++)
+    {
+        int32_t left, right;
+
+        left = buffer_a[i];
+        right = buffer_b[i];
+
+        /* weighted interlacing */
+        if (interlacing_leftweight)
+        {
+            int32_t difference = right;
+
+            right = left - ((difference * interlacing_leftweight) >> interlacing_shift);
+            left = right + difference;
+        }
+
+        if (uncompressed_bytes)
+        {
+            uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
+            left <<= (uncompressed_bytes * 8);
+            right <<= (uncompressed_bytes * 8);
+
+            left |= uncompressed_bytes_buffer_a[i] & mask;
+            right |= uncompressed_bytes_buffer_b[i] & mask;
+        }
+
+        buffer_out_a[i] = (float)left * scale;
+        buffer_out_b[i] = (float)right * scale;
+    }
+}
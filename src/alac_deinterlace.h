@@ -0,0 +1,86 @@
+#ifndef __ALAC__DEINTERLACE_H
+#define __ALAC__DEINTERLACE_H
+
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Stereo deinterlacing: undoes the mid/side coding of both channels and writes
+ * them interleaved, little endian. buffer_out needs no particular alignment.
+ */
+typedef void (*alac_deinterlace_16_fn)(const int32_t *buffer_a,
+                                       const int32_t *buffer_b,
+                                       int16_t *buffer_out,
+                                       int numsamples,
+                                       uint8_t interlacing_shift,
+                                       uint8_t interlacing_leftweight);
+
+typedef void (*alac_deinterlace_24_fn)(const int32_t *buffer_a,
+                                       const int32_t *buffer_b,
+                                       int uncompressed_bytes,
+                                       const int32_t *uncompressed_bytes_buffer_a,
+                                       const int32_t *uncompressed_bytes_buffer_b,
+                                       uint8_t *buffer_out,
+                                       int numsamples,
+                                       uint8_t interlacing_shift,
+                                       uint8_t interlacing_leftweight);
+
+/* Same for 16 or 24 bit into one float plane per channel, samples times scale
+ * (1/2^(sample size-1) gives [-1, 1)). No alignment required either.
+ */
+typedef void (*alac_deinterlace_float_fn)(const int32_t *buffer_a,
+                                          const int32_t *buffer_b,
+                                          int uncompressed_bytes,
+                                          const int32_t *uncompressed_bytes_buffer_a,
+                                          const int32_t *uncompressed_bytes_buffer_b,
+                                          float *buffer_out_a,
+                                          float *buffer_out_b,
+                                          int numsamples,
+                                          uint8_t interlacing_shift,
+                                          uint8_t interlacing_leftweight,
+                                          float scale);
+
+typedef struct alac_deinterlace_kernel
+{
+    const char *name;
+    alac_deinterlace_16_fn deinterlace_16;
+    alac_deinterlace_24_fn deinterlace_24;
+    alac_deinterlace_float_fn deinterlace_float;
+} alac_deinterlace_kernel;
+
+/* Kernels this cpu supports, scalar first and fastest last. Returns count. */
+int alac_deinterlace_kernels(alac_deinterlace_kernel *kernels, int max);
+/* Fastest kernel for this cpu */
+alac_deinterlace_kernel alac_deinterlace_best_kernel(void);
+
+/* Original loops for any number of channels, reference for the kernels */
+void alac_deinterlace_16_reference(const int32_t *buffer_a, const int32_t *buffer_b,
+                                   int16_t *buffer_out,
+                                   int numchannels, int numsamples,
+                                   uint8_t interlacing_shift,
+                                   uint8_t interlacing_leftweight);
+
+void alac_deinterlace_24_reference(const int32_t *buffer_a, const int32_t *buffer_b,
+                                   int uncompressed_bytes,
+                                   const int32_t *uncompressed_bytes_buffer_a, const int32_t *uncompressed_bytes_buffer_b,
+                                   void *buffer_out,
+                                   int numchannels, int numsamples,
+                                   uint8_t interlacing_shift,
+                                   uint8_t interlacing_leftweight);
+
+void alac_deinterlace_float_reference(const int32_t *buffer_a, const int32_t *buffer_b,
+                                      int uncompressed_bytes,
+                                      const int32_t *uncompressed_bytes_buffer_a, const int32_t *uncompressed_bytes_buffer_b,
+                                      float *buffer_out_a, float *buffer_out_b,
+                                      int numsamples,
+                                      uint8_t interlacing_shift,
+                                      uint8_t interlacing_leftweight,
+                                      float scale);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* __ALAC__DEINTERLACE_H */
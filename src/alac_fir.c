@@ -0,0 +1,724 @@
+/*
+ * ALAC (Apple Lossless Audio Codec) decoder
+ * Copyright (c) 2005 David Hammerton
+ * All rights reserved.
+ *
+ * Adaptive FIR predictor, with vectorized dot products.
+ *
+ * http://crazney.net/programs/itunes/alac.html
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "alac_fir.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define ALAC_FIR_X86
+    #include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+    #define ALAC_FIR_NEON
+    #include <arm_neon.h>
+#endif
+
+#define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
+
+#define SIGN_ONLY(v) \
+                     ((v < 0) ? (-1) : \
+                                ((v > 0) ? (1) : \
+                                           (0)))
+
+
+/* Kernels share the per sample steps below. The vector ones handle groups of
+ * 4 or 8 coefficients and leave the rest to the scalar steps.
+ * Sums wrap around in unsigned arithmetic, as the original int code does in practice.
+ */
+
+/* adds coefficients from on to sum */
+static inline int32_t fir_dot(const int32_t *history,
+                              const int16_t *coefs,
+                              int from, int count,
+                              int32_t base,
+                              uint32_t sum)
+{
+    int k;
+
+    for (k = from; k < count; k++)
+    {
+        sum += ((uint32_t)history[k] - (uint32_t)base) * (uint32_t)(int32_t)coefs[k];
+    }
+    return (int32_t)sum;
+}
+
+static inline int32_t fir_output(int32_t sum, int32_t base, int error_val,
+                                 int readsamplesize, int quantitization)
+{
+    int outval;
+
+    outval = (1 << (quantitization-1)) + sum;
+    outval = outval >> quantitization;
+    outval = outval + base + error_val;
+    outval = SIGN_EXTENDED32(outval, readsamplesize);
+
+    return outval;
+}
+
+/* sign-adaptive update from coefficient from on, oldest sample first like the reference.
+ * Stops when error_val changes sign, returns what is left of it.
+ */
+static inline int fir_adapt(const int32_t *history,
+                            int16_t *coefs,
+                            int from, int count,
+                            int32_t base,
+                            int error_val,
+                            int quantitization)
+{
+    int k;
+
+    if (error_val > 0)
+    {
+        for (k = from; k < count && error_val > 0; k++)
+        {
+            int val = base - history[k];
+            int sign = SIGN_ONLY(val);
+
+            coefs[k] -= sign;
+
+            val *= sign; /* absolute value */
+
+            error_val -= ((val >> quantitization) * (k + 1));
+        }
+    }
+    else if (error_val < 0)
+    {
+        for (k = from; k < count && error_val < 0; k++)
+        {
+            int val = base - history[k];
+            int sign = - SIGN_ONLY(val);
+
+            coefs[k] -= sign;
+
+            val *= sign; /* neg value */
+
+            error_val -= ((val >> quantitization) * (k + 1));
+        }
+    }
+    return error_val;
+}
+
+static void fir_run_scalar(const int32_t *error_buffer,
+                           int32_t *buffer_out,
+                           int output_size,
+                           int readsamplesize,
+                           int16_t *coefs,
+                           int coef_num,
+                           int quantitization)
+{
+    int i;
+
+    for (i = coef_num + 1; i < output_size; i++)
+    {
+        const int32_t *history = buffer_out + 1;
+        int32_t base = buffer_out[0];
+        int error_val = error_buffer[i];
+        int32_t sum;
+
+        sum = fir_dot(history, coefs, 0, coef_num, base, 0);
+        buffer_out[coef_num+1] = fir_output(sum, base, error_val, readsamplesize, quantitization);
+        fir_adapt(history, coefs, 0, coef_num, base, error_val, quantitization);
+
+        buffer_out++;
+    }
+}
+
+#ifdef ALAC_FIR_X86
+/* The adaptation of a group of coefficients at once: the terms subtracted from
+ * error_val are summed up lane by lane, coefficients before the first lane where
+ * error_val has lost its sign get updated. Returns the remaining error_val, 0 once stopped.
+ * Lanes after the stop may overflow, they are masked off.
+ */
+
+__attribute__((target("sse4.1")))
+static inline int32_t fir_hsum_sse41(__m128i sum)
+{
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("sse4.1")))
+static inline int fir_adapt_sse41(__m128i delta,
+                                  int16_t *coefs,
+                                  int k,
+                                  int error_val,
+                                  __m128i quantitization)
+{
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i sign = _mm_set1_epi32(error_val > 0 ? 1 : -1);
+    __m128i remaining = _mm_set1_epi32(error_val);
+    __m128i term, total, apply, step, coef;
+    int mask;
+    int remaining_val;
+
+    /* |val| >> q, or -|val| >> q for negative errors, times k + 1 */
+    term = _mm_sign_epi32(_mm_abs_epi32(delta), sign);
+    term = _mm_sra_epi32(term, quantitization);
+    term = _mm_mullo_epi32(term, _mm_add_epi32(lane, _mm_set1_epi32(k + 1)));
+
+    total = _mm_add_epi32(term, _mm_slli_si128(term, 4));
+    total = _mm_add_epi32(total, _mm_slli_si128(total, 8));
+
+    /* error_val before each lane */
+    remaining = _mm_sub_epi32(remaining, _mm_sub_epi32(total, term));
+    if (error_val > 0)
+        apply = _mm_cmpgt_epi32(remaining, _mm_setzero_si128());
+    else
+        apply = _mm_cmplt_epi32(remaining, _mm_setzero_si128());
+    mask = _mm_movemask_ps(_mm_castsi128_ps(apply));
+    if (mask != 0xf)
+        apply = _mm_cmplt_epi32(lane, _mm_set1_epi32(__builtin_ctz(~mask)));
+
+    /* delta is history - base, the opposite of val */
+    step = _mm_and_si128(_mm_sign_epi32(sign, delta), apply);
+    coef = _mm_loadl_epi64((const __m128i *)(coefs + k));
+    coef = _mm_add_epi16(coef, _mm_packs_epi32(step, step));
+    _mm_storel_epi64((__m128i *)(coefs + k), coef);
+
+    if (mask != 0xf)
+        return 0;
+    /* all applied, stop here if the last lane used up error_val */
+    remaining_val = error_val - _mm_extract_epi32(total, 3);
+    if ((error_val > 0) ? (remaining_val <= 0) : (remaining_val >= 0))
+        return 0;
+    return remaining_val;
+}
+
+__attribute__((target("sse4.1")))
+static void fir_run_sse41(const int32_t *error_buffer,
+                          int32_t *buffer_out,
+                          int output_size,
+                          int readsamplesize,
+                          int16_t *coefs,
+                          int coef_num,
+                          int quantitization)
+{
+    const int vector_num = coef_num & ~3;
+    const __m128i shift = _mm_cvtsi32_si128(quantitization);
+    int i;
+
+    for (i = coef_num + 1; i < output_size; i++)
+    {
+        const int32_t *history = buffer_out + 1;
+        int32_t base = buffer_out[0];
+        __m128i vbase = _mm_set1_epi32(base);
+        __m128i sum = _mm_setzero_si128();
+        int error_val = error_buffer[i];
+        int k;
+
+        for (k = 0; k < vector_num; k += 4)
+        {
+            __m128i delta = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(history + k)), vbase);
+            __m128i coef = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(coefs + k)));
+            sum = _mm_add_epi32(sum, _mm_mullo_epi32(delta, coef));
+        }
+        buffer_out[coef_num+1] = fir_output(fir_dot(history, coefs, vector_num, coef_num, base, fir_hsum_sse41(sum)),
+                                            base, error_val, readsamplesize, quantitization);
+
+        for (k = 0; k < vector_num && error_val; k += 4)
+        {
+            __m128i delta = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(history + k)), vbase);
+            error_val = fir_adapt_sse41(delta, coefs, k, error_val, shift);
+        }
+        fir_adapt(history, coefs, vector_num, coef_num, base, error_val, quantitization);
+
+        buffer_out++;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline int fir_adapt_avx2(__m256i delta,
+                                 int16_t *coefs,
+                                 int k,
+                                 int error_val,
+                                 __m128i quantitization)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i sign = _mm256_set1_epi32(error_val > 0 ? 1 : -1);
+    __m256i remaining = _mm256_set1_epi32(error_val);
+    __m256i term, total, apply, step;
+    __m128i coef;
+    int mask;
+    int remaining_val;
+
+    term = _mm256_sign_epi32(_mm256_abs_epi32(delta), sign);
+    term = _mm256_sra_epi32(term, quantitization);
+    term = _mm256_mullo_epi32(term, _mm256_add_epi32(lane, _mm256_set1_epi32(k + 1)));
+
+    /* running sums within each half, then the low half carried into the high one */
+    total = _mm256_add_epi32(term, _mm256_slli_si256(term, 4));
+    total = _mm256_add_epi32(total, _mm256_slli_si256(total, 8));
+    total = _mm256_add_epi32(total, _mm256_blend_epi32(_mm256_setzero_si256(),
+                                                       _mm256_permutevar8x32_epi32(total, _mm256_set1_epi32(3)),
+                                                       0xf0));
+
+    remaining = _mm256_sub_epi32(remaining, _mm256_sub_epi32(total, term));
+    if (error_val > 0)
+        apply = _mm256_cmpgt_epi32(remaining, _mm256_setzero_si256());
+    else
+        apply = _mm256_cmpgt_epi32(_mm256_setzero_si256(), remaining);
+    mask = _mm256_movemask_ps(_mm256_castsi256_ps(apply));
+    if (mask != 0xff)
+        apply = _mm256_cmpgt_epi32(_mm256_set1_epi32(__builtin_ctz(~mask)), lane);
+
+    step = _mm256_and_si256(_mm256_sign_epi32(sign, delta), apply);
+    coef = _mm_loadu_si128((const __m128i *)(coefs + k));
+    coef = _mm_add_epi16(coef, _mm_packs_epi32(_mm256_castsi256_si128(step),
+                                               _mm256_extracti128_si256(step, 1)));
+    _mm_storeu_si128((__m128i *)(coefs + k), coef);
+
+    if (mask != 0xff)
+        return 0;
+    /* all applied, stop here if the last lane used up error_val */
+    remaining_val = error_val - _mm256_extract_epi32(total, 7);
+    if ((error_val > 0) ? (remaining_val <= 0) : (remaining_val >= 0))
+        return 0;
+    return remaining_val;
+}
+
+__attribute__((target("avx2")))
+static void fir_run_avx2(const int32_t *error_buffer,
+                         int32_t *buffer_out,
+                         int output_size,
+                         int readsamplesize,
+                         int16_t *coefs,
+                         int coef_num,
+                         int quantitization)
+{
+    /* groups of 8, then one of 4, typical orders (4, 8, 16) have no rest */
+    const int wide_num = coef_num & ~7;
+    const int vector_num = coef_num & ~3;
+    const __m128i shift = _mm_cvtsi32_si128(quantitization);
+    int i;
+
+    for (i = coef_num + 1; i < output_size; i++)
+    {
+        const int32_t *history = buffer_out + 1;
+        int32_t base = buffer_out[0];
+        __m256i vbase = _mm256_set1_epi32(base);
+        __m256i wide_sum = _mm256_setzero_si256();
+        __m128i sum;
+        int error_val = error_buffer[i];
+        int k;
+
+        for (k = 0; k < wide_num; k += 8)
+        {
+            __m256i delta = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(history + k)), vbase);
+            __m256i coef = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(coefs + k)));
+            wide_sum = _mm256_add_epi32(wide_sum, _mm256_mullo_epi32(delta, coef));
+        }
+        sum = _mm_add_epi32(_mm256_castsi256_si128(wide_sum), _mm256_extracti128_si256(wide_sum, 1));
+        if (wide_num < vector_num)
+        {
+            __m128i delta = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(history + k)),
+                                          _mm256_castsi256_si128(vbase));
+            __m128i coef = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(coefs + k)));
+            sum = _mm_add_epi32(sum, _mm_mullo_epi32(delta, coef));
+        }
+        buffer_out[coef_num+1] = fir_output(fir_dot(history, coefs, vector_num, coef_num, base, fir_hsum_sse41(sum)),
+                                            base, error_val, readsamplesize, quantitization);
+
+        for (k = 0; k < wide_num && error_val; k += 8)
+        {
+            __m256i delta = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)(history + k)), vbase);
+            error_val = fir_adapt_avx2(delta, coefs, k, error_val, shift);
+        }
+        if (wide_num < vector_num && error_val)
+        {
+            __m128i delta = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(history + k)),
+                                          _mm256_castsi256_si128(vbase));
+            error_val = fir_adapt_sse41(delta, coefs, k, error_val, shift);
+        }
+        fir_adapt(history, coefs, vector_num, coef_num, base, error_val, quantitization);
+
+        buffer_out++;
+    }
+}
+#endif
+
+#ifdef ALAC_FIR_NEON
+static inline int32_t fir_hsum_neon(int32x4_t sum)
+{
+#ifdef __aarch64__
+    return vaddvq_s32(sum);
+#else
+    int32x2_t pair = vadd_s32(vget_low_s32(sum), vget_high_s32(sum));
+    return vget_lane_s32(vpadd_s32(pair, pair), 0);
+#endif
+}
+
+/* Same as fir_adapt_sse41 */
+static inline int fir_adapt_neon(int32x4_t delta,
+                                 int16_t *coefs,
+                                 int k,
+                                 int error_val,
+                                 int32x4_t quantitization)
+{
+    static const int32_t lanes[4] = { 0, 1, 2, 3 };
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    const int32x4_t zero = vdupq_n_s32(0);
+    const int32x4_t lane = vld1q_s32(lanes);
+    int32x4_t term, total, remaining, step;
+    uint32x4_t apply;
+    int16x4_t coef;
+    int mask;
+    int remaining_val;
+
+    /* sign of delta, as the comparisons give -1 for true */
+    step = vsubq_s32(vreinterpretq_s32_u32(vcltq_s32(delta, zero)),
+                     vreinterpretq_s32_u32(vcgtq_s32(delta, zero)));
+    term = vabsq_s32(delta);
+    if (error_val < 0)
+    {
+        step = vnegq_s32(step);
+        term = vnegq_s32(term);
+    }
+    /* shifting left by -q is an arithmetic shift right */
+    term = vshlq_s32(term, quantitization);
+    term = vmulq_s32(term, vaddq_s32(lane, vdupq_n_s32(k + 1)));
+
+    total = vaddq_s32(term, vextq_s32(zero, term, 3));
+    total = vaddq_s32(total, vextq_s32(zero, total, 2));
+
+    remaining = vsubq_s32(vdupq_n_s32(error_val), vsubq_s32(total, term));
+    if (error_val > 0)
+        apply = vcgtq_s32(remaining, zero);
+    else
+        apply = vcltq_s32(remaining, zero);
+    mask = fir_hsum_neon(vreinterpretq_s32_u32(vandq_u32(apply, vld1q_u32(bits))));
+    if (mask != 0xf)
+        apply = vcltq_s32(lane, vdupq_n_s32(__builtin_ctz(~mask)));
+
+    step = vandq_s32(step, vreinterpretq_s32_u32(apply));
+    coef = vld1_s16(coefs + k);
+    coef = vadd_s16(coef, vmovn_s32(step));
+    vst1_s16(coefs + k, coef);
+
+    if (mask != 0xf)
+        return 0;
+    /* all applied, stop here if the last lane used up error_val */
+    remaining_val = error_val - vgetq_lane_s32(total, 3);
+    if ((error_val > 0) ? (remaining_val <= 0) : (remaining_val >= 0))
+        return 0;
+    return remaining_val;
+}
+
+static void fir_run_neon(const int32_t *error_buffer,
+                         int32_t *buffer_out,
+                         int output_size,
+                         int readsamplesize,
+                         int16_t *coefs,
+                         int coef_num,
+                         int quantitization)
+{
+    const int vector_num = coef_num & ~3;
+    const int32x4_t shift = vdupq_n_s32(-quantitization);
+    int i;
+
+    for (i = coef_num + 1; i < output_size; i++)
+    {
+        const int32_t *history = buffer_out + 1;
+        int32_t base = buffer_out[0];
+        int32x4_t vbase = vdupq_n_s32(base);
+        int32x4_t sum = vdupq_n_s32(0);
+        int error_val = error_buffer[i];
+        int k;
+
+        for (k = 0; k < vector_num; k += 4)
+        {
+            int32x4_t delta = vsubq_s32(vld1q_s32(history + k), vbase);
+            int32x4_t coef = vmovl_s16(vld1_s16(coefs + k));
+            sum = vmlaq_s32(sum, delta, coef);
+        }
+        buffer_out[coef_num+1] = fir_output(fir_dot(history, coefs, vector_num, coef_num, base, fir_hsum_neon(sum)),
+                                            base, error_val, readsamplesize, quantitization);
+
+        for (k = 0; k < vector_num && error_val; k += 4)
+        {
+            int32x4_t delta = vsubq_s32(vld1q_s32(history + k), vbase);
+            error_val = fir_adapt_neon(delta, coefs, k, error_val, shift);
+        }
+        fir_adapt(history, coefs, vector_num, coef_num, base, error_val, quantitization);
+
+        buffer_out++;
+    }
+}
+#endif
+
+int alac_fir_kernels(alac_fir_kernel *kernels, int max)
+{
+    int count = 0;
+
+    if (count < max)
+    {
+        kernels[count].name = "scalar";
+        kernels[count++].run = fir_run_scalar;
+    }
+#ifdef ALAC_FIR_X86
+    __builtin_cpu_init();
+    if (count < max && __builtin_cpu_supports("sse4.1"))
+    {
+        kernels[count].name = "sse4.1";
+        kernels[count++].run = fir_run_sse41;
+    }
+    if (count < max && __builtin_cpu_supports("avx2"))
+    {
+        kernels[count].name = "avx2";
+        kernels[count++].run = fir_run_avx2;
+    }
+#endif
+#ifdef ALAC_FIR_NEON
+    if (count < max)
+    {
+        kernels[count].name = "neon";
+        kernels[count++].run = fir_run_neon;
+    }
+#endif
+    return count;
+}
+
+alac_fir_kernel alac_fir_best_kernel(void)
+{
+    alac_fir_kernel kernels[4];
+    int count = alac_fir_kernels(kernels, 4);
+
+    return kernels[count - 1];
+}
+
+void alac_fir_predict(alac_fir_run_fn run,
+                      int32_t *error_buffer,
+                      int32_t *buffer_out,
+                      int output_size,
+                      int readsamplesize,
+                      int16_t *predictor_coef_table,
+                      int predictor_coef_num,
+                      int predictor_quantitization)
+{
+    /* coefficients reversed, so coefs[k] goes with buffer_out[1+k] */
+    int16_t coefs[32];
+    int i;
+    int k;
+
+    /* first sample always copies */
+    *buffer_out = *error_buffer;
+
+    if (!predictor_coef_num)
+    {
+        if (output_size <= 1) return;
+        memcpy(buffer_out+1, error_buffer+1, (output_size-1) * 4);
+        return;
+    }
+
+    if (predictor_coef_num == 0x1f) /* 11111 - max value of predictor_coef_num */
+    { /* second-best case scenario for fir decompression,
+       * error describes a small difference from the previous sample only
+       */
+        if (output_size <= 1) return;
+        for (i = 0; i < output_size - 1; i++)
+        {
+            int32_t prev_value;
+            int32_t error_value;
+
+            prev_value = buffer_out[i];
+            error_value = error_buffer[i+1];
+            buffer_out[i+1] = SIGN_EXTENDED32((prev_value + error_value), readsamplesize);
+        }
+        return;
+    }
+
+    /* read warm-up samples */
+    for (i = 0; i < predictor_coef_num; i++)
+    {
+        int32_t val;
+
+        val = buffer_out[i] + error_buffer[i+1];
+
+        val = SIGN_EXTENDED32(val, readsamplesize);
+
+        buffer_out[i+1] = val;
+    }
+
+    for (k = 0; k < predictor_coef_num; k++)
+    {
+        coefs[k] = predictor_coef_table[predictor_coef_num-1-k];
+    }
+
+    run(error_buffer, buffer_out, output_size, readsamplesize,
+        coefs, predictor_coef_num, predictor_quantitization);
+
+    for (k = 0; k < predictor_coef_num; k++)
+    {
+        predictor_coef_table[predictor_coef_num-1-k] = coefs[k];
+    }
+}
+
+void alac_fir_predict_reference(int32_t *error_buffer,
+                                int32_t *buffer_out,
+                                int output_size,
+                                int readsamplesize,
+                                int16_t *predictor_coef_table,
+                                int predictor_coef_num,
+                                int predictor_quantitization)
+{
+    int i;
+
+    /* first sample always copies */
+    *buffer_out = *error_buffer;
+
+    if (!predictor_coef_num)
+    {
+        if (output_size <= 1) return;
+        memcpy(buffer_out+1, error_buffer+1, (output_size-1) * 4);
+        return;
+    }
+
+    if (predictor_coef_num == 0x1f) /* 11111 - max value of predictor_coef_num */
+    { /* second-best case scenario for fir decompression,
+       * error describes a small difference from the previous sample only
+       */
+        if (output_size <= 1) return;
+        for (i = 0; i < output_size - 1; i++)
+        {
+            int32_t prev_value;
+            int32_t error_value;
+
+            prev_value = buffer_out[i];
+            error_value = error_buffer[i+1];
+            buffer_out[i+1] = SIGN_EXTENDED32((prev_value + error_value), readsamplesize);
+        }
+        return;
+    }
+
+    /* read warm-up samples */
+    if (predictor_coef_num > 0)
+    {
+        int i;
+        for (i = 0; i < predictor_coef_num; i++)
+        {
+            int32_t val;
+
+            val = buffer_out[i] + error_buffer[i+1];
+
+            val = SIGN_EXTENDED32(val, readsamplesize);
+
+            buffer_out[i+1] = val;
+        }
+    }
+
+#if 0
+    /* 4 and 8 are very common cases (the only ones i've seen). these
+     * should be unrolled and optimised
+     */
+    if (predictor_coef_num == 4)
+    {
+        /* FIXME: optimised general case */
+        return;
+    }
+
+    if (predictor_coef_table == 8)
+    {
+        /* FIXME: optimised general case */
+        return;
+    }
+#endif
+
+
+    /* general case */
+    if (predictor_coef_num > 0)
+    {
+        for (i = predictor_coef_num + 1;
+             i < output_size;
+             i++)
+        {
+            int j;
+            int sum = 0;
+            int outval;
+            int error_val = error_buffer[i];
+
+            for (j = 0; j < predictor_coef_num; j++)
+            {
+                sum += (buffer_out[predictor_coef_num-j] - buffer_out[0]) *
+                       predictor_coef_table[j];
+            }
+
+            outval = (1 << (predictor_quantitization-1)) + sum;
+            outval = outval >> predictor_quantitization;
+            outval = outval + buffer_out[0] + error_val;
+            outval = SIGN_EXTENDED32(outval, readsamplesize);
+
+            buffer_out[predictor_coef_num+1] = outval;
+
+            if (error_val > 0)
+            {
+                int predictor_num = predictor_coef_num - 1;
+
+                while (predictor_num >= 0 && error_val > 0)
+                {
+                    int val = buffer_out[0] - buffer_out[predictor_coef_num - predictor_num];
+                    int sign = SIGN_ONLY(val);
+
+                    predictor_coef_table[predictor_num] -= sign;
+
+                    val *= sign; /* absolute value */
+
+                    error_val -= ((val >> predictor_quantitization) *
+                                  (predictor_coef_num - predictor_num));
+
+                    predictor_num--;
+                }
+            }
+            else if (error_val < 0)
+            {
+                int predictor_num = predictor_coef_num - 1;
+
+                while (predictor_num >= 0 && error_val < 0)
+                {
+                    int val = buffer_out[0] - buffer_out[predictor_coef_num - predictor_num];
+                    int sign = - SIGN_ONLY(val);
+
+                    predictor_coef_table[predictor_num] -= sign;
+
+                    val *= sign; /* neg value */
+
+                    error_val -= ((val >> predictor_quantitization) *
+                                  (predictor_coef_num - predictor_num));
+
+                    predictor_num--;
+                }
+            }
+
+            buffer_out++;
+        }
+    }
+}
+
@@ -0,0 +1,56 @@
+#ifndef __ALAC__FIR_H
+#define __ALAC__FIR_H
+
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* General case of the adaptive FIR predictor, from sample coef_num + 1 on:
+ * prediction from the last coef_num samples, then sign-adaptive update of coefs.
+ * coefs are reversed, coefs[k] goes with buffer_out[1+k] (the oldest sample).
+ */
+typedef void (*alac_fir_run_fn)(const int32_t *error_buffer,
+                                int32_t *buffer_out,
+                                int output_size,
+                                int readsamplesize,
+                                int16_t *coefs,
+                                int coef_num,
+                                int quantitization);
+
+typedef struct alac_fir_kernel
+{
+    const char *name;
+    alac_fir_run_fn run;
+} alac_fir_kernel;
+
+/* Kernels this cpu supports, scalar first and fastest last. Returns count. */
+int alac_fir_kernels(alac_fir_kernel *kernels, int max);
+/* Fastest kernel for this cpu */
+alac_fir_kernel alac_fir_best_kernel(void);
+
+/* Adaptive FIR predictor, adapts predictor_coef_table in place */
+void alac_fir_predict(alac_fir_run_fn run,
+                      int32_t *error_buffer,
+                      int32_t *buffer_out,
+                      int output_size,
+                      int readsamplesize,
+                      int16_t *predictor_coef_table,
+                      int predictor_coef_num,
+                      int predictor_quantitization);
+
+/* Original scalar predictor, reference for the kernels */
+void alac_fir_predict_reference(int32_t *error_buffer,
+                                int32_t *buffer_out,
+                                int output_size,
+                                int readsamplesize,
+                                int16_t *predictor_coef_table,
+                                int predictor_coef_num,
+                                int predictor_quantitization);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* __ALAC__FIR_H */
@@ -23,6 +23,8 @@ public:
     virtual void stop() {}
     // play samples
     virtual void play(char *data, int bytes) = 0;
+    // frames written but not yet audible, -1 if unknown
+    virtual int delay() { return -1; }
 
     // if no volume control available, we apply soft volume
     virtual bool hasVolumeControl() { return false; }
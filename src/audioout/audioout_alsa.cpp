@@ -136,6 +136,15 @@ void AudioOutAlsa::play(char *data, int bytes)
     }
 }
 
+int AudioOutAlsa::delay()
+{
+    snd_pcm_sframes_t frames = 0;
+    if (!m_pcm || (snd_pcm_delay(m_pcm, &frames) < 0)) {
+        return -1;
+    }
+    return frames;
+}
+
 bool AudioOutAlsa::hasVolumeControl()
 {
     return true;
@@ -20,6 +20,7 @@ private:
     virtual void start() Q_DECL_OVERRIDE;
     virtual void stop() Q_DECL_OVERRIDE;
     virtual void play(char *data, int bytes) Q_DECL_OVERRIDE;
+    virtual int delay() Q_DECL_OVERRIDE;
     virtual bool hasVolumeControl() Q_DECL_OVERRIDE;
     virtual void setVolume(float volume) Q_DECL_OVERRIDE;
 
@@ -97,9 +97,9 @@ void AudioOutJack::stop()
 void AudioOutJack::play(char *data, int bytes)
 {
     // we always expect int16 samples
-    int16_t *inSamples = (int16_t*)data;
-    size_t  numSamples = bytes/2;
-    size_t  bytesPerChannel = numSamples*sizeof(sample_t)/airtunes::channels;
+    const int16_t *inSamples = (const int16_t*)data;
+    size_t  numFrames = bytes/(sizeof(int16_t)*airtunes::channels);
+    size_t  bytesPerChannel = numFrames*sizeof(sample_t);
 
     // find minimum available size
     size_t availableWrite = SIZE_MAX;
@@ -115,19 +115,23 @@ void AudioOutJack::play(char *data, int bytes)
         m_mutex.unlock();
     }
 
-    // Deinterleave and convert to float32
-    float outSamples[airtunes::channels][numSamples/airtunes::channels];
-    for (uint i = 0; i < numSamples; i += airtunes::channels) {
-        for (uint j = 0; j < airtunes::channels; ++j) {
-            outSamples[j][i/airtunes::channels] = (float)inSamples[i+j]/32768.0f;
-        }
-    }
-
-    // Write to jack ringbuffer
+    // Deinterleave and convert to float32 straight into the jack ringbuffers.
+    // Read and write positions only move by whole samples, so a part of the free space
+    // starts on a sample boundary.
     for (uint i = 0; i < airtunes::channels; ++i) {
-        size_t written = jack_ringbuffer_write(m_buffers[i], (char*)outSamples[i], bytesPerChannel);
-        if (written != bytesPerChannel) {
-            qWarning()<<Q_FUNC_INFO<<"error writing entire packet. written ="<<written;
+        jack_ringbuffer_data_t parts[2];
+        jack_ringbuffer_get_write_vector(m_buffers[i], parts);
+        size_t frame = 0;
+        for (const jack_ringbuffer_data_t &part : parts) {
+            sample_t *outSamples = reinterpret_cast<sample_t*>(part.buf);
+            const size_t count = std::min(part.len/sizeof(sample_t), numFrames-frame);
+            for (size_t j = 0; j < count; ++j, ++frame) {
+                outSamples[j] = (float)inSamples[frame*airtunes::channels+i]/32768.0f;
+            }
+        }
+        jack_ringbuffer_write_advance(m_buffers[i], frame*sizeof(sample_t));
+        if (frame != numFrames) {
+            qWarning()<<Q_FUNC_INFO<<"error writing entire packet. written ="<<frame*sizeof(sample_t);
         }
     }
 }
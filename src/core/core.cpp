@@ -40,6 +40,18 @@ void Core::parseCommandLine(QCommandLineParser &parser)
     parser.addOption(portOption);
     QCommandLineOption latencyOption(QStringList() << "l" << "latency", "Set latency in milliseconds.", "latency", "500");
     parser.addOption(latencyOption);
+    QCommandLineOption minLatencyOption(QStringList() << "minlatency", "Set minimum latency in milliseconds for adaptive latency.", "minlatency", "0");
+    parser.addOption(minLatencyOption);
+    QCommandLineOption maxLatencyOption(QStringList() << "maxlatency", "Set maximum latency in milliseconds for adaptive latency.", "maxlatency", "0");
+    parser.addOption(maxLatencyOption);
+    QCommandLineOption lazyDecodeOption(QStringList() << "lazydecode", "Buffer encrypted packets and decode them when played (saves memory).");
+    parser.addOption(lazyDecodeOption);
+    QCommandLineOption decodeThreadsOption(QStringList() << "decodethreads", "Decode bursts of packets with additional threads.", "decodethreads", "0");
+    parser.addOption(decodeThreadsOption);
+    QCommandLineOption captureOption(QStringList() << "capture", "Record received RTP streams to file for replay.", "capture", "");
+    parser.addOption(captureOption);
+    QCommandLineOption socketBackendOption(QStringList() << "receiver", "Set socket backend of the RTP receiver (asio, io_uring).", "receiver", "asio");
+    parser.addOption(socketBackendOption);
     QCommandLineOption audioOutOption(QStringList() << "ao" << "audioout", "Set audio backend.", "audioout", "ao");
     parser.addOption(audioOutOption);
     QCommandLineOption audioDeviceOption(QStringList() << "ad" << "audiodevice", "Set audio device.", "audiodevice", "");
@@ -50,11 +62,17 @@ void Core::parseCommandLine(QCommandLineParser &parser)
     m_options.name = parser.value(nameOption);
     m_options.port = parser.value(portOption).toInt();
     m_options.latency = parser.value(latencyOption).toInt();
+    m_options.minLatency = parser.value(minLatencyOption).toInt();
+    m_options.maxLatency = parser.value(maxLatencyOption).toInt();
+    m_options.lazyDecode = parser.isSet(lazyDecodeOption);
+    m_options.decodeThreads = parser.value(decodeThreadsOption).toInt();
+    m_options.captureFile = parser.value(captureOption);
+    m_options.socketBackend = parser.value(socketBackendOption);
 
     m_audioOutName = parser.value(audioOutOption);
     m_audioDeviceName = parser.value(audioDeviceOption);
 
-    qDebug()<<Q_FUNC_INFO<<"name:"<<m_options.name<<"port:"<<m_options.port<<"latency:"<<m_options.latency;
+    qDebug()<<Q_FUNC_INFO<<"name:"<<m_options.name<<"port:"<<m_options.port<<"latency:"<<m_options.latency<<"("<<m_options.minLatency<<"-"<<m_options.maxLatency<<")"<<"lazyDecode:"<<m_options.lazyDecode<<"decodeThreads:"<<m_options.decodeThreads<<"capture:"<<m_options.captureFile<<"receiver:"<<m_options.socketBackend;
     qDebug()<<Q_FUNC_INFO<<"audioOut:"<<m_audioOutName<<"audioDevice:"<<m_audioDeviceName;
 }
 
@@ -18,6 +18,12 @@ public:
         QString name;
         quint16 port;
         quint16 latency;
+        quint16 minLatency; // adaptive latency is used if minLatency < maxLatency
+        quint16 maxLatency;
+        bool lazyDecode;    // store encrypted packets, decode when played
+        int decodeThreads;  // additional threads to decode bursts, 0 if off
+        QString captureFile;    // record received streams for replay, empty if off
+        QString socketBackend;  // how datagrams are received, see RtpSocketBackend
     };
 
 public:
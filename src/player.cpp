@@ -2,14 +2,25 @@
 
 #include <audioout/audioout_abstract.h>
 #include "core/core.h"
+#include <airtunes/airtunesconstants.h>
 #include <rtp/rtpbuffer.h>
+#include <rtp/rtpclock.h>
 #include <rtp/rtppacket.h>
 
 #include <QDebug>
 
-Player::Player(RtpBuffer *rtpBuffer, QObject *parent) :
+static const int frameSize = airtunes::channels*(airtunes::sampleSize/8);
+// Output may be off the presentation time by that many frames (~1 ms) before we correct it
+static const int alignTolerance = 44;
+// Max frames dropped or repeated per packet once aligned, to keep corrections inaudible
+static const int maxCorrection = 44;
+// Max silence at start, guards against bogus sync packets
+static const int maxStartDelay = 4*airtunes::sampleRate;
+
+Player::Player(RtpBuffer *rtpBuffer, RtpClock *rtpClock, QObject *parent) :
     QObject(parent),
     m_rtpBuffer(rtpBuffer),
+    m_rtpClock(rtpClock),
     m_volume(0.0f)
 {
     // Start playing when buffer is ready
@@ -20,6 +31,15 @@ Player::Player(RtpBuffer *rtpBuffer, QObject *parent) :
 
 void Player::play()
 {
+    // Worker survives underruns and flushes, only restart it after teardown
+    if (m_playWorker->isRunning()) {
+        return;
+    }
+
+    if (m_rtpClock->isValid()) {
+        qDebug()<<Q_FUNC_INFO<<"sender clock offset:"<<m_rtpClock->offset(RtpClock::now())<<"drift:"<<m_rtpClock->drift();
+    }
+
     ofCore->audioOut()->start();
     m_playWorker->start();
 }
@@ -28,6 +48,7 @@ void Player::teardown()
 {
     qDebug()<<Q_FUNC_INFO;
 
+    m_rtpBuffer->teardown();
     if (m_playWorker->isRunning()) {
         m_playWorker->wait();
     }
@@ -47,21 +68,97 @@ void Player::setVolume(float volume)
 
 Player::PlayWorker::PlayWorker(Player *player)
     : QThread(player),
-      m_player(player)
+      m_player(player),
+      m_aligned(false)
 {
 }
 
+bool Player::PlayWorker::schedule(quint32 timestamp, char **payload, int *size)
+{
+    qint64 presentation;
+    if (!m_player->m_rtpClock->presentationTime(timestamp, &presentation)) {
+        return true;
+    }
+
+    // Frames we write now are audible after the device delay. Positive error means we are late.
+    const int delay = qMax(ofCore->audioOut()->delay(), 0);
+    const qint64 audible = RtpClock::now() + (qint64(delay)*1000000000LL)/airtunes::sampleRate;
+    int error = ((audible-presentation)*airtunes::sampleRate)/1000000000LL;
+    if (m_aligned && (qAbs(error) <= alignTolerance)) {
+        return true;
+    }
+
+    if (!m_aligned) {
+        // Start: skip whole packets or fill with silence up to presentation time
+        if (error >= *size/frameSize) {
+            return false;
+        }
+        qDebug()<<Q_FUNC_INFO<<"align output, error in frames:"<<error;
+        if (-error > maxStartDelay) {
+            qWarning()<<Q_FUNC_INFO<<"presentation time too far ahead, limiting delay";
+            error = -maxStartDelay;
+        }
+        char *silence;
+        int silenceSize;
+        m_player->m_rtpBuffer->silence(&silence, &silenceSize);
+        for (int frames = -error; frames > 0; frames -= silenceSize/frameSize) {
+            ofCore->audioOut()->play(silence, qMin(frames*frameSize, silenceSize));
+        }
+        m_aligned = true;
+    } else {
+        // Running: repeat first frame to wait, or drop first frames to catch up
+        error = qBound(-maxCorrection, error, maxCorrection);
+        // Short packets may be dropped as a whole
+        if (error >= *size/frameSize) {
+            return false;
+        }
+        if (error < 0) {
+            qint32 repeated[maxCorrection];
+            for (int i = 0; i < -error; ++i) {
+                repeated[i] = *reinterpret_cast<const qint32*>(*payload);
+            }
+            ofCore->audioOut()->play(reinterpret_cast<char*>(repeated), -error*frameSize);
+        }
+    }
+
+    if (error > 0) {
+        *payload += error*frameSize;
+        *size -= error*frameSize;
+    }
+    return true;
+}
+
 void Player::PlayWorker::run()
 {
     qDebug()<<Q_FUNC_INFO<<"enter";
 
     float prevVolume = 0.0;
 
+    // Wait at most one packet for data, then keep audio device busy with silence
+    const int timeout = (airtunes::framesPerPacket*1000)/airtunes::sampleRate;
+    char *silence;
+    int silenceSize;
+    m_player->m_rtpBuffer->silence(&silence, &silenceSize);
+    m_aligned = false;
+
     while(true) {
-        const RtpPacket *packet = m_player->m_rtpBuffer->takePacket();
-        if (!packet) {
-            qWarning()<<Q_FUNC_INFO<< "no packet from buffer. Stopping playback.";
+        // Synced output follows sender's presentation time, buffer must not drop or insert packets then
+        m_player->m_rtpBuffer->setAdaptiveFill(!m_player->m_rtpClock->isSynced());
+
+        RtpBuffer::TakeStatus status;
+        const RtpPacket *packet = m_player->m_rtpBuffer->takePacket(timeout, &status);
+        if (status == RtpBuffer::TakeEnded) {
+            qDebug()<<Q_FUNC_INFO<< "stream ended. Stopping playback.";
             break;
+        } else if (status == RtpBuffer::TakeUnderrun) {
+            ofCore->audioOut()->play(silence, silenceSize);
+            m_aligned = false;
+            continue;
+        }
+        char *payload = m_player->m_rtpBuffer->payload(packet);
+        int size = packet->payloadSize;
+        if (!schedule(packet->timestamp, &payload, &size)) {
+            continue;
         }
         m_player->m_mutex.lock();
         float volume = m_player->m_volume;
@@ -69,8 +166,8 @@ void Player::PlayWorker::run()
         int shift = abs(volume/5.625f);
         //float volume = qPow(10.0f, m_volume/20.0f);
         if (shift != 0) {
-            for (int i = 0; i < packet->payloadSize/2; ++i) {
-                *(qint16 *)(packet->payload+(i*2)) >>= shift;
+            for (int i = 0; i < size/2; ++i) {
+                *(qint16 *)(payload+(i*2)) >>= shift;
                 //*(qint16 *)(data+(i*2)) *= volume;
             }
         }
@@ -78,7 +175,7 @@ void Player::PlayWorker::run()
             ofCore->audioOut()->setVolume(volume);
             prevVolume = volume;
         }
-        ofCore->audioOut()->play(packet->payload, packet->payloadSize);
+        ofCore->audioOut()->play(payload, size);
     } // while
 
     qDebug()<<Q_FUNC_INFO<< "exit";
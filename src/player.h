@@ -7,13 +7,15 @@
 #include <QThread>
 
 class RtpBuffer;
+class RtpClock;
 
 class Player : public QObject
 {
     Q_OBJECT
     friend class PlayWorker;
 public:
-    explicit Player(RtpBuffer *rtpBuffer, QObject *parent = 0);
+    // rtpClock maps sender time to local time
+    explicit Player(RtpBuffer *rtpBuffer, RtpClock *rtpClock, QObject *parent = 0);
 
 public slots:
     void play();
@@ -27,11 +29,15 @@ private:
         explicit PlayWorker(Player *player);
     private:
         void run() Q_DECL_OVERRIDE;
+        // Align packet to sender's presentation time, false if it is too late to be played
+        bool schedule(quint32 timestamp, char **payload, int *size);
         Player *m_player;
+        bool    m_aligned;  // output follows presentation time
     };
 
 private:
     RtpBuffer   *m_rtpBuffer;
+    RtpClock    *m_rtpClock;
     PlayWorker  *m_playWorker;
     float       m_volume;
     QMutex      m_mutex;
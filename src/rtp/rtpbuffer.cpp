@@ -1,4 +1,6 @@
 #include "rtpbuffer.h"
+#include "rtpclock.h"
+#include "rtpdecoder.h"
 
 #include "rtpheader.h"
 #include "rtppacket.h"
@@ -6,126 +8,612 @@
 #include <util.h>
 #include <airtunes/airtunesconstants.h>
 
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <QtDebug>
 #include <QThread>
 
-RtpBuffer::RtpBuffer(uint framesPerPacket, uint latency, QObject *parent) :
+// Align payload slots to cache lines, whole slab to huge pages if it is big enough.
+static const uint cacheLineSize = 64;
+static const size_t hugePageSize = 2*1024*1024;
+// Silence, insert and decoded packet behind the ring
+static const uint extraPackets = 3;
+
+// Adaptive fill: target = minLatency + jitterFactor*jitter + lossPenalty*lossPercent
+static const uint jitterFactor = 4;
+static const uint lossPenalty = 20;  // ms per percent of lost packets
+// Consumer inserts or drops at most one packet per adjustInterval packets
+static const uint adjustInterval = 32;
+
+// Marks a pending flush request, lower 16 bits hold the sequence number
+static const quint32 flushPending = 0x10000;
+
+RtpBuffer::RtpBuffer(uint framesPerPacket, uint latency, uint minLatency, uint maxLatency, QObject *parent) :
     QObject(parent),
-    m_framesPerPacket(framesPerPacket),
+    m_framesPerPacket(0),
     m_latency(latency),
-    m_desiredFill((airtunes::sampleRate*m_latency)/(m_framesPerPacket*1000)),
-    m_capacity(Util::roundToPowerOfTwo(m_desiredFill*2)),
+    m_minLatency(minLatency ? qMin(minLatency, latency) : latency),
+    m_maxLatency(maxLatency ? qMax(maxLatency, latency) : latency),
+    m_maxFill(0),
+    m_desiredFill(latencyToFill(m_latency)),
+    m_capacity(0),
+    m_payloadStride(0),
     m_data(NULL),
+    m_silencePacket(NULL),
+    m_insertPacket(NULL),
+    m_decodedPacket(NULL),
+    m_payloads(NULL),
+    m_payloadsSize(0),
+    m_extraPayloads(NULL),
     m_silence(NULL),
+    m_decoder(NULL),
+    m_arena(NULL),
+    m_arenaSize(0),
+    m_arenaWrite(0),
+    m_arenaTail(0),
     m_begin(0),
     m_end(0),
-    m_ready(false),
+    m_pendingEnd(0),
+    m_endTimestamp(0),
+    m_playedTimestamp(0),
+    m_state(Empty),
+    m_consumerBusy(false),
+    m_consumerLocked(false),
+    m_taken(NULL),
+    m_takenGeneration(0),
+    m_generation(0),
+    m_ended(false),
+    m_consumerWaiting(false),
+    m_flushRequest(0),
+    m_flushFilter(false),
+    m_flushSequence(0),
+    m_hasTransit(false),
+    m_lastArrival(0),
+    m_lastTimestamp(0),
+    m_jitter(0),
+    m_intervalBegin(0),
+    m_intervalEnd(0),
+    m_intervalReceived(0),
+    m_adjustCountdown(0),
+    m_adaptiveFill(true),
+    m_concealer(),
+    m_concealerGeneration(0),
     m_stat(),
     m_lastPlayed(0)
 {
-    alloc();
+    qRegisterMetaType<RtpBuffer::State>();
+    setFramesPerPacket(framesPerPacket);
 }
 
 RtpBuffer::~RtpBuffer()
 {
     free();
+    delete m_decoder;
+}
+
+void RtpBuffer::setFramesPerPacket(uint framesPerPacket)
+{
+    if (!framesPerPacket || (framesPerPacket == m_framesPerPacket)) {
+        return;
+    }
+    qDebug()<<Q_FUNC_INFO<<framesPerPacket;
+
+    lockConsumer();
+    m_framesPerPacket = framesPerPacket;
+    reallocate();
+    unlockConsumer();
+}
+
+void RtpBuffer::setDecoder(RtpDecoder *decoder)
+{
+    if (!decoder && !m_decoder) {
+        return;
+    }
+    qDebug()<<Q_FUNC_INFO<<"lazy decode:"<<(decoder != NULL);
+
+    lockConsumer();
+    RtpDecoder *previous = m_decoder;
+    m_decoder = decoder;
+    if (!decoder != !previous) {
+        reallocate();
+    }
+    unlockConsumer();
+    delete previous;
 }
 
-RtpPacket* RtpBuffer::obtainPacket(const RtpHeader& rtpHeader)
+int RtpBuffer::maxPayloadSize() const
 {
-    m_mutex.lock();
+    // Encrypted packets might be slightly bigger than decoded ones
+    return m_arena ? m_payloadStride+cacheLineSize : m_payloadStride;
+}
+
+void RtpBuffer::reallocate()
+{
+    // Consumer is locked
+    m_maxFill = latencyToFill(m_maxLatency)/m_framesPerPacket;
+    m_capacity = Util::roundToPowerOfTwo(m_maxFill*2);
+    m_payloadStride = (m_framesPerPacket*airtunes::channels*(airtunes::sampleSize/8)+cacheLineSize-1) & ~(cacheLineSize-1);
+    alloc();
+    m_begin.store(0, std::memory_order_relaxed);
+    m_end.store(0, std::memory_order_relaxed);
+    m_arenaWrite = 0;
+    m_arenaTail = 0;
+    setState(Empty);
+    m_taken = NULL;
+    ++m_generation;
+    m_missing.clear();
+}
+
+bool RtpBuffer::reserve(quint64 *offset)
+{
+    // Payload must not wrap around end of arena
+    const quint64 size = maxPayloadSize();
+    quint64 write = m_arenaWrite;
+    if ((write%m_arenaSize)+size > m_arenaSize) {
+        write += m_arenaSize-(write%m_arenaSize);
+    }
+
+    if ((write-m_arenaTail)+size > m_arenaSize) {
+        // Look up oldest payload, which might still be in use
+        m_arenaTail = write;
+        const quint16 end = m_end.load(std::memory_order_relaxed);
+        for (quint16 i = m_begin.load(std::memory_order_acquire); i != end; ++i) {
+            const RtpPacket *packet = &m_data[i%m_capacity];
+            const RtpPacket::Status status = packet->status.load(std::memory_order_acquire);
+            if (((status == RtpPacket::PacketOk) || (status == RtpPacket::PacketBusy)) && ((write-packet->offset) > (write-m_arenaTail))) {
+                m_arenaTail = packet->offset;
+            }
+        }
+        if ((write-m_arenaTail)+size > m_arenaSize) {
+            return false;
+        }
+    }
+
+    *offset = write;
+    m_arenaWrite = write;
+    return true;
+}
+
+int RtpBuffer::frames(const RtpPacket *packet) const
+{
+    // Size of encrypted packets tells nothing, they are full ones for AirTunes
+    if (m_arena && (packet < m_silencePacket)) {
+        return m_framesPerPacket;
+    }
+    return packet->payloadSize/(airtunes::channels*(airtunes::sampleSize/8));
+}
+
+uint RtpBuffer::latency() const
+{
+    return (m_desiredFill.load(std::memory_order_relaxed)*1000)/airtunes::sampleRate;
+}
+
+uint RtpBuffer::maxLatency() const
+{
+    return m_maxLatency;
+}
+
+void RtpBuffer::flush(quint16 sequenceNumber)
+{
+    qDebug()<<Q_FUNC_INFO<<"flush before:"<<sequenceNumber;
+
+    m_flushRequest.store(flushPending | sequenceNumber, std::memory_order_release);
+    wakeConsumer();
+}
+
+bool RtpBuffer::applyFlush(const RtpHeader& rtpHeader)
+{
+    quint32 flushRequest = m_flushRequest.load(std::memory_order_acquire);
+    if (flushRequest) {
+        // Drop packets before flush sequence, keep the ones of the new stream
+        m_flushSequence = flushRequest;
+        m_flushFilter = true;
+        lockConsumer();
+        quint16 begin = m_begin.load(std::memory_order_relaxed);
+        const quint16 end = m_end.load(std::memory_order_relaxed);
+        for (; (begin != end) && (qint16(begin-m_flushSequence) < 0); ++begin) {
+            release(&m_data[begin%m_capacity]);
+        }
+        m_begin.store(begin, std::memory_order_relaxed);
+        m_playedTimestamp.store(timestampOf(begin), std::memory_order_relaxed);
+        if (fill() >= m_desiredFill.load(std::memory_order_relaxed)) {
+            setState(Ready);
+        } else {
+            setState((begin != end) ? Filling : Empty);
+        }
+        ++m_generation;
+        unlockConsumer();
+        // Keep newer request, if there is one
+        m_flushRequest.compare_exchange_strong(flushRequest, 0);
+        m_stat.flush++;
+    }
+
+    // Old stream packets might still be on their way
+    if (m_flushFilter) {
+        if (qint16(rtpHeader.sequenceNumber-m_flushSequence) < 0) {
+            return false;
+        }
+        m_flushFilter = false;
+    }
+
+    return true;
+}
+
+RtpPacket* RtpBuffer::obtainPacket(const RtpHeader& rtpHeader, qint64 arrival)
+{
+    if (!applyFlush(rtpHeader)) {
+        return NULL;
+    }
+    if (arrival < 0) {
+        arrival = RtpClock::now();
+    }
+    const PacketRating rating = ratePacket(rtpHeader, arrival);
 
-    RtpPacket* packet = NULL;
+    // Consumer still uses this slot after a flush or overflow. Drop packet before it
+    // moves the stream or records a gap, the next packet does that.
+    RtpPacket* packet = &(m_data[rtpHeader.sequenceNumber%m_capacity]);
+    if (((rating == Start) || (rating == Expected) || (rating == Early)) && isHeld(packet)) {
+        m_stat.overflow++;
+        return NULL;
+    }
 
-    switch (ratePacket(rtpHeader)) {
+    // Lazy decode: reserve arena space for encrypted payload of packets we store.
+    // New streams start with empty arena.
+    quint64 offset = 0;
+    if (m_arena && (rating != Duplicate) && (rating != TooLate)) {
+        if (rating == Start) {
+            m_arenaTail = m_arenaWrite;
+        }
+        if (!reserve(&offset)) {
+            qWarning()<<Q_FUNC_INFO<< "arena overflow, dropping:"<<rtpHeader.sequenceNumber;
+            m_stat.overflow++;
+            return NULL;
+        }
+    }
+
+    switch (rating) {
     case Start:
-        m_begin = rtpHeader.sequenceNumber;
-        m_end = rtpHeader.sequenceNumber+1;
+        lockConsumer();
+        m_begin.store(rtpHeader.sequenceNumber, std::memory_order_relaxed);
+        m_end.store(rtpHeader.sequenceNumber, std::memory_order_relaxed);
+        m_endTimestamp.store(rtpHeader.timestamp, std::memory_order_relaxed);
+        m_playedTimestamp.store(rtpHeader.timestamp, std::memory_order_relaxed);
+        ++m_generation;
+        unlockConsumer();
+        m_missing.clear();
+        m_pendingEnd = rtpHeader.sequenceNumber+1;
         break;
     case Early:
-        // Mark missing packets
-        for (quint16 i = m_end; i != rtpHeader.sequenceNumber; ++i) {
-            m_data[i%m_capacity].status = RtpPacket::PacketMissing;
-            m_data[i%m_capacity].sequenceNumber = i;
-        }
     case Expected:
         //  Check for buffer overflow.
-        if (size() >= (m_capacity-1)) {
+        if (quint16(rtpHeader.sequenceNumber-m_begin.load(std::memory_order_acquire)) >= (m_capacity-1)) {
             qWarning()<<Q_FUNC_INFO<< "buffer overflow, clipping front";
-            m_begin = m_end-m_desiredFill;
+            lockConsumer();
+            quint16 begin = m_begin.load(std::memory_order_relaxed);
+            const quint16 newBegin = rtpHeader.sequenceNumber+1-m_desiredFill.load(std::memory_order_relaxed)/m_framesPerPacket;
+            for (; begin != newBegin; ++begin) {
+                release(&m_data[begin%m_capacity]);
+            }
+            m_begin.store(newBegin, std::memory_order_relaxed);
+            m_playedTimestamp.store(timestampOf(newBegin), std::memory_order_relaxed);
+            ++m_generation;
+            unlockConsumer();
             m_stat.overflow++;
         }
+        // Mark missing packets. They become visible to consumer on commit.
+        if (rating == Early) {
+            const quint16 end = m_end.load(std::memory_order_relaxed);
+            for (quint16 i = end; i != rtpHeader.sequenceNumber; ++i) {
+                if (isHeld(&m_data[i%m_capacity])) continue;
+                m_data[i%m_capacity].sequenceNumber = i;
+                m_data[i%m_capacity].offset = m_arenaWrite;
+                m_data[i%m_capacity].status.store(RtpPacket::PacketMissing, std::memory_order_relaxed);
+            }
+            addMissing(end, rtpHeader.sequenceNumber-end);
+        }
         // End is one slot beyond last valid packet
-        m_end = rtpHeader.sequenceNumber+1;
+        m_pendingEnd = rtpHeader.sequenceNumber+1;
         break;
-    case Late:
+    case Late: {
+        // Consumer might conceal this slot concurrently, so we have to claim it.
+        RtpPacket::Status expected = RtpPacket::PacketMissing;
+        removeMissing(rtpHeader.sequenceNumber);
+        if (!m_data[rtpHeader.sequenceNumber%m_capacity].status.compare_exchange_strong(expected, RtpPacket::PacketBusy)) {
+            qDebug()<<Q_FUNC_INFO<< "too late packet:"<<rtpHeader.sequenceNumber;
+            m_stat.lost++;
+            return NULL;
+        }
+        m_pendingEnd = m_end.load(std::memory_order_relaxed);
         break;
+    }
     case Duplicate:
     case TooLate:
     default:
-        m_mutex.unlock();
         return NULL;
         break;
     }
 
-    // Fetch slot from buffer
-    packet = &(m_data[rtpHeader.sequenceNumber%m_capacity]);
     packet->sequenceNumber  = rtpHeader.sequenceNumber;
+    packet->timestamp       = rtpHeader.timestamp;
+    packet->offset          = offset;
+    packet->arrival         = arrival;
+    packet->status.store(RtpPacket::PacketBusy, std::memory_order_relaxed);
 
     return packet;
 }
 
 void RtpBuffer::commitPacket(RtpPacket* packet)
 {
-    // Mark packet as ok
-    packet->status = RtpPacket::PacketOk;
+    // Newest audio in buffer, late packets do not move it
+    const quint32 endTimestamp = packet->timestamp+frames(packet);
+    if (qint32(endTimestamp-m_endTimestamp.load(std::memory_order_relaxed)) > 0) {
+        m_endTimestamp.store(endTimestamp, std::memory_order_relaxed);
+    }
+
+    if (m_arena) {
+        m_arenaWrite = packet->offset+((packet->payloadSize+cacheLineSize-1) & ~(cacheLineSize-1));
+    }
+
+    // Our own share of the latency: socket, queue and decode
+    packet->committed = RtpClock::now();
+    const quint32 delay = qMax(packet->committed-packet->arrival, qint64(0))/1000;
+
+    // Mark packet as ok and publish it to consumer
+    packet->status.store(RtpPacket::PacketOk, std::memory_order_release);
+    m_end.store(m_pendingEnd, std::memory_order_release);
+
+    m_stat.maxDelay = qMax(m_stat.maxDelay, delay);
 
     // Dump buffer size
     static quint32 count = 0;
     if ((count%250) == 0) {
-        qDebug()<<Q_FUNC_INFO<<"fill:"<<size();
+        qDebug()<<Q_FUNC_INFO<<"packets:"<<size()<<"frames:"<<fill()<<"jitter:"<<m_stat.jitter<<"us, max delay:"<<m_stat.maxDelay<<"us";
+        m_stat.maxDelay = 0;
     }
     ++count;
 
-    // Wake player thread
-    if (size() >= m_desiredFill) {
-        m_ready = true;
-        emit ready();
+    // Update state on transitions only. After draining, consumer continues right away once
+    // there is a packet for it, commits behind the consumer do not count.
+    const State state = m_state.load(std::memory_order_acquire);
+    if (state == Draining) {
+        if (m_begin.load(std::memory_order_acquire) != m_pendingEnd) {
+            setState(Ready);
+        }
+    } else if ((state != Ready) && (fill() >= m_desiredFill.load(std::memory_order_relaxed))) {
+        m_ended.store(false, std::memory_order_relaxed);
+        setState(Ready);
+    } else if (state == Empty) {
+        setState(Filling);
     }
+    wakeConsumer();
+}
+
+void RtpBuffer::teardown()
+{
+    qDebug()<<Q_FUNC_INFO;
 
-    m_mutex.unlock();
+    setState(Empty);
+    m_ended.store(true, std::memory_order_release);
+    wakeConsumer();
 }
 
-const RtpPacket* RtpBuffer::takePacket()
+void RtpBuffer::wakeConsumer()
 {
-    QMutexLocker locker(&m_mutex);
+    // Pairs with fence in waitForPacket: either we see the waiting consumer or it sees our data.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_consumerWaiting.load(std::memory_order_relaxed)) {
+        m_waitMutex.lock();
+        m_waitCondition.wakeAll();
+        m_waitMutex.unlock();
+    }
+}
 
-    // If we flushed the buffer before, we return null until buffer is ready again
-    if (!m_ready) return NULL;
+const RtpPacket* RtpBuffer::takePacket(int timeout, TakeStatus *status)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    TakeStatus takeStatus = TakeOk;
+    const RtpPacket *packet = tryTakePacket(&takeStatus);
+    while (takeStatus == TakeUnderrun) {
+        const int remaining = timeout-timer.elapsed();
+        if ((remaining <= 0) || !waitForPacket(remaining)) {
+            break;
+        }
+        packet = tryTakePacket(&takeStatus);
+    }
+
+    if (status) {
+        *status = takeStatus;
+    }
+    return packet;
+}
+
+void RtpBuffer::setAdaptiveFill(bool enabled)
+{
+    m_adaptiveFill = enabled;
+}
+
+bool RtpBuffer::waitForPacket(int timeout)
+{
+    m_waitMutex.lock();
+    m_consumerWaiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool woken = m_ended.load(std::memory_order_relaxed)
+            || (isReady() && (m_begin.load(std::memory_order_relaxed) != m_end.load(std::memory_order_relaxed)));
+    if (!woken) {
+        woken = m_waitCondition.wait(&m_waitMutex, timeout);
+    }
+    m_consumerWaiting.store(false, std::memory_order_relaxed);
+    m_waitMutex.unlock();
+
+    return woken;
+}
 
-    RtpPacket* packet = &(m_data[m_begin%m_capacity]);
-    ++m_begin;
+const RtpPacket* RtpBuffer::tryTakePacket(TakeStatus *takeStatus)
+{
+    enterConsumer();
+
+    // Release packet from previous call. Producer must not reuse it before.
+    if (m_taken) {
+        m_taken->init();
+        if (m_takenGeneration == m_generation) {
+            m_begin.store(m_begin.load(std::memory_order_relaxed)+1, std::memory_order_release);
+        }
+        m_taken = NULL;
+    }
 
-    switch (packet->status) {
-    case RtpPacket::PacketFree:
-        qWarning()<<Q_FUNC_INFO<<"last packet:"<<m_lastPlayed;
+    // New stream or skipped packets, history does not continue
+    if (m_concealerGeneration != m_generation) {
+        m_concealer.reset();
+        m_concealerGeneration = m_generation;
+    }
+
+    if (m_ended.load(std::memory_order_acquire)) {
+        *takeStatus = TakeEnded;
+        leaveConsumer();
         return NULL;
-        break;
-    case RtpPacket::PacketMissing:
-        qWarning()<<Q_FUNC_INFO<<"missing packet:"<<packet->sequenceNumber;
-        memcpy(packet->payload, m_silence, packet->payloadSize);
-    case RtpPacket::PacketOk:
-        if (packet->flush) {
-            qDebug()<<Q_FUNC_INFO<<"flush packet:"<<packet->sequenceNumber;
+    }
+
+    // Stop playing old stream right away. Producer applies flush with next packet and decides
+    // about ready state, until then we return null.
+    const quint32 flushRequest = m_flushRequest.load(std::memory_order_acquire);
+    if (flushRequest) {
+        const quint16 flushSequence = flushRequest;
+        const quint16 end = m_end.load(std::memory_order_acquire);
+        quint16 begin = m_begin.load(std::memory_order_relaxed);
+        for (; (begin != end) && (qint16(begin-flushSequence) < 0); ++begin) {
+            RtpPacket *packet = &m_data[begin%m_capacity];
+            claimPacket(packet);
+            packet->init();
+            m_begin.store(begin+1, std::memory_order_release);
         }
-        m_lastPlayed = packet->sequenceNumber;
-        packet->init();
-        break;
-    default:
-        qFatal(Q_FUNC_INFO);
+        *takeStatus = TakeUnderrun;
+        leaveConsumer();
+        return NULL;
     }
 
-    return packet;
+    // If we flushed the buffer before, we return null until buffer is ready again
+    if (!isReady()) {
+        *takeStatus = TakeUnderrun;
+        leaveConsumer();
+        return NULL;
+    }
+
+    // Buffer stays ready on underrun, so we continue as soon as the next packet arrives.
+    const quint16 begin = m_begin.load(std::memory_order_relaxed);
+    if (begin == m_end.load(std::memory_order_acquire)) {
+        State expected = Ready;
+        if (m_state.compare_exchange_strong(expected, Draining)) {
+            qWarning()<<Q_FUNC_INFO<<"last packet:"<<m_lastPlayed;
+            m_stat.underrun++;
+            m_concealer.reset();
+            emit stateChanged(Draining);
+        }
+        *takeStatus = TakeUnderrun;
+        leaveConsumer();
+        return NULL;
+    }
+
+    // Follow adaptive target fill, at most one packet every few takes
+    if (m_adaptiveFill && (m_minLatency < m_maxLatency) && (m_adjustCountdown-- == 0)) {
+        m_adjustCountdown = 0;
+        const int desired = m_desiredFill.load(std::memory_order_relaxed);
+        const int fill = qint32(m_endTimestamp.load(std::memory_order_acquire)-m_playedTimestamp.load(std::memory_order_relaxed));
+        const int margin = desired/8+m_framesPerPacket;
+        if (fill > desired+margin && (m_data[begin%m_capacity].status.load(std::memory_order_acquire) == RtpPacket::PacketOk)) {
+            // Drop one packet
+            qDebug()<<Q_FUNC_INFO<<"shrink, fill:"<<fill<<"desired:"<<desired;
+            m_stat.dropped++;
+            const RtpPacket *dropped = &m_data[begin%m_capacity];
+            m_playedTimestamp.store(dropped->timestamp+frames(dropped), std::memory_order_release);
+            m_data[begin%m_capacity].init();
+            m_begin.store(begin+1, std::memory_order_release);
+            m_adjustCountdown = adjustInterval;
+            leaveConsumer();
+            return tryTakePacket(takeStatus);
+        } else if (fill < desired-margin) {
+            // Insert one concealed packet
+            qDebug()<<Q_FUNC_INFO<<"grow, fill:"<<fill<<"desired:"<<desired;
+            m_stat.inserted++;
+            m_adjustCountdown = adjustInterval;
+            m_concealer.conceal(payload(m_insertPacket), m_framesPerPacket);
+            // Follows the last packet, played timestamp does not advance
+            m_insertPacket->timestamp = m_playedTimestamp.load(std::memory_order_relaxed);
+            *takeStatus = TakeOk;
+            leaveConsumer();
+            return m_insertPacket;
+        }
+    }
+
+    // Hold the slot (mark busy) until next call. With lazy decode we return a decoded copy.
+    RtpPacket* packet = &(m_data[begin%m_capacity]);
+    RtpPacket* result = m_decoder ? m_decodedPacket : packet;
+    if (!claimPacket(packet)) {
+        // We own the missing slot now, a late packet will be rejected.
+        qWarning()<<Q_FUNC_INFO<<"missing packet:"<<begin;
+        // Producer sets sequence number of missing slots, only stale free slots need it.
+        if (result->sequenceNumber != begin) {
+            result->sequenceNumber = begin;
+        }
+        // Size of missing packet is unknown, we assume a full one
+        result->payloadSize = m_silencePacket->payloadSize;
+        result->timestamp = m_playedTimestamp.load(std::memory_order_relaxed);
+        result->flush = packet->flush;
+        m_concealer.conceal(payload(result), m_framesPerPacket);
+        *takeStatus = TakeLate;
+    } else {
+        if (m_decoder) {
+            result->sequenceNumber = packet->sequenceNumber;
+            result->timestamp = packet->timestamp;
+            result->flush = packet->flush;
+            result->arrival = packet->arrival;
+            result->committed = packet->committed;
+            result->payloadSize = m_decoder->decode(payload(packet), packet->payloadSize, payload(result));
+        }
+        *takeStatus = TakeOk;
+        m_concealer.process(payload(result), frames(result));
+    }
+    m_playedTimestamp.store(result->timestamp+frames(result), std::memory_order_release);
+
+    if (result->flush) {
+        qDebug()<<Q_FUNC_INFO<<"flush packet:"<<result->sequenceNumber;
+    }
+    m_lastPlayed = result->sequenceNumber;
+    m_stat.take++;
+    m_taken = packet;
+    m_takenGeneration = m_generation;
+
+    leaveConsumer();
+
+    return result;
+}
+
+bool RtpBuffer::claimPacket(RtpPacket *packet)
+{
+    RtpPacket::Status status = packet->status.load(std::memory_order_acquire);
+    while (true) {
+        if (status == RtpPacket::PacketBusy) {
+            // Late packet is being written right now, it is worth waiting for it.
+            QThread::yieldCurrentThread();
+            status = packet->status.load(std::memory_order_acquire);
+        } else if (packet->status.compare_exchange_weak(status, RtpPacket::PacketBusy, std::memory_order_acquire)) {
+            break;
+        }
+    }
+
+    return (status == RtpPacket::PacketOk);
+}
+
+char* RtpBuffer::payload(const RtpPacket* packet) const
+{
+    const int index = packet-m_data;
+    if (index >= m_capacity) {
+        return m_extraPayloads + (index-m_capacity)*m_payloadStride;
+    } else if (m_arena) {
+        return m_arena + packet->offset%m_arenaSize;
+    }
+    return m_payloads + index*m_payloadStride;
 }
 
 void RtpBuffer::silence(char **silence, int *size) const
@@ -134,42 +622,82 @@ void RtpBuffer::silence(char **silence, int *size) const
     *size   = m_framesPerPacket*airtunes::channels*(airtunes::sampleSize/8);
 }
 
-QList<RtpBuffer::Sequence> RtpBuffer::missingSequences() const
+QList<RtpBuffer::Sequence> RtpBuffer::missingSequences()
 {
-    QMutexLocker locker(&m_mutex);
-
-    QList<RtpBuffer::Sequence> missingSequences;
-    int startOfSequence = -1;
-    int endOfSequence   = -1;
+    if (m_missing.isEmpty()) {
+        return m_missing;
+    }
 
-    for (int i = m_begin%m_capacity; i != m_end%m_capacity; i = (i+1)%m_capacity) {
-        // find startOfSequence of missing packets
-        if (m_data[i].status == RtpPacket::PacketMissing && startOfSequence == -1) {
-            startOfSequence = m_data[i].sequenceNumber;
+    // Prune sequences already taken by consumer
+    const quint16 begin = m_begin.load(std::memory_order_acquire);
+    while (!m_missing.isEmpty()) {
+        Sequence &sequence = m_missing.first();
+        const qint16 taken = begin-sequence.first;
+        if (taken <= 0) {
+            break;
+        } else if (taken < sequence.count) {
+            sequence.first += taken;
+            sequence.count -= taken;
+            break;
         }
-        // find endOfSequence of missing packets
-        if ((m_data[(i+1)%m_capacity].status != RtpPacket::PacketMissing) && startOfSequence != -1) {
-            endOfSequence = m_data[i].sequenceNumber;
+        m_missing.removeFirst();
+    }
 
-            missingSequences.push_back( { static_cast<quint16>(startOfSequence), static_cast<quint16>(endOfSequence-startOfSequence+1) } );
+    return m_missing;
+}
 
-            startOfSequence = -1;
-            endOfSequence   = -1;
-        }
+int RtpBuffer::timeToPlay(quint16 sequenceNumber) const
+{
+    // While filling, consumer starts once desired fill is reached
+    qint32 frames = timestampOf(sequenceNumber)-m_playedTimestamp.load(std::memory_order_acquire);
+    if (!isReady()) {
+        frames += qMax(m_desiredFill.load(std::memory_order_relaxed)-fill(), 0);
     }
+    return (qint64(frames)*1000)/airtunes::sampleRate;
+}
+
+void RtpBuffer::addMissing(quint16 first, quint16 count)
+{
+    // Sequences are always appended at m_end, so the list stays ordered
+    m_missing.append( { first, count } );
+}
 
-    return missingSequences;
+void RtpBuffer::removeMissing(quint16 sequenceNumber)
+{
+    for (int i = 0; i < m_missing.size(); ++i) {
+        Sequence &sequence = m_missing[i];
+        const quint16 offset = sequenceNumber-sequence.first;
+        if (offset >= sequence.count) {
+            continue;
+        }
+
+        if (sequence.count == 1) {
+            m_missing.removeAt(i);
+        } else if (offset == 0) {
+            ++sequence.first;
+            --sequence.count;
+        } else if (offset == sequence.count-1) {
+            --sequence.count;
+        } else {
+            // Split sequence
+            const Sequence tail = { static_cast<quint16>(sequenceNumber+1), static_cast<quint16>(sequence.count-offset-1) };
+            sequence.count = offset;
+            m_missing.insert(i+1, tail);
+        }
+        return;
+    }
 }
 
-RtpBuffer::PacketRating RtpBuffer::ratePacket(const RtpHeader& rtpHeader)
+RtpBuffer::PacketRating RtpBuffer::ratePacket(const RtpHeader& rtpHeader, qint64 arrival)
 {
     m_stat.put++;
+    updateJitter(rtpHeader, arrival);
 
     // 1. Check for duplicate (PacketStatus == ok)
     // 2. Regular packet (always take it)
-    // 2.1 Start (new stream) (m_begin == empty)
+    // 2.1 Start (new stream) (buffer empty)
     // 2.2 seqDiff: –32.768 to 32.767
-    // 2.2.1 early (0 < seqDiff < desiredFill(63))
+    // 2.2.1 early (0 < seqDiff < maxFill(63))
     // 2.2.2 expected (seqDiff == 0)
     // 2.2.3 late (seqDiff < 0 && PacketStatus == missing) // also handle retransmission here
     // 2.2.4 start (new stream here, 'cause (seqDiff > desiredFill || seqDiff < 0)
@@ -177,25 +705,34 @@ RtpBuffer::PacketRating RtpBuffer::ratePacket(const RtpHeader& rtpHeader)
 
     // Fetch slot from buffer
     RtpPacket* packet = &(m_data[rtpHeader.sequenceNumber%m_capacity]);
+    const RtpPacket::Status status = packet->status.load(std::memory_order_acquire);
 
     // 1. Check for duplicate
-    if ((packet->sequenceNumber == rtpHeader.sequenceNumber) && (packet->status == RtpPacket::PacketOk)) {
+    if ((status == RtpPacket::PacketOk) && (packet->sequenceNumber == rtpHeader.sequenceNumber)) {
         qDebug()<<Q_FUNC_INFO<< "packet already received:"<<packet->sequenceNumber;
         m_stat.duplicates++;
         return Duplicate;
     }
 
-    // 2.1 New stream if empty
-    if (m_data[m_begin%m_capacity].status == RtpPacket::PacketFree) {
+    // 2.1 New stream if empty. After an underrun the stream goes on, packets the consumer
+    // already passed are too late.
+    const quint16 end = m_end.load(std::memory_order_relaxed);
+    if (m_begin.load(std::memory_order_acquire) == end) {
+        const qint16 behind = end-rtpHeader.sequenceNumber;
+        if ((m_state.load(std::memory_order_acquire) == Draining) && (behind > 0) && (behind < m_maxFill)) {
+            qDebug()<<Q_FUNC_INFO<< "too late packet:"<<rtpHeader.sequenceNumber;
+            m_stat.lost++;
+            return TooLate;
+        }
         qDebug()<<Q_FUNC_INFO<< "new stream:"<<rtpHeader.sequenceNumber;
         return Start;
     }
 
     // 2.2 Interpret seqDiff
-    qint16 seqDiff = rtpHeader.sequenceNumber-m_end;
-    // 2.2.1 Early (0 < seqDiff < desiredFill(63))
-    if ((seqDiff > 0) && (seqDiff < m_desiredFill)) {
-        qDebug()<<Q_FUNC_INFO<< "missing packets:"<<m_end<<"-"<<(rtpHeader.sequenceNumber-1);
+    qint16 seqDiff = rtpHeader.sequenceNumber-end;
+    // 2.2.1 Early (0 < seqDiff < maxFill(63))
+    if ((seqDiff > 0) && (seqDiff < m_maxFill)) {
+        qDebug()<<Q_FUNC_INFO<< "missing packets:"<<end<<"-"<<(rtpHeader.sequenceNumber-1);
         m_stat.early++;
         return Early;
     }
@@ -204,7 +741,7 @@ RtpBuffer::PacketRating RtpBuffer::ratePacket(const RtpHeader& rtpHeader)
         return Expected;
     }
     // 2.2.3 late (seqDiff < 0 && PacketStatus == missing) // also handle retransmission here
-    if ((packet->sequenceNumber == rtpHeader.sequenceNumber) && (packet->status == RtpPacket::PacketMissing)) {
+    if ((status == RtpPacket::PacketMissing) && (packet->sequenceNumber == rtpHeader.sequenceNumber)) {
         //qDebug()<<Q_FUNC_INFO<< "late packet:"<<packet->sequenceNumber;
         m_stat.late++;
         return Late;
@@ -216,52 +753,239 @@ RtpBuffer::PacketRating RtpBuffer::ratePacket(const RtpHeader& rtpHeader)
         return TooLate;
     }
 
-    qDebug()<<Q_FUNC_INFO<< "flush buffer, end:"<<m_end<<", this:"<<rtpHeader.sequenceNumber;
-    flush();
+    qDebug()<<Q_FUNC_INFO<< "flush buffer, end:"<<end<<", this:"<<rtpHeader.sequenceNumber;
+    clear();
     return RtpBuffer::Start;
 }
 
-quint16 RtpBuffer::size()
+void RtpBuffer::updateJitter(const RtpHeader& rtpHeader, qint64 arrivalTime)
 {
-    return m_end-m_begin-1;
+    // Retransmitted packets do not tell anything about network jitter
+    if (rtpHeader.payloadType != airtunes::AudioData) {
+        return;
+    }
+
+    // Arrival time in timestamp units (samples)
+    const qint64 arrival = (arrivalTime/1000)*airtunes::sampleRate/1000000;
+
+    // Restart estimation on new streams
+    if (m_intervalReceived && (qAbs(qint16(rtpHeader.sequenceNumber-m_intervalEnd)) > m_maxFill)) {
+        m_hasTransit = false;
+        m_intervalReceived = 0;
+    }
+
+    if (m_hasTransit) {
+        // D(i-1,i) = (Rj - Ri) - (Sj - Si), J(i) = J(i-1) + (|D(i-1,i)| - J(i-1))/16
+        const qint64 d = qMin(qAbs((arrival-m_lastArrival) - qint32(rtpHeader.timestamp-m_lastTimestamp)), qint64(airtunes::sampleRate));
+        m_jitter = qint64(m_jitter) + d - ((m_jitter+8) >> 4);
+    }
+    m_hasTransit = true;
+    m_stat.jitter = (quint64(m_jitter >> 4)*1000000)/airtunes::sampleRate;
+    m_lastArrival = arrival;
+    m_lastTimestamp = rtpHeader.timestamp;
+
+    // Loss estimation per interval of about one second
+    if (m_intervalReceived == 0) {
+        m_intervalBegin = rtpHeader.sequenceNumber;
+        m_intervalEnd = rtpHeader.sequenceNumber+1;
+    } else if (qint16(rtpHeader.sequenceNumber-m_intervalEnd) >= 0) {
+        m_intervalEnd = rtpHeader.sequenceNumber+1;
+    }
+    ++m_intervalReceived;
+
+    if (quint16(m_intervalEnd-m_intervalBegin) >= (airtunes::sampleRate/m_framesPerPacket)) {
+        adaptFill();
+        m_intervalReceived = 0;
+    }
 }
 
-void RtpBuffer::flush()
+void RtpBuffer::adaptFill()
 {
+    if (m_minLatency >= m_maxLatency) {
+        return;
+    }
+
+    const uint expected = quint16(m_intervalEnd-m_intervalBegin);
+    const uint lost = (expected > m_intervalReceived) ? (expected-m_intervalReceived) : 0;
+    const uint lossPercent = (100*lost)/expected;
+    const uint jitter = ((m_jitter >> 4)*1000)/airtunes::sampleRate;
+
+    const uint latency = qBound(m_minLatency, m_minLatency + jitterFactor*jitter + lossPenalty*lossPercent, m_maxLatency);
+    const int currentFill = m_desiredFill.load(std::memory_order_relaxed);
+    int desiredFill = latencyToFill(latency);
+
+    // Grow at once, shrink slowly
+    if (desiredFill < currentFill) {
+        desiredFill = qMax(desiredFill, currentFill-(currentFill/16+1));
+    }
+
+    if (desiredFill != currentFill) {
+        qDebug()<<Q_FUNC_INFO<<"jitter:"<<jitter<<"ms, loss:"<<lossPercent<<"%, desired fill:"<<desiredFill;
+        m_desiredFill.store(desiredFill, std::memory_order_relaxed);
+    }
+}
+
+int RtpBuffer::latencyToFill(uint latency) const
+{
+    return (airtunes::sampleRate*latency)/1000;
+}
+
+void RtpBuffer::setState(State state)
+{
+    const State previous = m_state.exchange(state);
+    if (previous == state) {
+        return;
+    }
+
+    qDebug()<<Q_FUNC_INFO<<previous<<"->"<<state;
+    emit stateChanged(state);
+    if ((state == Ready) && (previous != Draining)) {
+        emit ready();
+    }
+}
+
+bool RtpBuffer::isReady() const
+{
+    const State state = m_state.load(std::memory_order_acquire);
+    return (state == Ready) || (state == Draining);
+}
+
+quint16 RtpBuffer::size() const
+{
+    return m_end.load(std::memory_order_acquire)-m_begin.load(std::memory_order_acquire);
+}
+
+int RtpBuffer::fill() const
+{
+    // Consumer might be ahead for a moment after an underrun
+    return qMax(qint32(m_endTimestamp.load(std::memory_order_relaxed)-m_playedTimestamp.load(std::memory_order_acquire)), 0);
+}
+
+quint32 RtpBuffer::timestampOf(quint16 sequenceNumber) const
+{
+    // Exact if we have that packet, otherwise estimate from newest packet
+    const RtpPacket *packet = &m_data[sequenceNumber%m_capacity];
+    if ((packet->status.load(std::memory_order_acquire) == RtpPacket::PacketOk) && (packet->sequenceNumber == sequenceNumber)) {
+        return packet->timestamp;
+    }
+    return m_endTimestamp.load(std::memory_order_relaxed)+qint16(sequenceNumber-m_end.load(std::memory_order_relaxed))*int(m_framesPerPacket);
+}
+
+void RtpBuffer::clear()
+{
+    m_missing.clear();
+    lockConsumer();
     for (quint16 i = 0; i < m_capacity; ++i) {
-        m_data[i].init();
+        release(&m_data[i]);
     }
-    m_ready = false;
+    setState(Empty);
+    ++m_generation;
+    unlockConsumer();
     m_stat.flush++;
 }
 
-void RtpBuffer::alloc()
+bool RtpBuffer::isHeld(const RtpPacket* packet) const
 {
-    free();
+    // Producer never leaves a slot busy, so this is the packet held by consumer.
+    return packet->status.load(std::memory_order_acquire) == RtpPacket::PacketBusy;
+}
+
+void RtpBuffer::release(RtpPacket* packet)
+{
+    // Consumer releases held packet itself on next take
+    if (!isHeld(packet)) {
+        packet->init();
+    }
+}
 
-    const uint bytesPerPacket = m_framesPerPacket*airtunes::channels*(airtunes::sampleSize/8);
+void RtpBuffer::lockConsumer()
+{
+    // Dekker style handshake, requires sequential consistency.
+    m_consumerLocked.store(true);
+    while (m_consumerBusy.load()) {
+        QThread::yieldCurrentThread();
+    }
+}
+
+void RtpBuffer::unlockConsumer()
+{
+    m_consumerLocked.store(false);
+}
 
-    m_data = new RtpPacket[m_capacity];
-    for (uint i = 0; i < m_capacity; ++i) {
-        m_data[i].payload = new char[bytesPerPacket];
+void RtpBuffer::enterConsumer()
+{
+    m_consumerBusy.store(true);
+    while (m_consumerLocked.load()) {
+        m_consumerBusy.store(false);
+        QThread::yieldCurrentThread();
+        m_consumerBusy.store(true);
     }
+}
+
+void RtpBuffer::leaveConsumer()
+{
+    m_consumerBusy.store(false);
+}
+
+void RtpBuffer::alloc()
+{
+    free();
 
-    m_silence = new char[bytesPerPacket];
-    memset(m_silence, 0, bytesPerPacket);
+    // Extra packets are constant silence, the one we insert to grow fill and the decoded one
+    m_data = new RtpPacket[m_capacity+extraPackets];
+    m_silencePacket = &m_data[m_capacity];
+    m_insertPacket = &m_data[m_capacity+1];
+    m_decodedPacket = &m_data[m_capacity+2];
+
+    // One contiguous slab for all payloads plus extra packets. With lazy decode the ring
+    // payloads live in an arena of max fill packets instead of one slot per ring entry,
+    // plus the one consumer holds and the one producer writes. ALAC might escape to
+    // uncompressed frames, so each packet is reserved at full size.
+    const size_t ringSize = m_decoder ? (m_maxFill+2)*(m_payloadStride+cacheLineSize) : m_capacity*m_payloadStride;
+    m_payloadsSize = ringSize + extraPackets*m_payloadStride;
+    const size_t alignment = (m_payloadsSize >= hugePageSize) ? hugePageSize : cacheLineSize;
+    if (alignment == hugePageSize) {
+        m_payloadsSize = (m_payloadsSize+hugePageSize-1) & ~(hugePageSize-1);
+    }
+    void *payloads = NULL;
+    if (posix_memalign(&payloads, alignment, m_payloadsSize) != 0) {
+        qFatal("RtpBuffer::alloc: cannot allocate payloads");
+    }
+#ifdef MADV_HUGEPAGE
+    if (alignment == hugePageSize) {
+        madvise(payloads, m_payloadsSize, MADV_HUGEPAGE);
+    }
+#endif
+    m_payloads = static_cast<char*>(payloads);
+    memset(m_payloads, 0, m_payloadsSize);
+    m_arena = m_decoder ? m_payloads : NULL;
+    m_arenaSize = ringSize;
+    m_extraPayloads = m_payloads + ringSize;
+
+    m_silence = payload(m_silencePacket);
+    m_silencePacket->payloadSize = m_framesPerPacket*airtunes::channels*(airtunes::sampleSize/8);
+    m_silencePacket->status.store(RtpPacket::PacketOk);
+    m_insertPacket->payloadSize = m_silencePacket->payloadSize;
+    m_insertPacket->status.store(RtpPacket::PacketOk);
 }
 
 void RtpBuffer::free()
 {
     if (m_data) {
-        for (uint i = 0; i < m_capacity; ++i) {
-            delete[] m_data[i].payload;
-        }
         delete[] m_data;
         m_data = NULL;
+        m_silencePacket = NULL;
+        m_insertPacket = NULL;
+        m_decodedPacket = NULL;
     }
 
-    if (m_silence) {
-        delete[] m_silence;
+    if (m_payloads) {
+        ::free(m_payloads);
+        m_payloads = NULL;
+        m_payloadsSize = 0;
+        m_extraPayloads = NULL;
+        m_arena = NULL;
+        m_arenaSize = 0;
         m_silence = NULL;
     }
 }
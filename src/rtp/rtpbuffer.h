@@ -1,41 +1,99 @@
 #ifndef RTPBUFFER_H
 #define RTPBUFFER_H
 
+#include "rtpconcealer.h"
 #include "rtpstat.h"
 
+#include <atomic>
+#include <QElapsedTimer>
 #include <QList>
 #include <QMutex>
 #include <QObject>
+#include <QWaitCondition>
 
+class RtpDecoder;
 struct RtpHeader;
 struct RtpPacket;
 
+// Single-producer/single-consumer ring of RTP packets. The producer (UdpWorker)
+// and the consumer (PlayWorker) never block each other during regular operation.
+// Only structural changes (new stream, flush, overflow) briefly lock out the consumer.
 class RtpBuffer : public QObject
 {
     Q_OBJECT
 public:
-    // framesPerPacket = stereo frames per second.
-    RtpBuffer(uint framesPerPacket, uint latency = 500, QObject *parent = 0);
+    enum State {
+        Empty,      // no packets
+        Filling,    // receiving, but below target fill
+        Ready,      // consumer plays packets
+        Draining    // consumer ran out of packets, continues with next one
+    };
+
+    // framesPerPacket = max stereo frames per packet, packets may be smaller.
+    // Fill and latency are accounted in frames, using the RTP timestamps.
+    // If minLatency < maxLatency, the target latency adapts to measured network jitter and loss.
+    RtpBuffer(uint framesPerPacket, uint latency = 500, uint minLatency = 0, uint maxLatency = 0, QObject *parent = 0);
     ~RtpBuffer();
 
-    // producer thread
-    RtpPacket* obtainPacket(const RtpHeader& rtpHeader);
+    // Reallocate for another max frames per packet (e.g. from fmtp).
+    // Only call this while there is neither producer nor consumer.
+    void setFramesPerPacket(uint framesPerPacket);
+
+    // Lazy decode: producer stores encrypted packets, consumer decodes them when it takes them.
+    // Buffer takes ownership of decoder, NULL switches back to decoded packets.
+    // Only call this while there is neither producer nor consumer.
+    void setDecoder(RtpDecoder *decoder);
+
+    // max bytes producer may write to the payload of an obtained packet
+    int maxPayloadSize() const;
+
+    // current target latency in milliseconds
+    uint latency() const;
+    // configured max latency in milliseconds, target latency never exceeds it
+    uint maxLatency() const;
+
+    // producer thread, arrival is the receive time in nanoseconds (RtpClock::now() time base), -1 for now
+    RtpPacket* obtainPacket(const RtpHeader& rtpHeader, qint64 arrival = -1);
     void commitPacket(RtpPacket* packet);
 
-    // consumer thread
-    const RtpPacket* takePacket();
+    // consumer thread, returned packet stays valid until next call
+    enum TakeStatus {
+        TakeOk,         // packet received in time
+        TakeLate,       // packet did not arrive in time, returned packet is concealed
+        TakeUnderrun,   // no packet within timeout, returns NULL
+        TakeEnded       // stream has been torn down, returns NULL
+    };
+    const RtpPacket* takePacket(int timeout = 0, TakeStatus *status = NULL);
+
+    // consumer thread, turns off adaptive fill, e.g. while sender's presentation time decides latency
+    void setAdaptiveFill(bool enabled);
+
+    // any thread, wakes consumer and makes it return TakeEnded until buffer is ready again
+    void teardown();
+
+    // payload of a packet obtained from or taken from this buffer
+    char* payload(const RtpPacket* packet) const;
 
     // silence for missing packets
     void silence(char **silence, int *size) const;
 
-    // get missing sequences
+    // get missing sequences (producer thread)
     struct Sequence {
         quint16 first;
         quint16 count;
     };
-    QList<Sequence> missingSequences() const;
+    QList<Sequence> missingSequences();
+
+    // milliseconds until consumer plays sequenceNumber, negative if it is late (producer thread)
+    int timeToPlay(quint16 sequenceNumber) const;
+
+public slots:
+    // any thread, drop packets before sequenceNumber (RTSP FLUSH/RECORD)
+    void flush(quint16 sequenceNumber);
 
 signals:
+    // emitted on state transitions only, ready() once per stream when it becomes ready
+    void stateChanged(RtpBuffer::State state);
     void ready();
 
 private:
@@ -47,11 +105,50 @@ private:
         Late,       // packet is late (eventually from retransmit)
         TooLate,    // packet is too late (from retransmit)
     };
-    PacketRating ratePacket(const RtpHeader& rtpHeader);
+    PacketRating ratePacket(const RtpHeader& rtpHeader, qint64 arrival);
+
+    // Producer side of flush(sequenceNumber), false if packet belongs to flushed stream
+    bool applyFlush(const RtpHeader& rtpHeader);
+
+    // Consumer helpers
+    const RtpPacket* tryTakePacket(TakeStatus *takeStatus);
+    // Mark slot busy, returns false if it is missing
+    bool claimPacket(RtpPacket *packet);
+    bool waitForPacket(int timeout);
+    // Producer side: wake consumer, if it waits
+    void wakeConsumer();
 
     // Buffer helpers
-    quint16 size();
-    void flush();
+    void reallocate();
+    bool reserve(quint64 *offset);
+    int frames(const RtpPacket *packet) const;
+    void setState(State state);
+    bool isReady() const;
+    quint16 size() const;
+    int fill() const;
+    quint32 timestampOf(quint16 sequenceNumber) const;
+    void clear();
+
+    // Missing sequence index (producer thread)
+    void addMissing(quint16 first, quint16 count);
+    void removeMissing(quint16 sequenceNumber);
+
+    // Adaptive fill (producer thread)
+    void updateJitter(const RtpHeader& rtpHeader, qint64 arrival);
+    void adaptFill();
+    int latencyToFill(uint latency) const;
+
+    // Slot held by consumer (between two takePacket calls)
+    bool isHeld(const RtpPacket* packet) const;
+    // Free slot unless held by consumer
+    void release(RtpPacket* packet);
+
+    // Producer side: keep consumer out of the buffer while we modify m_begin
+    void lockConsumer();
+    void unlockConsumer();
+    // Consumer side: enter/leave the buffer
+    void enterConsumer();
+    void leaveConsumer();
 
     // Memory
     void alloc();
@@ -59,22 +156,84 @@ private:
 
 private:
     // General buffer settings and data
-    const uint      m_framesPerPacket;
+    uint            m_framesPerPacket;  // max frames per packet
     const uint      m_latency;
-    const int       m_desiredFill;
-    const quint16   m_capacity;
-    RtpPacket       *m_data;
+    const uint      m_minLatency;
+    const uint      m_maxLatency;
+    int             m_maxFill;          // in packets
+    std::atomic<int>    m_desiredFill;  // in frames
+    quint16         m_capacity;
+    uint            m_payloadStride;    // bytes per payload slot, multiple of a cache line
+    RtpPacket       *m_data;            // compact metadata array
+    RtpPacket       *m_silencePacket;   // behind last slot, constant silence
+    RtpPacket       *m_insertPacket;    // behind silence, concealed packet to grow fill
+    RtpPacket       *m_decodedPacket;   // behind insert, decoded packet in lazy decode mode
+    char            *m_payloads;        // payload slab, ring payloads (or arena) followed by extra packets
+    size_t          m_payloadsSize;
+    char            *m_extraPayloads;   // payloads of silence, insert and decoded packet
     char            *m_silence;
 
-    quint16     m_begin;
-    quint16     m_end;
-    mutable QMutex  m_mutex;
+    // Lazy decode. Encrypted payloads are variable sized, so they go to an arena of
+    // m_maxFill+2 full packets instead of one slot per packet. Offsets grow monotonically (64 bit, never wrap).
+    RtpDecoder      *m_decoder;
+    char            *m_arena;
+    quint32         m_arenaSize;
+    quint64         m_arenaWrite;   // producer, next free offset
+    quint64         m_arenaTail;    // producer, oldest offset possibly in use
+
+    // m_begin is owned by consumer, m_end by producer. Keep them on separate cache lines.
+    alignas(64) std::atomic<quint16>    m_begin;
+    alignas(64) std::atomic<quint16>    m_end;
+    quint16                 m_pendingEnd;   // m_end after commit of current packet
+
+    // Fill in frames is m_endTimestamp-m_playedTimestamp
+    std::atomic<quint32>    m_endTimestamp;     // producer, behind newest packet
+    std::atomic<quint32>    m_playedTimestamp;  // consumer, behind last taken packet
 
     // Needed to stop consumer
-    bool        m_ready;
+    alignas(64) std::atomic<State>  m_state;
+    std::atomic<bool>       m_consumerBusy;
+    std::atomic<bool>       m_consumerLocked;
+    RtpPacket               *m_taken;       // packet still held by consumer
+    quint32                 m_takenGeneration;
+    quint32                 m_generation;   // incremented whenever producer moves m_begin
+
+    // Needed to block consumer. Producer only locks m_waitMutex if consumer waits.
+    std::atomic<bool>       m_ended;
+    std::atomic<bool>       m_consumerWaiting;
+    QMutex                  m_waitMutex;
+    QWaitCondition          m_waitCondition;
+
+    // Targeted flush. Request (flushPending|sequenceNumber) is applied by producer on next packet.
+    std::atomic<quint32>    m_flushRequest;
+    bool                    m_flushFilter;      // producer drops packets before m_flushSequence
+    quint16                 m_flushSequence;
+
+    // Missing packets, ordered by sequence number. Entries before m_begin are pruned
+    // lazily by missingSequences(), so consumer never touches this.
+    QList<Sequence> m_missing;
+
+    // Jitter and loss estimation, RFC 3550 A.8 (producer thread)
+    bool            m_hasTransit;
+    qint64          m_lastArrival;  // in samples
+    quint32         m_lastTimestamp;
+    quint32         m_jitter;       // in samples, scaled by 16
+    quint16         m_intervalBegin;    // first sequence number of current interval
+    quint16         m_intervalEnd;      // highest sequence number+1 of current interval
+    uint            m_intervalReceived;
+
+    // Consumer side fill adjustment
+    uint            m_adjustCountdown;
+    bool            m_adaptiveFill;
+
+    // Consumer side packet loss concealment
+    RtpConcealer    m_concealer;
+    quint32         m_concealerGeneration;
 
     // Statistics
     RtpStat     m_stat;
     quint16     m_lastPlayed;
 };
+Q_DECLARE_METATYPE(RtpBuffer::State)
+
 #endif // RTPBUFFER_H
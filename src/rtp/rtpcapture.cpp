@@ -0,0 +1,106 @@
+#include "rtpcapture.h"
+
+#include <QDebug>
+
+static const quint32 magic = 0x4f464350;    // "OFCP"
+static const quint16 version = 1;
+
+RtpCapture::RtpCapture(const QString &fileName) :
+    m_file(fileName),
+    m_arrival(0)
+{
+    m_stream.setVersion(QDataStream::Qt_5_0);
+}
+
+RtpCapture::~RtpCapture()
+{
+    m_file.close();
+}
+
+bool RtpCapture::openWrite()
+{
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning()<<Q_FUNC_INFO<<"cannot open:"<<m_file.fileName()<<m_file.errorString();
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+
+    if (m_file.size() == 0) {
+        m_stream<<magic<<version;
+    }
+    return true;
+}
+
+void RtpCapture::writeAnnouncement(const RtspMessage::Announcement &announcement)
+{
+    m_stream<<quint8(Announcement)<<announcement.fmtp<<announcement.rsaAesKey<<announcement.aesIv;
+    flush();
+}
+
+void RtpCapture::writeDatagram(const char *data, int size, qint64 arrival)
+{
+    // Same layout as a serialized QByteArray, without copying into one
+    m_stream<<quint8(Datagram)<<arrival<<quint32(size);
+    m_stream.writeRawData(data, size);
+}
+
+void RtpCapture::flush()
+{
+    m_file.flush();
+}
+
+bool RtpCapture::openRead()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qWarning()<<Q_FUNC_INFO<<"cannot open:"<<m_file.fileName()<<m_file.errorString();
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+
+    quint32 fileMagic = 0;
+    quint16 fileVersion = 0;
+    m_stream>>fileMagic>>fileVersion;
+    if ((fileMagic != magic) || (fileVersion != version)) {
+        qWarning()<<Q_FUNC_INFO<<"not a capture file:"<<m_file.fileName();
+        return false;
+    }
+    return true;
+}
+
+RtpCapture::Record RtpCapture::read()
+{
+    quint8 record = None;
+    m_stream>>record;
+
+    switch (record) {
+    case Announcement:
+        m_stream>>m_announcement.fmtp>>m_announcement.rsaAesKey>>m_announcement.aesIv;
+        break;
+    case Datagram:
+        m_stream>>m_arrival>>m_datagram;
+        break;
+    default:
+        record = None;
+        break;
+    }
+
+    if (m_stream.status() != QDataStream::Ok) {
+        return None;
+    }
+    return static_cast<Record>(record);
+}
+
+const RtspMessage::Announcement &RtpCapture::announcement() const
+{
+    return m_announcement;
+}
+
+const QByteArray &RtpCapture::datagram() const
+{
+    return m_datagram;
+}
+
+qint64 RtpCapture::arrival() const
+{
+    return m_arrival;
+}
@@ -0,0 +1,52 @@
+#ifndef RTPCAPTURE_H
+#define RTPCAPTURE_H
+
+#include "rtsp/rtspmessage.h"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+
+// Capture file of a receive session, for offline replay and profiling.
+//
+// A file starts with a magic and version, followed by records. An announcement record
+// holds the stream parameters (fmtp, AES key and IV), a datagram record holds one received
+// RTP datagram with its arrival time. Each new session appends another announcement.
+// Written by the receiver: announcements from its own thread, datagrams from the socket thread.
+class RtpCapture
+{
+public:
+    enum Record {
+        None,           // end of file or error
+        Announcement,
+        Datagram
+    };
+
+    explicit RtpCapture(const QString &fileName);
+    ~RtpCapture();
+
+    // Writing, appends to existing captures
+    bool openWrite();
+    void writeAnnouncement(const RtspMessage::Announcement &announcement);
+    // arrival: receive time in nanoseconds (RtpClock::now() time base)
+    void writeDatagram(const char *data, int size, qint64 arrival);
+    void flush();
+
+    // Reading
+    bool openRead();
+    // Read next record, its content is available until the next call
+    Record read();
+    const RtspMessage::Announcement &announcement() const;
+    const QByteArray &datagram() const;
+    qint64 arrival() const;
+
+private:
+    QFile       m_file;
+    QDataStream m_stream;
+
+    RtspMessage::Announcement m_announcement;
+    QByteArray  m_datagram;
+    qint64      m_arrival;
+};
+
+#endif // RTPCAPTURE_H
@@ -0,0 +1,198 @@
+#include "rtpclock.h"
+
+#include "airtunes/airtunesconstants.h"
+
+#include <QDebug>
+
+#include <time.h>
+
+// Exchanges to select the min round trip time from, they are ~3 s apart
+static const int sampleWindow = 8;
+// Estimates to fit drift over
+static const int historySize = 16;
+// Drift is not trusted below that history span, nor beyond that value
+static const qint64 minDriftSpan = 10000000000LL;
+static const double maxDrift = 500e-6;
+
+static const qint64 nsecsPerSec = 1000000000LL;
+
+RtpClock::RtpClock()
+{
+    reset();
+}
+
+qint64 RtpClock::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec)*nsecsPerSec + ts.tv_nsec;
+}
+
+qint64 RtpClock::realtimeOffset()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return now() - (qint64(ts.tv_sec)*nsecsPerSec + ts.tv_nsec);
+}
+
+qint64 RtpClock::fromNtp(quint64 ntp)
+{
+    const quint64 seconds = ntp >> 32;
+    const quint64 fraction = ntp & 0xffffffff;
+    return seconds*nsecsPerSec + ((fraction*nsecsPerSec) >> 32);
+}
+
+quint64 RtpClock::toNtp(qint64 nsecs)
+{
+    const quint64 seconds = nsecs/nsecsPerSec;
+    const quint64 fraction = ((nsecs%nsecsPerSec) << 32)/nsecsPerSec;
+    return (seconds << 32) | fraction;
+}
+
+void RtpClock::addSample(qint64 localSend, qint64 remoteReceive, qint64 remoteSend, qint64 localReceive)
+{
+    const qint64 rtt = (localReceive-localSend)-(remoteSend-remoteReceive);
+    if (rtt < 0) {
+        qWarning()<<Q_FUNC_INFO<<"invalid timing exchange, rtt:"<<rtt;
+        return;
+    }
+    const Sample sample = { localSend+(localReceive-localSend)/2, ((remoteReceive-localSend)+(remoteSend-localReceive))/2, rtt };
+
+    QMutexLocker locker(&m_mutex);
+    m_samples.append(sample);
+    if (m_samples.size() > sampleWindow) {
+        m_samples.removeFirst();
+    }
+
+    // Min round trip time wins
+    Sample best = m_samples.first();
+    for (const Sample &s : m_samples) {
+        if (s.rtt < best.rtt) {
+            best = s;
+        }
+    }
+    if (m_valid && (best.local == m_estimate.local)) {
+        return;
+    }
+
+    m_estimate = best;
+    m_valid = true;
+    m_history.append(best);
+    if (m_history.size() > historySize) {
+        m_history.removeFirst();
+    }
+    updateDrift();
+
+    qDebug()<<Q_FUNC_INFO<<"offset:"<<m_estimate.offset<<"rtt:"<<m_estimate.rtt<<"drift:"<<m_drift;
+}
+
+void RtpClock::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_samples.clear();
+    m_history.clear();
+    m_estimate.local = 0;
+    m_estimate.offset = 0;
+    m_estimate.rtt = 0;
+    m_valid = false;
+    m_drift = 0.0;
+    m_syncValid = false;
+    m_syncTimestamp = 0;
+    m_syncTime = 0;
+}
+
+bool RtpClock::isValid() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_valid;
+}
+
+qint64 RtpClock::offset(qint64 local) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_estimate.offset + qint64(m_drift*(local-m_estimate.local));
+}
+
+double RtpClock::drift() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_drift;
+}
+
+qint64 RtpClock::rtt() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_estimate.rtt;
+}
+
+qint64 RtpClock::toLocal(qint64 remote) const
+{
+    QMutexLocker locker(&m_mutex);
+    return toLocalLocked(remote);
+}
+
+qint64 RtpClock::toRemote(qint64 local) const
+{
+    return local+offset(local);
+}
+
+void RtpClock::setSync(quint32 rtpTimestamp, quint64 ntpTime)
+{
+    QMutexLocker locker(&m_mutex);
+    m_syncTimestamp = rtpTimestamp;
+    m_syncTime = fromNtp(ntpTime);
+    m_syncValid = true;
+}
+
+bool RtpClock::isSynced() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_syncValid && m_valid;
+}
+
+bool RtpClock::presentationTime(quint32 rtpTimestamp, qint64 *local) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_syncValid || !m_valid) {
+        return false;
+    }
+
+    // Frames are sender clock ticks, so count them on remote time line
+    const qint64 frames = qint32(rtpTimestamp-m_syncTimestamp);
+    *local = toLocalLocked(m_syncTime + (frames*nsecsPerSec)/airtunes::sampleRate);
+    return true;
+}
+
+qint64 RtpClock::toLocalLocked(qint64 remote) const
+{
+    // remote = local + offset + drift*(local-estimate.local), solved for local
+    const qint64 reference = m_estimate.local+m_estimate.offset;
+    return m_estimate.local + qint64((remote-reference)/(1.0+m_drift));
+}
+
+void RtpClock::updateDrift()
+{
+    // Least squares fit of offset over local time, relative to oldest estimate
+    const Sample &first = m_history.first();
+    const qint64 span = m_history.last().local-first.local;
+    if (span < minDriftSpan) {
+        return;
+    }
+
+    const int n = m_history.size();
+    double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+    for (const Sample &s : m_history) {
+        const double x = double(s.local-first.local)/nsecsPerSec;
+        const double y = double(s.offset-first.offset);
+        sumX += x;
+        sumY += y;
+        sumXX += x*x;
+        sumXY += x*y;
+    }
+    const double denominator = n*sumXX - sumX*sumX;
+    if (denominator <= 0.0) {
+        return;
+    }
+    const double slope = (n*sumXY - sumX*sumY)/denominator;   // ns per s
+    m_drift = qBound(-maxDrift, slope/nsecsPerSec, maxDrift);
+}
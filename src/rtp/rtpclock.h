@@ -0,0 +1,71 @@
+#ifndef RTPCLOCK_H
+#define RTPCLOCK_H
+
+#include <QList>
+#include <QMutex>
+
+// Estimates offset and drift of the sender's clock from NTP-style timing exchanges.
+//
+// Of the last few exchanges, the one with the smallest round trip time is the least
+// disturbed by queueing, so its offset is taken as estimate. Drift is fitted over a
+// history of these estimates. Sync packets tie RTP timestamps to the sender's clock,
+// so play-out can be scheduled in local time. Updated by receiver thread, read from any thread.
+class RtpClock
+{
+public:
+    RtpClock();
+
+    // local monotonic time in nanoseconds
+    static qint64 now();
+    // local minus realtime clock in nanoseconds, to convert kernel timestamps (e.g. SO_TIMESTAMPNS)
+    static qint64 realtimeOffset();
+    // NTP timestamps (32.32 fixed point seconds) from and to nanoseconds
+    static qint64 fromNtp(quint64 ntp);
+    static quint64 toNtp(qint64 nsecs);
+
+    // Add a timing exchange, all in nanoseconds. We sent request at localSend, sender
+    // received it at remoteReceive and responded at remoteSend, we received it at localReceive.
+    void addSample(qint64 localSend, qint64 remoteReceive, qint64 remoteSend, qint64 localReceive);
+    // Forget all samples, e.g. on new session
+    void reset();
+
+    bool isValid() const;
+    // remote minus local time at local time
+    qint64 offset(qint64 local) const;
+    // remote clock rate relative to local, e.g. 1e-5 if it runs 10 ppm fast
+    double drift() const;
+    // round trip time of the exchange the estimate is based on
+    qint64 rtt() const;
+
+    qint64 toLocal(qint64 remote) const;
+    qint64 toRemote(qint64 local) const;
+
+    // Sync packet: frame rtpTimestamp is to be presented at ntpTime of the sender
+    void setSync(quint32 rtpTimestamp, quint64 ntpTime);
+    // Local time to present frame rtpTimestamp, false if there is no sync or estimate yet
+    bool presentationTime(quint32 rtpTimestamp, qint64 *local) const;
+    // presentation times are available
+    bool isSynced() const;
+
+private:
+    struct Sample {
+        qint64  local;      // local time in the middle of the exchange
+        qint64  offset;
+        qint64  rtt;
+    };
+    qint64 toLocalLocked(qint64 remote) const;
+    void updateDrift();
+
+    mutable QMutex  m_mutex;
+    QList<Sample>   m_samples;  // last exchanges
+    QList<Sample>   m_history;  // selected estimates, for drift
+    Sample          m_estimate;
+    bool            m_valid;
+    double          m_drift;
+
+    bool            m_syncValid;
+    quint32         m_syncTimestamp;
+    qint64          m_syncTime;     // remote
+};
+
+#endif // RTPCLOCK_H
@@ -0,0 +1,200 @@
+#include "rtpconcealer.h"
+
+#include <airtunes/airtunesconstants.h>
+
+#include <math.h>
+#include <string.h>
+
+// Played frames we keep to look for a period, must be at least twice the max period
+static const int historyFrames = 2048;
+// Cross-fade at period boundaries and into next received packet
+static const int fadeFrames = 64;
+// Pitch search: 55 Hz - 1.1 kHz at 44.1 kHz, compared over correlationFrames
+static const int minPeriod = 40;
+static const int maxPeriod = 800;
+static const int correlationFrames = 128;
+// Below this normalized correlation the signal is not periodic, we repeat a whole packet then
+static const float minCorrelation = 0.5f;
+
+static inline qint16 clip(float value)
+{
+    if (value > 32767.0f) return 32767;
+    if (value < -32768.0f) return -32768;
+    return static_cast<qint16>(value);
+}
+
+RtpConcealer::RtpConcealer(Mode mode) :
+    m_mode(mode),
+    m_packetFrames(0),
+    m_history(new qint16[historyFrames*airtunes::channels]),
+    m_historyFrames(0),
+    m_tail(new qint16[fadeFrames*airtunes::channels]),
+    m_period(0),
+    m_phase(0),
+    m_lost(0)
+{
+    reset();
+}
+
+RtpConcealer::~RtpConcealer()
+{
+    delete[] m_history;
+    delete[] m_tail;
+}
+
+void RtpConcealer::process(char *data, int frames)
+{
+    qint16 *samples = reinterpret_cast<qint16*>(data);
+
+    // Fade from concealment into received packet
+    if (m_lost > 0) {
+        const int n = qMin(frames, fadeFrames);
+        for (int i = 0; i < n; ++i) {
+            const float w = float(i+1)/(n+1);
+            for (uint c = 0; c < airtunes::channels; ++c) {
+                const int j = i*airtunes::channels+c;
+                samples[j] = clip((1.0f-w)*m_tail[j] + w*samples[j]);
+            }
+        }
+        m_lost = 0;
+    }
+
+    m_packetFrames = frames;
+    appendHistory(samples, frames);
+}
+
+void RtpConcealer::conceal(char *data, int frames)
+{
+    qint16 *samples = reinterpret_cast<qint16*>(data);
+
+    // New gap, look for period to repeat
+    if (m_lost == 0) {
+        m_period = (m_mode == Silence) ? 0 : findPeriod();
+        m_phase = 0;
+    }
+
+    // First packet at full level, second one fades out, silence afterwards
+    const float gainBegin = (m_lost < 2) ? 1.0f : 0.0f;
+    const float gainEnd = (m_lost < 1) ? 1.0f : 0.0f;
+
+    if (m_period == 0 || gainBegin == 0.0f) {
+        memset(samples, 0, frames*airtunes::channels*sizeof(qint16));
+        memset(m_tail, 0, fadeFrames*airtunes::channels*sizeof(qint16));
+    } else {
+        synthesize(samples, frames, gainBegin, gainEnd);
+        // Continuation for fading into next packet, does not advance phase
+        const int phase = m_phase;
+        synthesize(m_tail, fadeFrames, gainEnd, gainEnd);
+        m_phase = phase;
+    }
+
+    ++m_lost;
+}
+
+void RtpConcealer::reset()
+{
+    memset(m_history, 0, historyFrames*airtunes::channels*sizeof(qint16));
+    memset(m_tail, 0, fadeFrames*airtunes::channels*sizeof(qint16));
+    m_historyFrames = 0;
+    m_packetFrames = 0;
+    m_period = 0;
+    m_phase = 0;
+    m_lost = 0;
+}
+
+int RtpConcealer::findPeriod() const
+{
+    // Repeat whole packet, if signal is not periodic or for Repeat mode
+    const int packetPeriod = (m_packetFrames && (2*m_packetFrames <= m_historyFrames)) ? m_packetFrames : 0;
+    const int maxLag = qMin(qMin(maxPeriod, m_historyFrames/2), m_historyFrames-correlationFrames);
+    if (m_mode == Repeat || maxLag < minPeriod) {
+        return packetPeriod;
+    }
+
+    // Mono downmix of the frames we need
+    const int count = correlationFrames+maxLag;
+    float mono[historyFrames];
+    const qint16 *in = m_history+(historyFrames-count)*airtunes::channels;
+    for (int i = 0; i < count; ++i) {
+        float sum = 0.0f;
+        for (uint c = 0; c < airtunes::channels; ++c) {
+            sum += in[i*airtunes::channels+c];
+        }
+        mono[i] = sum;
+    }
+
+    // Normalized cross-correlation of the last correlationFrames with the frames one lag before
+    const float *x = mono+count-correlationFrames;
+    float energy = 0.0f;
+    float lagEnergy = 0.0f;
+    for (int i = 0; i < correlationFrames; ++i) {
+        energy += x[i]*x[i];
+        lagEnergy += x[i-minPeriod]*x[i-minPeriod];
+    }
+    if (energy == 0.0f) {
+        return packetPeriod;
+    }
+
+    int bestLag = 0;
+    float bestCorrelation = minCorrelation;
+    for (int lag = minPeriod; lag <= maxLag; ++lag) {
+        float correlation = 0.0f;
+        for (int i = 0; i < correlationFrames; ++i) {
+            correlation += x[i]*x[i-lag];
+        }
+        if (correlation > 0.0f && lagEnergy > 0.0f) {
+            correlation /= sqrtf(energy*lagEnergy);
+            if (correlation > bestCorrelation) {
+                bestCorrelation = correlation;
+                bestLag = lag;
+            }
+        }
+        // Slide energy window by one frame
+        if (lag < maxLag) {
+            lagEnergy += x[-lag-1]*x[-lag-1] - x[correlationFrames-lag-1]*x[correlationFrames-lag-1];
+        }
+    }
+
+    return bestLag ? bestLag : packetPeriod;
+}
+
+void RtpConcealer::synthesize(qint16 *out, int frames, float gainBegin, float gainEnd)
+{
+    // Repeat last period of history. Towards the end of each period we fade into the frames
+    // preceding that period, so the wrap back to its start is continuous.
+    const int P = m_period;
+    const qint16 *period = m_history+(historyFrames-P)*airtunes::channels;
+    const qint16 *previous = m_history+(historyFrames-2*P)*airtunes::channels;
+    const int fade = qMin(fadeFrames, P);
+
+    for (int i = 0; i < frames; ++i) {
+        const float gain = gainBegin + ((gainEnd-gainBegin)*i)/frames;
+        const int p = m_phase;
+        for (uint c = 0; c < airtunes::channels; ++c) {
+            const int j = p*airtunes::channels+c;
+            float value = period[j];
+            if (p >= P-fade) {
+                const float w = float(P-p)/fade;
+                value = w*period[j] + (1.0f-w)*previous[j];
+            }
+            out[i*airtunes::channels+c] = clip(gain*value);
+        }
+        if (++m_phase == P) {
+            m_phase = 0;
+        }
+    }
+}
+
+void RtpConcealer::appendHistory(const qint16 *data, int frames)
+{
+    if (frames >= historyFrames) {
+        memcpy(m_history, data+(frames-historyFrames)*airtunes::channels, historyFrames*airtunes::channels*sizeof(qint16));
+        m_historyFrames = historyFrames;
+        return;
+    }
+
+    const int keep = historyFrames-frames;
+    memmove(m_history, m_history+frames*airtunes::channels, keep*airtunes::channels*sizeof(qint16));
+    memcpy(m_history+keep*airtunes::channels, data, frames*airtunes::channels*sizeof(qint16));
+    m_historyFrames = qMin(m_historyFrames+frames, historyFrames);
+}
@@ -0,0 +1,47 @@
+#ifndef RTPCONCEALER_H
+#define RTPCONCEALER_H
+
+#include <QtGlobal>
+
+// Packet loss concealment for interleaved 16 bit stereo packets. Runs in consumer thread.
+//
+// Missing packets are synthesized by repeating the last pitch period (or the last
+// packet) of the played waveform. Period boundaries, as well as the transition into
+// the next received packet, are cross-faded. Consecutive losses fade to silence.
+class RtpConcealer
+{
+public:
+    enum Mode {
+        Silence,        // fill missing packets with silence
+        Repeat,         // repeat last packet
+        PitchRepeat     // repeat last pitch period (pitch-synchronous overlap-add)
+    };
+
+    explicit RtpConcealer(Mode mode = PitchRepeat);
+    ~RtpConcealer();
+
+    // Feed a received packet. Fades in from a previous concealment.
+    void process(char *data, int frames);
+    // Synthesize a missing packet
+    void conceal(char *data, int frames);
+    // Forget history, e.g. on new stream
+    void reset();
+
+private:
+    int findPeriod() const;
+    void synthesize(qint16 *out, int frames, float gainBegin, float gainEnd);
+    void appendHistory(const qint16 *data, int frames);
+
+    const Mode  m_mode;
+    int         m_packetFrames;     // size of last received packet
+
+    qint16  *m_history;         // last historyFrames played frames
+    int     m_historyFrames;    // valid frames in history (at end of buffer)
+    qint16  *m_tail;            // continuation of last concealment, faded into next packet
+
+    int     m_period;           // period of current concealment
+    int     m_phase;            // position within period
+    uint    m_lost;             // consecutive concealed packets
+};
+
+#endif // RTPCONCEALER_H
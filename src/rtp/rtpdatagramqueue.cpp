@@ -0,0 +1,123 @@
+#include "rtpdatagramqueue.h"
+
+#include <util.h>
+
+#include <limits.h>
+#include <string.h>
+
+RtpDatagramQueue::RtpDatagramQueue(int capacity) :
+    m_capacity(Util::roundToPowerOfTwo(qMax(capacity, 2))),
+    m_data(new char[m_capacity*datagramSize]),
+    m_sizes(new int[m_capacity]),
+    m_arrivals(new qint64[m_capacity]),
+    m_begin(0),
+    m_end(0),
+    m_maxSize(0),
+    m_dropped(0),
+    m_consumerWaiting(false),
+    m_woken(false)
+{
+}
+
+RtpDatagramQueue::~RtpDatagramQueue()
+{
+    delete[] m_data;
+    delete[] m_sizes;
+    delete[] m_arrivals;
+}
+
+bool RtpDatagramQueue::push(const char *data, int size, qint64 arrival)
+{
+    const uint end = m_end.load(std::memory_order_relaxed);
+    const int used = end-m_begin.load(std::memory_order_acquire);
+    if ((used == m_capacity) || (size > datagramSize)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const uint slot = end & (m_capacity-1);
+    memcpy(m_data+slot*datagramSize, data, size);
+    m_sizes[slot] = size;
+    m_arrivals[slot] = arrival;
+    m_end.store(end+1, std::memory_order_release);
+    if (used+1 > m_maxSize.load(std::memory_order_relaxed)) {
+        m_maxSize.store(used+1, std::memory_order_relaxed);
+    }
+
+    // Pairs with fence in wait: either we see the waiting consumer or it sees our datagram.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_consumerWaiting.load(std::memory_order_relaxed)) {
+        wake();
+    }
+    return true;
+}
+
+int RtpDatagramQueue::front(Datagram *datagrams, int count)
+{
+    const uint begin = m_begin.load(std::memory_order_relaxed);
+    const int available = qMin(int(m_end.load(std::memory_order_acquire)-begin), count);
+    for (int i = 0; i < available; ++i) {
+        const uint slot = (begin+i) & (m_capacity-1);
+        datagrams[i].data = m_data+slot*datagramSize;
+        datagrams[i].size = m_sizes[slot];
+        datagrams[i].arrival = m_arrivals[slot];
+    }
+    return available;
+}
+
+void RtpDatagramQueue::pop(int count)
+{
+    m_begin.store(m_begin.load(std::memory_order_relaxed)+count, std::memory_order_release);
+}
+
+bool RtpDatagramQueue::wait(int timeout)
+{
+    m_waitMutex.lock();
+    m_consumerWaiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool woken = m_woken || (m_begin.load(std::memory_order_relaxed) != m_end.load(std::memory_order_relaxed));
+    if (!woken) {
+        woken = m_waitCondition.wait(&m_waitMutex, (timeout < 0) ? ULONG_MAX : timeout);
+    }
+    m_woken = false;
+    m_consumerWaiting.store(false, std::memory_order_relaxed);
+    m_waitMutex.unlock();
+
+    return woken;
+}
+
+void RtpDatagramQueue::wake()
+{
+    m_waitMutex.lock();
+    m_woken = true;
+    m_waitCondition.wakeAll();
+    m_waitMutex.unlock();
+}
+
+int RtpDatagramQueue::size() const
+{
+    // Begin first, end never falls behind it
+    const uint begin = m_begin.load(std::memory_order_acquire);
+    return m_end.load(std::memory_order_acquire)-begin;
+}
+
+int RtpDatagramQueue::capacity() const
+{
+    return m_capacity;
+}
+
+int RtpDatagramQueue::maxSize() const
+{
+    return m_maxSize.load(std::memory_order_relaxed);
+}
+
+uint RtpDatagramQueue::dropped() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+void RtpDatagramQueue::resetStat()
+{
+    m_maxSize.store(size(), std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+#ifndef RTPDATAGRAMQUEUE_H
+#define RTPDATAGRAMQUEUE_H
+
+#include <atomic>
+#include <QMutex>
+#include <QWaitCondition>
+
+// Lock-free single-producer/single-consumer queue of raw datagrams. Hands received
+// audio from the socket thread to the decode stage, so receiving never waits for decoding.
+// Slots are preallocated. Producer only locks the mutex if the consumer waits.
+class RtpDatagramQueue
+{
+public:
+    enum { datagramSize = 1536 };
+
+    struct Datagram {
+        char    *data;
+        int     size;
+        qint64  arrival;    // receive time in nanoseconds (RtpClock::now() time base)
+    };
+
+    // capacity in datagrams, rounded up to a power of two
+    explicit RtpDatagramQueue(int capacity);
+    ~RtpDatagramQueue();
+
+    // producer thread, copies datagram. Returns false if queue is full.
+    bool push(const char *data, int size, qint64 arrival);
+
+    // consumer thread, up to count oldest datagrams. They stay valid until pop().
+    int front(Datagram *datagrams, int count);
+    void pop(int count);
+    // consumer thread, wait for datagrams. timeout in milliseconds, -1 waits until woken.
+    // Returns false on timeout.
+    bool wait(int timeout);
+
+    // any thread, wakes waiting consumer (e.g. to stop it)
+    void wake();
+
+    // Instrumentation, any thread
+    int size() const;
+    int capacity() const;
+    int maxSize() const;        // highest size since last reset
+    uint dropped() const;       // datagrams pushed while queue was full
+    void resetStat();
+
+private:
+    int         m_capacity;
+    char        *m_data;
+    int         *m_sizes;
+    qint64      *m_arrivals;
+
+    // m_begin is owned by consumer, m_end by producer. Keep them on separate cache lines.
+    alignas(64) std::atomic<uint>   m_begin;
+    alignas(64) std::atomic<uint>   m_end;
+
+    std::atomic<int>    m_maxSize;
+    std::atomic<uint>   m_dropped;
+
+    std::atomic<bool>   m_consumerWaiting;
+    bool                m_woken;
+    QMutex              m_waitMutex;
+    QWaitCondition      m_waitCondition;
+};
+
+#endif // RTPDATAGRAMQUEUE_H
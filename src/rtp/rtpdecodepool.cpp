@@ -0,0 +1,110 @@
+#include "rtpdecodepool.h"
+
+#include "rtpdecoder.h"
+
+#include <QDebug>
+
+RtpDecodePool::RtpDecodePool(const RtspMessage::Announcement &announcement, RtpDecoder *decoder, int threads) :
+    m_decoder(decoder),
+    m_jobs(NULL),
+    m_count(0),
+    m_next(0),
+    m_generation(0),
+    m_active(0),
+    m_stop(false)
+{
+    for (int i = 0; i < threads; ++i) {
+        Worker *worker = new Worker(this, announcement);
+        m_workers.append(worker);
+        worker->start();
+    }
+    qDebug()<<Q_FUNC_INFO<<"threads:"<<threads;
+}
+
+RtpDecodePool::~RtpDecodePool()
+{
+    m_mutex.lock();
+    m_stop = true;
+    m_started.wakeAll();
+    m_mutex.unlock();
+
+    for (Worker *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+int RtpDecodePool::threads() const
+{
+    return m_workers.size();
+}
+
+void RtpDecodePool::decode(Job *jobs, int count)
+{
+    // Workers that woke too late for the last burst must leave first
+    m_mutex.lock();
+    while (m_active) {
+        m_finished.wait(&m_mutex);
+    }
+    m_jobs = jobs;
+    m_count = count;
+    m_next.store(0, std::memory_order_relaxed);
+    ++m_generation;
+    m_started.wakeAll();
+    m_mutex.unlock();
+
+    work(m_decoder);
+
+    // All jobs are claimed, wait for the ones still running
+    m_mutex.lock();
+    while (m_active) {
+        m_finished.wait(&m_mutex);
+    }
+    m_mutex.unlock();
+}
+
+void RtpDecodePool::work(RtpDecoder *decoder)
+{
+    int i;
+    while ((i = m_next.fetch_add(1, std::memory_order_relaxed)) < m_count) {
+        Job &job = m_jobs[i];
+        job.outSize = decoder->decode(job.payload, job.size, job.out);
+    }
+}
+
+RtpDecodePool::Worker::Worker(RtpDecodePool *pool, const RtspMessage::Announcement &announcement) :
+    m_pool(pool),
+    m_decoder(new RtpDecoder(announcement))
+{
+}
+
+RtpDecodePool::Worker::~Worker()
+{
+    delete m_decoder;
+}
+
+void RtpDecodePool::Worker::run()
+{
+    quint32 generation = 0;
+    while (true) {
+        m_pool->m_mutex.lock();
+        while (!m_pool->m_stop && (m_pool->m_generation == generation)) {
+            m_pool->m_started.wait(&m_pool->m_mutex);
+        }
+        if (m_pool->m_stop) {
+            m_pool->m_mutex.unlock();
+            break;
+        }
+        generation = m_pool->m_generation;
+        ++m_pool->m_active;
+        m_pool->m_mutex.unlock();
+
+        m_pool->work(m_decoder);
+
+        m_pool->m_mutex.lock();
+        if (--m_pool->m_active == 0) {
+            m_pool->m_finished.wakeAll();
+        }
+        m_pool->m_mutex.unlock();
+    }
+}
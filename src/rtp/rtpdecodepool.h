@@ -0,0 +1,69 @@
+#ifndef RTPDECODEPOOL_H
+#define RTPDECODEPOOL_H
+
+#include "rtsp/rtspmessage.h"
+
+#include <atomic>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+class RtpDecoder;
+
+// Decrypts and decodes bursts of packets in parallel. ALAC packets are independent,
+// so each worker has its own decoder (ALAC state and cipher) and jobs finish in any order.
+// Jobs are claimed one by one, so idle workers take over from busy ones.
+class RtpDecodePool
+{
+public:
+    struct Job {
+        char    *payload;   // encrypted, decrypted in place
+        int     size;
+        char    *out;       // room for a whole decoded packet
+        int     outSize;    // result, bytes of decoded audio
+    };
+
+    // decoder: used by the calling thread, which works along. threads: additional workers.
+    RtpDecodePool(const RtspMessage::Announcement &announcement, RtpDecoder *decoder, int threads);
+    ~RtpDecodePool();
+
+    int threads() const;
+
+    // one thread at a time, returns when all jobs are done
+    void decode(Job *jobs, int count);
+
+private:
+    class Worker : public QThread
+    {
+    public:
+        Worker(RtpDecodePool *pool, const RtspMessage::Announcement &announcement);
+        ~Worker();
+
+    private:
+        void run() Q_DECL_OVERRIDE;
+
+        RtpDecodePool   *m_pool;
+        RtpDecoder      *m_decoder;
+    };
+
+    // claims and runs jobs until there are none left
+    void work(RtpDecoder *decoder);
+
+    RtpDecoder      *m_decoder;
+    QList<Worker*>  m_workers;
+
+    // Current burst, changes only while no worker is active
+    Job             *m_jobs;
+    int             m_count;
+    std::atomic<int>    m_next;
+
+    QMutex          m_mutex;
+    QWaitCondition  m_started;      // new burst or stop
+    QWaitCondition  m_finished;     // last active worker is done
+    quint32         m_generation;   // incremented per burst
+    int             m_active;       // workers inside work()
+    bool            m_stop;
+};
+
+#endif // RTPDECODEPOOL_H
@@ -0,0 +1,95 @@
+#include "rtpdecoder.h"
+
+#include <QDebug>
+
+#include <string.h>
+
+RtpDecoder::RtpDecoder(const RtspMessage::Announcement &announcement, SampleFormat format) :
+    m_format(format),
+    m_alac(NULL),
+    m_decodeFrame(NULL),
+    m_cipher(EVP_CIPHER_CTX_new())
+{
+    initAlac(announcement.fmtp);
+
+    memset(m_aesIv, 0, sizeof(m_aesIv));
+    memcpy(m_aesIv, announcement.aesIv.constData(), qMin(announcement.aesIv.size(), int(sizeof(m_aesIv))));
+    EVP_DecryptInit_ex(m_cipher, EVP_aes_128_cbc(), NULL, reinterpret_cast<const unsigned char*>(announcement.rsaAesKey.constData()), m_aesIv);
+    EVP_CIPHER_CTX_set_padding(m_cipher, 0);
+}
+
+RtpDecoder::~RtpDecoder()
+{
+    if (m_alac) {
+        alac_free(m_alac);
+        m_alac = NULL;
+    }
+    EVP_CIPHER_CTX_free(m_cipher);
+}
+
+uint RtpDecoder::framesPerPacket() const
+{
+    return m_alac->setinfo_max_samples_per_frame;
+}
+
+RtpDecoder::SampleFormat RtpDecoder::sampleFormat() const
+{
+    return m_format;
+}
+
+int RtpDecoder::bytesPerFrame() const
+{
+    return (m_format == PlanarFloat) ? 2*sizeof(float) : 2*sizeof(qint16);
+}
+
+int RtpDecoder::decode(char *payload, int size, char *out, bool decrypted)
+{
+    if (!decrypted) {
+        decrypt(payload, size);
+    }
+
+    int outSize = 0;
+    m_decodeFrame(m_alac, reinterpret_cast<unsigned char*>(payload), size, out, &outSize);
+    return outSize;
+}
+
+void RtpDecoder::decrypt(char *payload, int size)
+{
+    // Each packet starts with the same IV, key schedule is kept
+    unsigned char *data = reinterpret_cast<unsigned char*>(payload);
+    int length = 0;
+    EVP_DecryptInit_ex(m_cipher, NULL, NULL, NULL, m_aesIv);
+    EVP_DecryptUpdate(m_cipher, data, &length, data, size & ~0xf);
+}
+
+void RtpDecoder::decrypt(char *const *payloads, const int *sizes, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        decrypt(payloads[i], sizes[i]);
+    }
+}
+
+void RtpDecoder::initAlac(const QByteArray &fmtp)
+{
+    QList<QByteArray> fmtpList = fmtp.split(' ');
+
+    m_alac = alac_create(16, 2);
+    m_alac->setinfo_max_samples_per_frame   = fmtpList.at(1).toUInt();
+    m_alac->setinfo_7a                      = fmtpList.at(2).toUInt();
+    m_alac->setinfo_sample_size             = fmtpList.at(3).toUInt();
+    m_alac->setinfo_rice_historymult        = fmtpList.at(4).toUInt();
+    m_alac->setinfo_rice_initialhistory     = fmtpList.at(5).toUInt();
+    m_alac->setinfo_rice_kmodifier          = fmtpList.at(6).toUInt();
+    m_alac->setinfo_7f                      = fmtpList.at(7).toUInt();
+    m_alac->setinfo_80                      = fmtpList.at(8).toUInt();
+    m_alac->setinfo_82                      = fmtpList.at(9).toUInt();
+    m_alac->setinfo_86                      = fmtpList.at(10).toUInt();
+    m_alac->setinfo_8a_rate                 = fmtpList.at(11).toUInt();
+    // Straight from the deinterlace stage, no int16 in between
+    m_alac->output_format = (m_format == PlanarFloat) ? ALAC_OUTPUT_PLANAR_FLOAT : ALAC_OUTPUT_INTERLEAVED;
+    alac_allocate_buffers(m_alac);
+
+    // Stereo 16 bit 352 frames (RAOP) has its own decoder, other streams take the generic one
+    m_decodeFrame = alac_select_decoder(m_alac);
+    qDebug()<<Q_FUNC_INFO<<"specialised decoder:"<<(m_decodeFrame != alac_decode_frame);
+}
@@ -0,0 +1,49 @@
+#ifndef RTPDECODER_H
+#define RTPDECODER_H
+
+#include "alac.h"
+#include "rtsp/rtspmessage.h"
+
+#include <openssl/evp.h>
+
+// Decrypts and decodes the ALAC payloads of an announced stream.
+// Use it from one thread at a time.
+class RtpDecoder
+{
+public:
+    // Layout of decoded audio
+    enum SampleFormat {
+        Interleaved16,  // int16 stereo frames
+        PlanarFloat     // float in [-1, 1), one plane per channel, planes back to back
+    };
+
+    explicit RtpDecoder(const RtspMessage::Announcement &announcement, SampleFormat format = Interleaved16);
+    ~RtpDecoder();
+
+    // max stereo frames per packet (fmtp)
+    uint framesPerPacket() const;
+
+    SampleFormat sampleFormat() const;
+    // size of a decoded stereo frame
+    int bytesPerFrame() const;
+
+    // decrypt payload in place and decode it to out, returns size of decoded audio in bytes.
+    // For PlanarFloat the planes are as long as the packet.
+    int decode(char *payload, int size, char *out, bool decrypted = false);
+
+    // decrypt payload in place (AES-128-CBC, trailing partial block is plain)
+    void decrypt(char *payload, int size);
+    // decrypt a burst of payloads in place
+    void decrypt(char *const *payloads, const int *sizes, int count);
+
+private:
+    void initAlac(const QByteArray &fmtp);
+
+    const SampleFormat  m_format;
+    alac_file   *m_alac;
+    alac_decode_frame_fn    m_decodeFrame;  // specialised for the stream's profile if possible
+    EVP_CIPHER_CTX  *m_cipher;  // key schedule is set up once, hardware AES if available
+    unsigned char   m_aesIv[16];
+};
+
+#endif // RTPDECODER_H
@@ -16,3 +16,26 @@ void readHeader(const char* data, RtpHeader *header)
     header->timestamp       = qFromBigEndian(*((quint32*)(data+4)));
     header->ssrc            = qFromBigEndian(*((quint32*)(data+8)));
 }
+
+int readAudioHeader(const char* data, int size, RtpHeader *header)
+{
+    if (size < 12) {
+        return 0;
+    }
+    readHeader(data, header);
+
+    switch (header->payloadType) {
+    case airtunes::AudioData:
+        return 12;
+    case airtunes::RetransmitResponse:
+        if (size < 16) {
+            return 0;
+        }
+        // Original header starts at 4, its ssrc is not part of it
+        header->sequenceNumber  = qFromBigEndian(*((quint16*)(data+6)));
+        header->timestamp       = qFromBigEndian(*((quint32*)(data+8)));
+        return 16;
+    default:
+        return 0;
+    }
+}
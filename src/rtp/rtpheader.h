@@ -18,5 +18,8 @@ struct RtpHeader {
 };
 
 void readHeader(const char* data, RtpHeader *header);
+// Header of AudioData or RetransmitResponse, the latter carries the original header behind its own.
+// Returns offset of the audio payload, 0 if datagram has none.
+int readAudioHeader(const char* data, int size, RtpHeader *header);
 
 #endif // RTPHEADER_H
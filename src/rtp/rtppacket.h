@@ -2,32 +2,44 @@
 #define RTPPACKET_H
 
 
+#include <atomic>
 #include <QtGlobal>
 
 
+// Packet metadata. The payload lives in a separate slab owned by RtpBuffer,
+// see RtpBuffer::payload().
 struct RtpPacket {
     RtpPacket() :
         sequenceNumber(0),
-        status(PacketFree),
+        timestamp(0),
         flush(false),
+        status(PacketFree),
         payloadSize(0),
-        payload(NULL)
+        offset(0),
+        arrival(0),
+        committed(0)
     {}
     void init() {
         //sequenceNumber = 0;
-        status = PacketFree;
+        status.store(PacketFree, std::memory_order_release);
         flush = false;
     }
 
-    quint16         sequenceNumber;
     enum Status {
         PacketFree,
         PacketOk,
-        PacketMissing
-    }               status;
+        PacketMissing,
+        PacketBusy      // slot is being written (by producer) or concealed (by consumer)
+    };
+
+    quint16         sequenceNumber;
+    quint32         timestamp;
     bool            flush;
+    std::atomic<Status> status;
     int             payloadSize;
-    char            *payload;
+    quint64         offset;     // arena offset of payload (lazy decode)
+    qint64          arrival;    // receive time in nanoseconds (RtpClock::now() time base), from kernel if available
+    qint64          committed;  // time producer committed packet, arrival to committed is our receive and decode time
 };
     
-#endif // RTPPACKET_H    
+#endif // RTPPACKET_H
@@ -1,32 +1,109 @@
 #include "rtpreceiver.h"
 
 #include "rtpbuffer.h"
+#include "rtpcapture.h"
+#include "rtpclock.h"
+#include "rtpdecodepool.h"
+#include "rtpdecoder.h"
 #include "rtpheader.h"
 #include "rtppacket.h"
-#include "alac.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
+#include <errno.h>
+#include <string.h>
 #include <QElapsedTimer>
 #include <QtEndian>
 
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#endif
+
 using boost::asio::ip::udp;
 namespace ph = boost::asio::placeholders;
 
-RtpReceiver::RtpReceiver(RtpBuffer *rtpBuffer, quint16 retryInterval, QObject *parent) :
+// Offset of audio payload in datagram, 0 if there is none
+static int audioOffset(const char *data, std::size_t size)
+{
+    RtpHeader header;
+    return readAudioHeader(data, size, &header);
+}
+
+// Sequence number of audio datagram
+static quint16 sequenceNumber(const char *data, int size)
+{
+    RtpHeader header = RtpHeader();
+    readAudioHeader(data, size, &header);
+    return header.sequenceNumber;
+}
+
+// Give reordered packets a moment before requesting them
+static const int reorderHold = 5;
+// Decode stage decrypts this many queued datagrams at once
+static const int decodeBatch = 32;
+// Batches of at least this many datagrams are decoded in parallel, for fewer waking the pool costs more
+static const int parallelDecodeBatch = 4;
+// Decode queue statistics are logged every so many datagrams
+static const uint statInterval = 1000;
+// First timing exchanges go out quickly for an initial estimate, later ones every few seconds
+static const uint initialTimingRequests = 4;
+static const int initialTimingInterval = 200;
+static const int timingInterval = 3000;
+
+RtpReceiver::RtpReceiver(RtpBuffer *rtpBuffer, RtpClock *rtpClock, quint16 retryInterval, bool lazyDecode, QObject *parent) :
     QObject(parent),
     m_senderControlPort(0),
+    m_senderTimingPort(0),
     m_rtpBuffer(rtpBuffer),
+    m_rtpClock(rtpClock),
     m_retryInterval(retryInterval),
+    m_lazyDecode(lazyDecode),
+    m_rtpCapture(NULL),
+    m_decodeThreads(0),
     m_udpWorker(NULL)
 {
 }
 
+RtpReceiver::~RtpReceiver()
+{
+    teardown();
+    delete m_rtpCapture;
+}
+
+void RtpReceiver::setCaptureFile(const QString &fileName)
+{
+    m_captureFile = fileName;
+}
+
+void RtpReceiver::setSocketBackend(const QString &name)
+{
+    m_socketBackend = name;
+}
+
+void RtpReceiver::setDecodeThreads(int threads)
+{
+    m_decodeThreads = threads;
+}
+
 void RtpReceiver::announce(const RtspMessage::Announcement &announcement)
 {
     teardown();
 
     m_announcement = announcement;
+    m_rtpClock->reset();
+
+    if (!m_captureFile.isEmpty() && !m_rtpCapture) {
+        m_rtpCapture = new RtpCapture(m_captureFile);
+        if (!m_rtpCapture->openWrite()) {
+            delete m_rtpCapture;
+            m_rtpCapture = NULL;
+            m_captureFile.clear();
+        }
+    }
+    if (m_rtpCapture) {
+        m_rtpCapture->writeAnnouncement(m_announcement);
+    }
 }
 
 void RtpReceiver::setSenderSocket(airtunes::PayloadType payloadType, quint16 controlPort)
@@ -35,6 +112,9 @@ void RtpReceiver::setSenderSocket(airtunes::PayloadType payloadType, quint16 con
     case airtunes::RetransmitRequest:
         m_senderControlPort = controlPort;
         break;
+    case airtunes::TimingRequest:
+        m_senderTimingPort = controlPort;
+        break;
     default:
         break;
     }
@@ -42,14 +122,12 @@ void RtpReceiver::setSenderSocket(airtunes::PayloadType payloadType, quint16 con
 
 void RtpReceiver::bindSocket(airtunes::PayloadType payloadType, quint16 *port)
 {
-    Q_UNUSED(payloadType);
-
     if (!m_udpWorker) {
-        m_udpWorker = new UdpWorker(m_announcement, m_rtpBuffer, m_senderControlPort, m_retryInterval);
+        m_udpWorker = new UdpWorker(m_announcement, m_rtpBuffer, m_rtpClock, m_rtpCapture, m_socketBackend, m_senderControlPort, m_senderTimingPort, m_retryInterval, m_lazyDecode, m_decodeThreads);
     }
 
     m_udpWorker->start();
-    *port = m_udpWorker->port();
+    *port = m_udpWorker->port(payloadType);
 }
 
 void RtpReceiver::teardown()
@@ -60,45 +138,124 @@ void RtpReceiver::teardown()
         delete m_udpWorker;
         m_udpWorker = NULL;
     }
+
+    if (m_rtpCapture) {
+        m_rtpCapture->flush();
+    }
 }
 
-RtpReceiver::UdpWorker::UdpWorker(const RtspMessage::Announcement &announcement, RtpBuffer *rtpBuffer, quint16 senderControlPort, quint16 retryInterval) :
+RtpReceiver::UdpWorker::UdpWorker(const RtspMessage::Announcement &announcement, RtpBuffer *rtpBuffer, RtpClock *rtpClock, RtpCapture *rtpCapture, const QString &socketBackend, quint16 senderControlPort, quint16 senderTimingPort, quint16 retryInterval, bool lazyDecode, int decodeThreads) :
+    m_work(NULL),
     m_announcement(announcement),
-    m_alac(NULL),
+    m_decoder(new RtpDecoder(announcement)),
+    m_decodePool(NULL),
     m_rtpBuffer(rtpBuffer),
+    m_rtpCapture(rtpCapture),
+    m_queue(NULL),
+    m_decodeWorker(NULL),
     m_senderControlPort(senderControlPort),
-    m_retryInterval(retryInterval),
-    m_retryTimer(m_ioService, boost::posix_time::milliseconds(m_retryInterval))
+    m_rtpClock(rtpClock),
+    m_timingTimer(m_ioService),
+    m_timingRequests(0)
 {
     m_socket = new udp::socket(m_ioService, udp::endpoint(udp::v4(), 0));
-    initAlac(m_announcement.fmtp);
-    AES_set_decrypt_key(reinterpret_cast<const unsigned char*>(m_announcement.rsaAesKey.data()), 128, &m_aesKey);
+    m_controlSocket = new udp::socket(m_ioService, udp::endpoint(udp::v4(), 0));
+    m_timingSocket = new udp::socket(m_ioService, udp::endpoint(udp::v4(), 0));
+    m_socketBackend = RtpSocketBackend::create(socketBackend, m_ioService, this);
+    qDebug()<<Q_FUNC_INFO<<"socket backend:"<<m_socketBackend->name();
+
+    // Size buffer slots for the biggest packet the sender announced
+    const uint framesPerPacket = m_decoder->framesPerPacket();
+    m_rtpBuffer->setFramesPerPacket(framesPerPacket);
+    if (lazyDecode) {
+        m_rtpBuffer->setDecoder(m_decoder);
+        m_decoder = NULL;
+    } else {
+        m_rtpBuffer->setDecoder(NULL);
+    }
 
-    m_retryEndpoint = udp::endpoint(boost::asio::ip::address::from_string(m_announcement.senderAddress.toString().toStdString()), m_senderControlPort);
+    const boost::asio::ip::address senderAddress = boost::asio::ip::address::from_string(m_announcement.senderAddress.toString().toStdString());
+    m_retryEndpoint = udp::endpoint(senderAddress, m_senderControlPort);
+    m_timingEndpoint = udp::endpoint(senderAddress, senderTimingPort);
+
+    // Kernel queue should hold a whole latency of packets, e.g. the burst after a WiFi stall.
+    // Target latency adapts during the session, so size for the max one.
+    const int packets = (m_rtpBuffer->maxLatency()*airtunes::sampleRate)/(1000*framesPerPacket);
+    udp::socket::receive_buffer_size receiveBufferSize;
+    boost::system::error_code error;
+    m_socket->get_option(receiveBufferSize, error);
+    if (!error && (receiveBufferSize.value() < packets*1536)) {
+        m_socket->set_option(udp::socket::receive_buffer_size(packets*1536), error);
+        qDebug()<<Q_FUNC_INFO<<"receive buffer size:"<<packets*1536<<(error ? "failed" : "");
+    }
+
+    // Decode queue holds as much, so a stalled decoder does not lose the burst either
+    m_queue = new RtpDatagramQueue(packets);
+    // Bursts after a stall or at stream start are decoded in parallel
+    if (m_decoder && (decodeThreads > 0)) {
+        m_decodePool = new RtpDecodePool(m_announcement, m_decoder, decodeThreads);
+    }
+    m_decodeWorker = new DecodeWorker(m_queue, m_rtpBuffer, m_decoder, m_decodePool, this, retryInterval);
+
+#ifdef Q_OS_LINUX
+    // Kernel stamps datagrams on arrival, before our own dispatch delay
+    const int on = 1;
+    udp::socket *sockets[] = { m_socket, m_controlSocket, m_timingSocket };
+    for (udp::socket *socket : sockets) {
+        if (::setsockopt(socket->native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+            qWarning()<<Q_FUNC_INFO<<"cannot enable receive timestamps:"<<strerror(errno);
+        }
+    }
+#endif
 }
 
 RtpReceiver::UdpWorker::~UdpWorker()
 {
     stop();
 
+    // Decode stage uses decoder and posts to our sockets
+    m_decodeWorker->wait();
+    delete m_decodeWorker;
+    delete m_decodePool;
+    delete m_queue;
+
+    // Before the sockets it receives from
+    delete m_socketBackend;
+
     if (m_socket) {
         delete m_socket;
     }
+    if (m_controlSocket) {
+        delete m_controlSocket;
+    }
+    if (m_timingSocket) {
+        delete m_timingSocket;
+    }
 
-    if (m_alac) {
-        alac_free(m_alac);
-        m_alac = NULL;
+    if (m_decoder) {
+        delete m_decoder;
+        m_decoder = NULL;
     }
 }
 
-quint16 RtpReceiver::UdpWorker::port()
+quint16 RtpReceiver::UdpWorker::port(airtunes::PayloadType payloadType)
 {
-    return m_socket ? m_socket->local_endpoint().port() : 0;
+    switch (payloadType) {
+    case airtunes::AudioData:
+        return m_socket->local_endpoint().port();
+    case airtunes::RetransmitResponse:
+        return m_controlSocket->local_endpoint().port();
+    case airtunes::TimingResponse:
+        return m_timingSocket->local_endpoint().port();
+    default:
+        return 0;
+    }
 }
 
 void RtpReceiver::UdpWorker::stop()
 {
-    m_retryTimer.cancel();
+    m_decodeWorker->stop();
+    m_timingTimer.cancel();
 
     if (m_work) {
         delete m_work;
@@ -111,92 +268,61 @@ void RtpReceiver::UdpWorker::run()
 {
     m_work = new boost::asio::io_service::work(m_ioService);
 
-    m_retryTimer.async_wait(boost::bind(&UdpWorker::doRequestRetransmit, this));
-    doReceive();
+    m_decodeWorker->start();
+    m_socketBackend->start({ m_socket, m_controlSocket, m_timingSocket });
+    if (m_timingEndpoint.port()) {
+        doRequestTiming(boost::system::error_code());
+    }
     m_ioService.run();
 }
 
-void RtpReceiver::UdpWorker::doReceive()
+void RtpReceiver::UdpWorker::onDatagram(const char *data, std::size_t size, qint64 arrival)
 {
-    m_socket->async_receive_from(boost::asio::buffer(m_receiveBuffer),
-                                 m_remoteEndpoint,
-                                 boost::bind(&RtpReceiver::UdpWorker::onReceive, this, ph::error, ph::bytes_transferred));
-}
-
-void RtpReceiver::UdpWorker::onReceive(const boost::system::error_code& error, std::size_t bytesTransferred)
-{
-    if (error) {
-        qWarning()<<Q_FUNC_INFO<<" error occurred: "<<error;
-    } else {
-        RtpHeader header;
-        readHeader(m_receiveBuffer.data(), &header);
-        const char* payload = (m_receiveBuffer.data()+12);
-        int payloadSize = bytesTransferred-12;
-
-        switch (header.payloadType) {
-        case airtunes::Sync:
-            break;
-        case airtunes::RetransmitResponse: {
-            header.sequenceNumber = qFromBigEndian(*((quint16*)(m_receiveBuffer.data()+6)));
-            payload = payload+4;
-            payloadSize = payloadSize-4;
-            // need to check payloadSize, since we get broken payloads from time to time
-            if (payloadSize < 0) {
-                break;
-            }
-        }
-        case airtunes::AudioData: {
-            RtpPacket* rtpPacket = m_rtpBuffer->obtainPacket(header);
-            if (rtpPacket) {
-                unsigned char packet[2048];
-                decrypt(payload, packet, payloadSize);
-                alac_decode_frame(m_alac, packet, rtpPacket->payload, &(rtpPacket->payloadSize));
-                m_rtpBuffer->commitPacket(rtpPacket);
-            }
-            break;
-        }
-        default:
-            qCritical("RtpReceiver::readPendingDatagrams: illegal payload type: %d", header.payloadType);
-            break;
-        }
+    if (size < 12) {
+        qWarning()<<Q_FUNC_INFO<<"datagram too small:"<<size;
+        return;
     }
 
-    doReceive();
-}
+    if (m_rtpCapture) {
+        m_rtpCapture->writeDatagram(data, size, arrival);
+    }
 
-void RtpReceiver::UdpWorker::initAlac(const QByteArray &fmtp)
-{
-    QList<QByteArray> fmtpList = fmtp.split(' ');
+    RtpHeader header;
+    readHeader(data, &header);
 
-    if (!m_alac) {
-        m_alac = alac_create(16, 2);
-        m_alac->setinfo_max_samples_per_frame   = fmtpList.at(1).toUInt();
-        m_alac->setinfo_7a                      = fmtpList.at(2).toUInt();
-        m_alac->setinfo_sample_size             = fmtpList.at(3).toUInt();
-        m_alac->setinfo_rice_historymult        = fmtpList.at(4).toUInt();
-        m_alac->setinfo_rice_initialhistory     = fmtpList.at(5).toUInt();
-        m_alac->setinfo_rice_kmodifier          = fmtpList.at(6).toUInt();
-        m_alac->setinfo_7f                      = fmtpList.at(7).toUInt();
-        m_alac->setinfo_80                      = fmtpList.at(8).toUInt();
-        m_alac->setinfo_82                      = fmtpList.at(9).toUInt();
-        m_alac->setinfo_86                      = fmtpList.at(10).toUInt();
-        m_alac->setinfo_8a_rate                 = fmtpList.at(11).toUInt();
-        alac_allocate_buffers(m_alac);
+    switch (header.payloadType) {
+    case airtunes::Sync:
+        // Frame of RTP timestamp is presented at NTP time of sender
+        if (size >= 20) {
+            m_rtpClock->setSync(header.timestamp, qFromBigEndian(*((quint64*)(data+8))));
+        }
+        break;
+    case airtunes::TimingRequest:
+        onTimingRequest(data, size, arrival);
+        break;
+    case airtunes::TimingResponse:
+        onTimingResponse(data, size, arrival);
+        break;
+    case airtunes::RetransmitResponse:
+    case airtunes::AudioData:
+        // Decode stage takes it from here
+        if (!m_queue->push(data, size, arrival)) {
+            qWarning()<<Q_FUNC_INFO<<"decode queue full, dropping:"<<header.sequenceNumber;
+        }
+        break;
+    default:
+        qCritical("RtpReceiver::readPendingDatagrams: illegal payload type: %d", header.payloadType);
+        break;
     }
 }
 
-void RtpReceiver::UdpWorker::decrypt(const char *in, unsigned char *out, int length)
+void RtpReceiver::UdpWorker::requestRetransmit(const QList<RtpBuffer::Sequence> &sequences)
 {
-    unsigned char iv[16];
-    int encryptedSize = length & ~0xf;
-    memcpy(iv, m_announcement.aesIv.data(), sizeof(iv));
-    AES_cbc_encrypt(reinterpret_cast<const unsigned char*>(in), out, encryptedSize, &m_aesKey, iv, AES_DECRYPT);
-    memcpy(out+encryptedSize, in+encryptedSize, length-encryptedSize);
+    m_ioService.post(boost::bind(&RtpReceiver::UdpWorker::doRequestRetransmit, this, sequences));
 }
 
-void RtpReceiver::UdpWorker::doRequestRetransmit()
+void RtpReceiver::UdpWorker::doRequestRetransmit(const QList<RtpBuffer::Sequence> &sequences)
 {
-    auto sequences = m_rtpBuffer->missingSequences();
     for (const RtpBuffer::Sequence& sequence : sequences) {
         qDebug()<<Q_FUNC_INFO<<"first:"<<sequence.first<<"count:"<<sequence.count;
 
@@ -208,18 +334,252 @@ void RtpReceiver::UdpWorker::doRequestRetransmit()
         *(unsigned short *)(req+4) = qToBigEndian(sequence.first);  // missed seqnum
         *(unsigned short *)(req+6) = qToBigEndian(sequence.count);  // count
 
-        m_socket->async_send_to(boost::asio::buffer(req, 8),
-                                m_retryEndpoint,
-                                boost::bind(&RtpReceiver::UdpWorker::onRequestRetransmit, this, ph::error, ph::bytes_transferred));
+        // Synchronous, req lives on stack. UDP send does not block.
+        boost::system::error_code error;
+        m_controlSocket->send_to(boost::asio::buffer(req, 8), m_retryEndpoint, 0, error);
+        if (error) {
+            qWarning()<<Q_FUNC_INFO<<"error occurred:"<<error;
+        }
     }
+}
 
-    m_retryTimer.expires_at(m_retryTimer.expires_at() + boost::posix_time::milliseconds(m_retryInterval));
-    m_retryTimer.async_wait(boost::bind(&UdpWorker::doRequestRetransmit, this));
+void RtpReceiver::UdpWorker::doRequestTiming(const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted) {
+        return;
+    }
+
+    // Sender echoes our send time as origin time in its response
+    memset(m_timingRequest, 0, sizeof(m_timingRequest));
+    m_timingRequest[0] = 0x80;
+    m_timingRequest[1] = airtunes::TimingRequest|0x80;
+    *(quint16 *)(m_timingRequest+2) = qToBigEndian(quint16(7));
+    *(quint64 *)(m_timingRequest+24) = qToBigEndian(RtpClock::toNtp(RtpClock::now()));
+
+    m_timingSocket->async_send_to(boost::asio::buffer(m_timingRequest, sizeof(m_timingRequest)),
+                                  m_timingEndpoint,
+                                  boost::bind(&RtpReceiver::UdpWorker::onSendTiming, this, ph::error, ph::bytes_transferred));
+
+    ++m_timingRequests;
+    m_timingTimer.expires_from_now(boost::posix_time::milliseconds((m_timingRequests < initialTimingRequests) ? initialTimingInterval : timingInterval));
+    m_timingTimer.async_wait(boost::bind(&UdpWorker::doRequestTiming, this, ph::error));
 }
 
-void RtpReceiver::UdpWorker::onRequestRetransmit(const boost::system::error_code& error, std::size_t /*bytesTransferred*/)
+void RtpReceiver::UdpWorker::onTimingResponse(const char *data, std::size_t size, qint64 arrival)
+{
+    const qint64 localReceive = arrival;
+    if (size < 32) {
+        qWarning()<<Q_FUNC_INFO<<"timing response too small:"<<size;
+        return;
+    }
+
+    const qint64 localSend = RtpClock::fromNtp(qFromBigEndian(*((quint64*)(data+8))));
+    const qint64 remoteReceive = RtpClock::fromNtp(qFromBigEndian(*((quint64*)(data+16))));
+    const qint64 remoteSend = RtpClock::fromNtp(qFromBigEndian(*((quint64*)(data+24))));
+    m_rtpClock->addSample(localSend, remoteReceive, remoteSend, localReceive);
+}
+
+void RtpReceiver::UdpWorker::onTimingRequest(const char *data, std::size_t size, qint64 arrival)
+{
+    const qint64 localReceive = arrival;
+    if ((size < 32) || !m_timingEndpoint.port()) {
+        return;
+    }
+
+    // Sender asks for our time: origin is its send time, followed by our receive and send time
+    memset(m_timingResponse, 0, sizeof(m_timingResponse));
+    m_timingResponse[0] = 0x80;
+    m_timingResponse[1] = airtunes::TimingResponse|0x80;
+    *(quint16 *)(m_timingResponse+2) = qToBigEndian(quint16(7));
+    memcpy(m_timingResponse+8, data+24, 8);
+    *(quint64 *)(m_timingResponse+16) = qToBigEndian(RtpClock::toNtp(localReceive));
+    *(quint64 *)(m_timingResponse+24) = qToBigEndian(RtpClock::toNtp(RtpClock::now()));
+
+    m_timingSocket->async_send_to(boost::asio::buffer(m_timingResponse, sizeof(m_timingResponse)),
+                                  m_timingEndpoint,
+                                  boost::bind(&RtpReceiver::UdpWorker::onSendTiming, this, ph::error, ph::bytes_transferred));
+}
+
+void RtpReceiver::UdpWorker::onSendTiming(const boost::system::error_code& error, std::size_t /*bytesTransferred*/)
 {
     if (error) {
         qWarning()<<Q_FUNC_INFO<<"error occurred:"<<error;
     }
 }
+
+RtpReceiver::DecodeWorker::DecodeWorker(RtpDatagramQueue *queue, RtpBuffer *rtpBuffer, RtpDecoder *decoder, RtpDecodePool *decodePool, UdpWorker *udpWorker, quint16 retryInterval) :
+    m_queue(queue),
+    m_rtpBuffer(rtpBuffer),
+    m_decoder(decoder),
+    m_decodePool(decodePool),
+    m_decoded(decodePool ? new char[decodeBatch*rtpBuffer->maxPayloadSize()] : NULL),
+    m_udpWorker(udpWorker),
+    m_stop(false),
+    m_retransmitScheduler(rtpBuffer, retryInterval),
+    m_retryDeadline(-1),
+    m_nextSequenceNumber(0),
+    m_processed(0)
+{
+}
+
+RtpReceiver::DecodeWorker::~DecodeWorker()
+{
+    delete[] m_decoded;
+}
+
+void RtpReceiver::DecodeWorker::stop()
+{
+    m_stop.store(true);
+    m_queue->wake();
+}
+
+void RtpReceiver::DecodeWorker::run()
+{
+    m_clock.start();
+
+    RtpDatagramQueue::Datagram datagrams[decodeBatch];
+    while (!m_stop.load()) {
+        // Sleep until audio arrives or a retransmission is due
+        const int timeout = (m_retryDeadline < 0) ? -1 : qMax(m_retryDeadline-m_clock.elapsed(), qint64(0));
+        m_queue->wait(timeout);
+
+        int count;
+        while (!m_stop.load() && ((count = m_queue->front(datagrams, decodeBatch)) > 0)) {
+            processBatch(datagrams, count);
+            m_queue->pop(count);
+        }
+
+        if ((m_retryDeadline >= 0) && (m_clock.elapsed() >= m_retryDeadline)) {
+            requestRetransmit();
+        }
+    }
+}
+
+void RtpReceiver::DecodeWorker::processBatch(RtpDatagramQueue::Datagram *datagrams, int count)
+{
+    if (m_decodePool && (count >= parallelDecodeBatch)) {
+        processBurst(datagrams, count);
+    } else {
+        // Decrypt audio of whole batch at once, lazy decode keeps it encrypted
+        if (m_decoder) {
+            char *payloads[decodeBatch];
+            int sizes[decodeBatch];
+            int audio = 0;
+            for (int i = 0; i < count; ++i) {
+                const int offset = audioOffset(datagrams[i].data, datagrams[i].size);
+                if (offset) {
+                    payloads[audio] = datagrams[i].data+offset;
+                    sizes[audio] = datagrams[i].size-offset;
+                    ++audio;
+                }
+            }
+            m_decoder->decrypt(payloads, sizes, audio);
+        }
+
+        for (int i = 0; i < count; ++i) {
+            processDatagram(datagrams[i].data, datagrams[i].size, datagrams[i].arrival, true);
+        }
+    }
+
+    // Queue depth tells how far decoding lags behind receiving
+    m_processed += count;
+    if (m_processed >= statInterval) {
+        qDebug()<<Q_FUNC_INFO<<"queue size:"<<m_queue->size()<<"max:"<<m_queue->maxSize()<<"capacity:"<<m_queue->capacity()<<"dropped:"<<m_queue->dropped();
+        m_queue->resetStat();
+        m_processed = 0;
+    }
+}
+
+void RtpReceiver::DecodeWorker::processBurst(RtpDatagramQueue::Datagram *datagrams, int count)
+{
+    // Decode all audio at once, packets finish in any order
+    RtpDecodePool::Job jobs[decodeBatch];
+    int jobOf[decodeBatch];
+    int audio = 0;
+    for (int i = 0; i < count; ++i) {
+        const int offset = audioOffset(datagrams[i].data, datagrams[i].size);
+        jobOf[i] = offset ? audio : -1;
+        if (offset) {
+            RtpDecodePool::Job &job = jobs[audio++];
+            job.payload = datagrams[i].data+offset;
+            job.size = datagrams[i].size-offset;
+            job.out = m_decoded + jobOf[i]*m_rtpBuffer->maxPayloadSize();
+            job.outSize = 0;
+        }
+    }
+    m_decodePool->decode(jobs, audio);
+
+    // Commit in sequence number order, so reordering within a burst does not look like loss
+    int order[decodeBatch];
+    for (int i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    const quint16 first = sequenceNumber(datagrams[0].data, datagrams[0].size);
+    std::stable_sort(order, order+count, [&](int a, int b) {
+        return qint16(sequenceNumber(datagrams[a].data, datagrams[a].size)-first) < qint16(sequenceNumber(datagrams[b].data, datagrams[b].size)-first);
+    });
+
+    for (int i = 0; i < count; ++i) {
+        const RtpDatagramQueue::Datagram &datagram = datagrams[order[i]];
+        const int job = jobOf[order[i]];
+        if (job >= 0) {
+            processDatagram(datagram.data, datagram.size, datagram.arrival, true, jobs[job].out, jobs[job].outSize);
+        } else {
+            processDatagram(datagram.data, datagram.size, datagram.arrival, true);
+        }
+    }
+}
+
+void RtpReceiver::DecodeWorker::processDatagram(char *data, int size, qint64 arrival, bool decrypted, const char *decoded, int decodedSize)
+{
+    RtpHeader header;
+    const int offset = readAudioHeader(data, size, &header);
+    // need to check size, since we get broken payloads from time to time
+    if (!offset) {
+        return;
+    }
+    char* payload = data+offset;
+    const int payloadSize = size-offset;
+
+    // Lazy decode stores packet as is
+    if (!m_decoder && (payloadSize > m_rtpBuffer->maxPayloadSize())) {
+        qWarning()<<Q_FUNC_INFO<<"payload too big:"<<payloadSize;
+        return;
+    }
+    RtpPacket* rtpPacket = m_rtpBuffer->obtainPacket(header, arrival);
+    if (rtpPacket) {
+        if (decoded) {
+            memcpy(m_rtpBuffer->payload(rtpPacket), decoded, decodedSize);
+            rtpPacket->payloadSize = decodedSize;
+        } else if (m_decoder) {
+            rtpPacket->payloadSize = m_decoder->decode(payload, payloadSize, m_rtpBuffer->payload(rtpPacket), decrypted);
+        } else {
+            memcpy(m_rtpBuffer->payload(rtpPacket), payload, payloadSize);
+            rtpPacket->payloadSize = payloadSize;
+        }
+        m_rtpBuffer->commitPacket(rtpPacket);
+    }
+
+    if (header.payloadType == airtunes::RetransmitResponse) {
+        m_retransmitScheduler.responseReceived(header.sequenceNumber, m_clock.elapsed());
+    } else {
+        // Packets got lost (or reordered)
+        if ((qint16(header.sequenceNumber-m_nextSequenceNumber) > 0) && (m_retryDeadline < 0)) {
+            m_retryDeadline = m_clock.elapsed()+reorderHold;
+        }
+        m_nextSequenceNumber = header.sequenceNumber+1;
+    }
+}
+
+void RtpReceiver::DecodeWorker::requestRetransmit()
+{
+    const qint64 now = m_clock.elapsed();
+    const QList<RtpBuffer::Sequence> sequences = m_retransmitScheduler.requests(now);
+    if (!sequences.isEmpty()) {
+        m_udpWorker->requestRetransmit(sequences);
+    }
+
+    // Deadline is cleared when there is nothing left to request
+    const int timeout = m_retransmitScheduler.nextTimeout(now);
+    m_retryDeadline = (timeout >= 0) ? now+timeout : -1;
+}
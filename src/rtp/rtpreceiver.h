@@ -1,27 +1,43 @@
 #ifndef RTPRECEIVERBOOST_H
 #define RTPRECEIVERBOOST_H
 
-#include "alac.h"
 #include "airtunes/airtunesconstants.h"
+#include "rtpdatagramqueue.h"
+#include "rtpretransmitscheduler.h"
+#include "rtpsocketbackend.h"
 #include "rtsp/rtspmessage.h"
 
+#include <atomic>
 #include <memory>
-#include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
-#include <openssl/aes.h>
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QThread>
 
 class RtpBuffer;
-class QElapsedTimer;
+class RtpCapture;
+class RtpClock;
+class RtpDecodePool;
+class RtpDecoder;
 
 class RtpReceiver : public QObject
 {
     Q_OBJECT
 public:
-    explicit RtpReceiver(RtpBuffer *rtpBuffer, quint16 retryInterval = 25, QObject *parent = 0);
+    // rtpClock: estimates the sender's clock from timing exchanges
+    // lazyDecode: buffer stores encrypted packets, consumer decodes them when taken
+    explicit RtpReceiver(RtpBuffer *rtpBuffer, RtpClock *rtpClock, quint16 retryInterval = 25, bool lazyDecode = false, QObject *parent = 0);
+    ~RtpReceiver();
+
+    // Record announcements and received datagrams of all following sessions to file, see RtpCapture
+    void setCaptureFile(const QString &fileName);
+    // Socket backend of all following sessions, see RtpSocketBackend::names()
+    void setSocketBackend(const QString &name);
+    // Decode bursts with this many additional threads, 0 decodes one packet at a time.
+    // Has no effect with lazy decode.
+    void setDecodeThreads(int threads);
 
 public slots:
     void announce(const RtspMessage::Announcement &announcement);
@@ -30,51 +46,114 @@ public slots:
     void teardown();
 
 private:
-    class UdpWorker : public QThread
+    class UdpWorker;
+
+    // Decode stage, producer of the buffer. Takes audio datagrams from the queue, decrypts
+    // and decodes them (or stores them encrypted for lazy decode) and requests retransmissions.
+    // With a decode pool, bursts are decoded in parallel and still committed by this thread.
+    class DecodeWorker : public QThread
     {
     public:
-        UdpWorker(const RtspMessage::Announcement& announcement, RtpBuffer *rtpBuffer, quint16 senderControlPort, quint16 retryInterval = 25);
-        ~UdpWorker();
-        quint16 port();
+        // decoder: NULL for lazy decode. decodePool: NULL to decode one packet at a time.
+        DecodeWorker(RtpDatagramQueue *queue, RtpBuffer *rtpBuffer, RtpDecoder *decoder, RtpDecodePool *decodePool, UdpWorker *udpWorker, quint16 retryInterval = 25);
+        ~DecodeWorker();
         void stop();
 
     private:
         void run() Q_DECL_OVERRIDE;
-        void doReceive();
-        void onReceive(const boost::system::error_code& error, std::size_t bytesTransferred);
+        void processBatch(RtpDatagramQueue::Datagram *datagrams, int count);
+        // Decode audio of batch in parallel, then process it in sequence number order
+        void processBurst(RtpDatagramQueue::Datagram *datagrams, int count);
+        // decrypted: audio payload has already been decrypted in place
+        // decoded: audio has already been decoded to this, NULL if not
+        void processDatagram(char *data, int size, qint64 arrival, bool decrypted, const char *decoded = NULL, int decodedSize = 0);
+        void requestRetransmit();
+
+        RtpDatagramQueue    *m_queue;
+        RtpBuffer           *m_rtpBuffer;
+        RtpDecoder          *m_decoder;
+        RtpDecodePool       *m_decodePool;
+        char                *m_decoded;     // decoded audio of a burst, one packet per slot
+        UdpWorker           *m_udpWorker;
+        std::atomic<bool>   m_stop;
+
+        //retry members, deadline is only set while there are gaps to request
+        RtpRetransmitScheduler  m_retransmitScheduler;
+        QElapsedTimer   m_clock;
+        qint64          m_retryDeadline;        // -1 if none
+        quint16         m_nextSequenceNumber;   // to detect new gaps
+        uint            m_processed;            // for queue statistics
+    };
 
-        void initAlac(const QByteArray &fmtp);
-        void decrypt(const char *in, unsigned char *out, int length);
+    // Socket thread, only receives. Audio goes to the decode stage through a queue,
+    // sync and timing packets are handled right away.
+    class UdpWorker : public QThread, private RtpSocketBackend::Handler
+    {
+    public:
+        UdpWorker(const RtspMessage::Announcement& announcement, RtpBuffer *rtpBuffer, RtpClock *rtpClock, RtpCapture *rtpCapture, const QString &socketBackend, quint16 senderControlPort, quint16 senderTimingPort, quint16 retryInterval = 25, bool lazyDecode = false, int decodeThreads = 0);
+        ~UdpWorker();
+        // local port for AudioData, RetransmitResponse (control) or TimingResponse (timing)
+        quint16 port(airtunes::PayloadType payloadType);
+        void stop();
+        // any thread, sends requests from socket thread
+        void requestRetransmit(const QList<RtpBuffer::Sequence> &sequences);
+
+    private:
+        void run() Q_DECL_OVERRIDE;
+        void onDatagram(const char *data, std::size_t size, qint64 arrival) Q_DECL_OVERRIDE;
 
         boost::asio::io_service m_ioService;
         boost::asio::io_service::work   *m_work;
-        boost::asio::ip::udp::socket    *m_socket;
-        boost::asio::ip::udp::endpoint  m_remoteEndpoint;
-        boost::array<char, 1536>        m_receiveBuffer;
+        boost::asio::ip::udp::socket    *m_socket;          // audio data
+        boost::asio::ip::udp::socket    *m_controlSocket;   // sync, retransmit requests and responses
+        boost::asio::ip::udp::socket    *m_timingSocket;    // timing requests and responses
+        RtpSocketBackend                *m_socketBackend;
 
         RtspMessage::Announcement m_announcement;
 
-        alac_file   *m_alac;
-        AES_KEY     m_aesKey;
+        RtpDecoder  *m_decoder;     // NULL for lazy decode, buffer owns decoder then
+        RtpDecodePool   *m_decodePool;  // NULL if bursts are decoded one packet at a time
 
         RtpBuffer   *m_rtpBuffer;
+        RtpCapture  *m_rtpCapture;  // NULL if not capturing
 
-        //retry members
-        void doRequestRetransmit();
-        void onRequestRetransmit(const boost::system::error_code& error, std::size_t bytesTransferred);
+        // Decode stage
+        RtpDatagramQueue    *m_queue;
+        DecodeWorker        *m_decodeWorker;
+
+        //retry members, requests come from decode stage
+        void doRequestRetransmit(const QList<RtpBuffer::Sequence> &sequences);
         quint16         m_senderControlPort;
         boost::asio::ip::udp::endpoint  m_retryEndpoint;
-        quint16         m_retryInterval;
-        boost::asio::deadline_timer m_retryTimer;
+
+        //timing members, NTP-style exchange with sender
+        void doRequestTiming(const boost::system::error_code& error);
+        void onTimingResponse(const char *data, std::size_t size, qint64 arrival);
+        void onTimingRequest(const char *data, std::size_t size, qint64 arrival);
+        void onSendTiming(const boost::system::error_code& error, std::size_t bytesTransferred);
+        RtpClock        *m_rtpClock;
+        boost::asio::ip::udp::endpoint  m_timingEndpoint;
+        boost::asio::deadline_timer m_timingTimer;
+        uint            m_timingRequests;   // sent so far
+        char            m_timingRequest[32];
+        char            m_timingResponse[32];
     };
 
 private:
     quint16     m_senderControlPort;
+    quint16     m_senderTimingPort;
 
     RtspMessage::Announcement m_announcement;
 
     RtpBuffer   *m_rtpBuffer;
+    RtpClock    *m_rtpClock;
     quint16     m_retryInterval;
+    bool        m_lazyDecode;
+
+    QString     m_captureFile;
+    RtpCapture  *m_rtpCapture;
+    QString     m_socketBackend;
+    int         m_decodeThreads;
 
     UdpWorker   *m_udpWorker;
 };
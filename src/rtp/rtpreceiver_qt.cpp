@@ -100,7 +100,7 @@ void RtpReceiver::readPendingDatagrams()
             if (rtpPacket) {
                 unsigned char packet[2048];
                 decrypt(payload, packet, payloadSize);
-                alac_decode_frame(m_alac, packet, rtpPacket->payload, &(rtpPacket->payloadSize));
+                alac_decode_frame(m_alac, packet, payloadSize, rtpPacket->payload, &(rtpPacket->payloadSize));
                 m_rtpBuffer->commitPacket(rtpPacket);
             }
             break;
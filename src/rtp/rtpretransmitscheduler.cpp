@@ -0,0 +1,134 @@
+#include "rtpretransmitscheduler.h"
+
+#include <QDebug>
+
+// Timeout doubles with each retry, up to 2^maxBackoff times
+static const uint maxBackoff = 3;
+// Due gaps with at most that many received packets in between are requested at once
+static const quint16 mergeDistance = 2;
+
+RtpRetransmitScheduler::RtpRetransmitScheduler(RtpBuffer *rtpBuffer, uint minInterval) :
+    m_rtpBuffer(rtpBuffer),
+    m_minInterval(minInterval)
+{
+    reset();
+}
+
+QList<RtpBuffer::Sequence> RtpRetransmitScheduler::requests(qint64 now)
+{
+    // Sync gaps with missing sequences of buffer. Those only shrink or split,
+    // so each one is either new or part of a gap we already know.
+    const QList<RtpBuffer::Sequence> missing = m_rtpBuffer->missingSequences();
+    QList<Gap> gaps;
+    for (const RtpBuffer::Sequence &sequence : missing) {
+        Gap gap = { sequence.first, sequence.count, 0, 0, false };
+        for (const Gap &known : m_gaps) {
+            const quint16 offset = sequence.first-known.first;
+            if ((offset < known.count) && (offset+sequence.count <= known.count)) {
+                gap.requested = known.requested;
+                gap.retries = known.retries;
+                gap.expired = known.expired;
+                break;
+            }
+        }
+
+        // Give up on packets which would arrive after they are played
+        if (!gap.expired) {
+            quint16 late = 0;
+            while ((late < gap.count) && (m_rtpBuffer->timeToPlay(gap.first+late) < int(rtt()))) {
+                ++late;
+            }
+            if (late > 0) {
+                qDebug()<<Q_FUNC_INFO<<"give up, first:"<<gap.first<<"count:"<<late<<"rtt:"<<rtt();
+                const Gap expired = { gap.first, late, gap.requested, gap.retries, true };
+                gaps.append(expired);
+                gap.first += late;
+                gap.count -= late;
+            }
+        }
+        if (gap.count > 0) {
+            gaps.append(gap);
+        }
+    }
+    m_gaps = gaps;
+
+    QList<RtpBuffer::Sequence> requests;
+    int previous = -1;
+    for (int i = 0; i < m_gaps.size(); ++i) {
+        Gap &gap = m_gaps[i];
+        if (gap.expired || ((gap.retries > 0) && (now-gap.requested < timeout(gap.retries)))) {
+            continue;
+        }
+        gap.requested = now;
+        ++gap.retries;
+
+        // Merge with request for previous gap, if it is close
+        if ((i > 0) && (previous == i-1) && (quint16(gap.first-(requests.last().first+requests.last().count)) <= mergeDistance)) {
+            requests.last().count = gap.first+gap.count-requests.last().first;
+        } else {
+            const RtpBuffer::Sequence request = { gap.first, gap.count };
+            requests.append(request);
+        }
+        previous = i;
+    }
+
+    return requests;
+}
+
+void RtpRetransmitScheduler::responseReceived(quint16 sequenceNumber, qint64 now)
+{
+    for (const Gap &gap : m_gaps) {
+        if (quint16(sequenceNumber-gap.first) >= gap.count) {
+            continue;
+        }
+        // Response to a repeated request is ambiguous (Karn's algorithm)
+        if (gap.retries != 1) {
+            return;
+        }
+        const int rtt = now-gap.requested;
+        if (m_srtt < 0) {
+            m_srtt = rtt;
+            m_rttVar = rtt/2;
+        } else {
+            m_rttVar = (3*m_rttVar + qAbs(m_srtt-rtt))/4;
+            m_srtt = (7*m_srtt + rtt)/8;
+        }
+        return;
+    }
+}
+
+int RtpRetransmitScheduler::nextTimeout(qint64 now) const
+{
+    int next = -1;
+    for (const Gap &gap : m_gaps) {
+        if (gap.expired) {
+            continue;
+        } else if (gap.retries == 0) {
+            return 0;
+        }
+        const int remaining = qMax(gap.requested+timeout(gap.retries)-now, qint64(0));
+        if ((next < 0) || (remaining < next)) {
+            next = remaining;
+        }
+    }
+    return next;
+}
+
+uint RtpRetransmitScheduler::rtt() const
+{
+    return qMax(m_srtt, 0);
+}
+
+void RtpRetransmitScheduler::reset()
+{
+    m_gaps.clear();
+    m_srtt = -1;
+    m_rttVar = 0;
+}
+
+int RtpRetransmitScheduler::timeout(uint retries) const
+{
+    // Until we have a sample, the min interval is all we know
+    const int rto = qMax(int(m_minInterval), m_srtt+4*m_rttVar);
+    return rto << qMin(retries-1, maxBackoff);
+}
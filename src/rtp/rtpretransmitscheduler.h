@@ -0,0 +1,52 @@
+#ifndef RTPRETRANSMITSCHEDULER_H
+#define RTPRETRANSMITSCHEDULER_H
+
+#include "rtpbuffer.h"
+
+#include <QList>
+
+// Decides which missing packets to request from the sender and when. Runs in producer thread.
+//
+// Each gap remembers when it was requested and how often. A gap is requested again only
+// after the retransmission timeout, which derives from the measured round trip time and
+// backs off exponentially. Gaps that cannot arrive before they are played are given up,
+// and requests for gaps close to each other are merged.
+class RtpRetransmitScheduler
+{
+public:
+    // minInterval = minimum time between two requests for the same gap in milliseconds
+    explicit RtpRetransmitScheduler(RtpBuffer *rtpBuffer, uint minInterval = 25);
+
+    // Sequences to request now, now is a monotonic time in milliseconds
+    QList<RtpBuffer::Sequence> requests(qint64 now);
+    // Retransmitted packet arrived, samples round trip time
+    void responseReceived(quint16 sequenceNumber, qint64 now);
+    // Milliseconds until requests() should be called again, -1 if there is nothing to request
+    int nextTimeout(qint64 now) const;
+
+    // smoothed round trip time in milliseconds
+    uint rtt() const;
+    // Forget gaps and round trip time, e.g. on new stream
+    void reset();
+
+private:
+    struct Gap {
+        quint16 first;
+        quint16 count;
+        qint64  requested;  // time of last request
+        uint    retries;    // requests sent so far
+        bool    expired;    // cannot arrive in time anymore
+    };
+
+    int timeout(uint retries) const;
+
+    RtpBuffer   *m_rtpBuffer;
+    const uint  m_minInterval;
+    QList<Gap>  m_gaps;     // ordered like RtpBuffer::missingSequences()
+
+    // Round trip time estimation (RFC 6298), in milliseconds
+    int         m_srtt;
+    int         m_rttVar;
+};
+
+#endif // RTPRETRANSMITSCHEDULER_H
@@ -0,0 +1,168 @@
+#include "rtpsocketbackend.h"
+
+#include "rtpclock.h"
+#include "rtpdatagramqueue.h"
+#ifdef HAVE_IO_URING
+#include "rtpsocketbackend_uring.h"
+#endif
+
+#include <boost/array.hpp>
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <string.h>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <time.h>
+#endif
+
+using boost::asio::ip::udp;
+namespace ph = boost::asio::placeholders;
+
+#ifdef Q_OS_LINUX
+qint64 rtpArrivalTime(struct msghdr *message, qint64 realtimeOffset)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return qint64(ts.tv_sec)*1000000000LL + ts.tv_nsec + realtimeOffset;
+        }
+    }
+    return RtpClock::now();
+}
+#endif
+
+// Reactor based: waits for readability, then drains the socket
+class RtpSocketBackendAsio : public RtpSocketBackend
+{
+public:
+    RtpSocketBackendAsio(Handler *handler);
+
+    const char *name() const Q_DECL_OVERRIDE { return "asio"; }
+    bool start(const std::vector<udp::socket*> &sockets) Q_DECL_OVERRIDE;
+
+private:
+    void doReceive(udp::socket *socket);
+    void onReadable(udp::socket *socket, const boost::system::error_code& error);
+
+    Handler *m_handler;
+#ifdef Q_OS_LINUX
+    // Sockets are drained with recvmmsg into a batch of preallocated buffers,
+    // control messages carry the kernel receive timestamps
+    enum { receiveBatch = 32 };
+    boost::array<boost::array<char, RtpDatagramQueue::datagramSize>, receiveBatch> m_receiveBuffers;
+    struct mmsghdr  m_messages[receiveBatch];
+    struct iovec    m_iovecs[receiveBatch];
+    char            m_controls[receiveBatch][CMSG_SPACE(sizeof(struct timespec))];
+#else
+    boost::array<char, RtpDatagramQueue::datagramSize>  m_receiveBuffer;
+#endif
+};
+
+RtpSocketBackendAsio::RtpSocketBackendAsio(Handler *handler) :
+    m_handler(handler)
+{
+#ifdef Q_OS_LINUX
+    for (int i = 0; i < receiveBatch; ++i) {
+        m_iovecs[i].iov_base = m_receiveBuffers[i].data();
+        m_iovecs[i].iov_len = m_receiveBuffers[i].size();
+        memset(&m_messages[i], 0, sizeof(m_messages[i]));
+        m_messages[i].msg_hdr.msg_iov = &m_iovecs[i];
+        m_messages[i].msg_hdr.msg_iovlen = 1;
+        m_messages[i].msg_hdr.msg_control = m_controls[i];
+    }
+#endif
+}
+
+bool RtpSocketBackendAsio::start(const std::vector<udp::socket*> &sockets)
+{
+    for (udp::socket *socket : sockets) {
+        doReceive(socket);
+    }
+    return true;
+}
+
+void RtpSocketBackendAsio::doReceive(udp::socket *socket)
+{
+    socket->async_receive(boost::asio::null_buffers(),
+                          boost::bind(&RtpSocketBackendAsio::onReadable, this, socket, ph::error));
+}
+
+void RtpSocketBackendAsio::onReadable(udp::socket *socket, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted) {
+        return;
+    } else if (error) {
+        qWarning()<<Q_FUNC_INFO<<" error occurred: "<<error;
+    } else {
+#ifdef Q_OS_LINUX
+        // Drain socket, a burst is processed in batches
+        int count;
+        do {
+            for (int i = 0; i < receiveBatch; ++i) {
+                m_messages[i].msg_hdr.msg_controllen = sizeof(m_controls[i]);
+            }
+            count = ::recvmmsg(socket->native_handle(), m_messages, receiveBatch, MSG_DONTWAIT, NULL);
+            const qint64 realtimeOffset = RtpClock::realtimeOffset();
+
+            for (int i = 0; i < count; ++i) {
+                if (m_messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    qWarning()<<Q_FUNC_INFO<<"datagram truncated";
+                    continue;
+                }
+                m_handler->onDatagram(m_receiveBuffers[i].data(), m_messages[i].msg_len, rtpArrivalTime(&m_messages[i].msg_hdr, realtimeOffset));
+            }
+        } while (count == receiveBatch);
+
+        if ((count < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            qWarning()<<Q_FUNC_INFO<<"recvmmsg failed:"<<strerror(errno);
+        }
+#else
+        // Drain socket
+        boost::system::error_code receiveError;
+        while (socket->available(receiveError) > 0) {
+            const std::size_t size = socket->receive(boost::asio::buffer(m_receiveBuffer), 0, receiveError);
+            if (receiveError) {
+                qWarning()<<Q_FUNC_INFO<<"receive failed:"<<receiveError.message().c_str();
+                break;
+            }
+            m_handler->onDatagram(m_receiveBuffer.data(), size, RtpClock::now());
+        }
+#endif
+    }
+
+    doReceive(socket);
+}
+
+RtpSocketBackend *RtpSocketBackend::create(const QString &name, boost::asio::io_service &ioService, Handler *handler)
+{
+#ifdef HAVE_IO_URING
+    if (name == "io_uring") {
+        RtpSocketBackendUring *backend = new RtpSocketBackendUring(ioService, handler);
+        if (backend->init()) {
+            return backend;
+        }
+        delete backend;
+        qWarning()<<Q_FUNC_INFO<<"io_uring not available, falling back to asio";
+    }
+#else
+    Q_UNUSED(ioService)
+#endif
+
+    if (!name.isEmpty() && !names().contains(name)) {
+        qWarning()<<Q_FUNC_INFO<<"unknown backend:"<<name;
+    }
+    return new RtpSocketBackendAsio(handler);
+}
+
+QStringList RtpSocketBackend::names()
+{
+    QStringList names;
+    names<<"asio";
+#ifdef HAVE_IO_URING
+    names<<"io_uring";
+#endif
+    return names;
+}
@@ -0,0 +1,40 @@
+#ifndef RTPSOCKETBACKEND_H
+#define RTPSOCKETBACKEND_H
+
+#include <boost/asio.hpp>
+
+#include <QString>
+#include <QStringList>
+
+// Receives the datagrams of the receiver's sockets within its io_service. The socket
+// thread keeps running the io_service for timers and sends, backends only differ in
+// how datagrams get from the kernel to the handler.
+class RtpSocketBackend
+{
+public:
+    class Handler {
+    public:
+        virtual ~Handler() {}
+        // socket thread. arrival: receive time in nanoseconds (RtpClock::now() time base)
+        virtual void onDatagram(const char *data, std::size_t size, qint64 arrival) = 0;
+    };
+
+    // name: "asio" or "io_uring", falls back to asio if name is unknown or unavailable
+    static RtpSocketBackend *create(const QString &name, boost::asio::io_service &ioService, Handler *handler);
+    // backends available on this platform
+    static QStringList names();
+
+    virtual ~RtpSocketBackend() {}
+    virtual const char *name() const = 0;
+
+    // socket thread, before running the io_service. Sockets must outlive the backend.
+    virtual bool start(const std::vector<boost::asio::ip::udp::socket*> &sockets) = 0;
+};
+
+#ifdef Q_OS_LINUX
+struct msghdr;
+// Kernel receive timestamp (SO_TIMESTAMPNS) of message in local time, now if there is none
+qint64 rtpArrivalTime(struct msghdr *message, qint64 realtimeOffset);
+#endif
+
+#endif // RTPSOCKETBACKEND_H
@@ -0,0 +1,321 @@
+#include "rtpsocketbackend_uring.h"
+
+#include "rtpclock.h"
+#include "rtpdatagramqueue.h"
+
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <QDebug>
+
+using boost::asio::ip::udp;
+namespace ph = boost::asio::placeholders;
+
+// Only receives are submitted, one per socket
+static const uint submissionEntries = 8;
+// Buffers the kernel may fill before we drain them, about a second of audio
+static const uint bufferCount = 256;
+static const uint bufferSize = 2048;
+static const quint16 bufferGroup = 0;
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, args);
+}
+
+// Multishot recvmsg came with 6.0, there is no feature flag for it
+static bool kernelSupported()
+{
+    struct utsname name;
+    int major = 0;
+    if ((uname(&name) < 0) || (sscanf(name.release, "%d", &major) != 1)) {
+        return false;
+    }
+    return major >= 6;
+}
+
+RtpSocketBackendUring::RtpSocketBackendUring(boost::asio::io_service &ioService, Handler *handler) :
+    m_handler(handler),
+    m_completionEvent(ioService),
+    m_ringFd(-1),
+    m_eventFd(-1),
+    m_pending(0),
+    m_sqRing(MAP_FAILED),
+    m_sqRingSize(0),
+    m_cqRing(MAP_FAILED),
+    m_cqRingSize(0),
+    m_sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+    m_sqesSize(0),
+    m_bufferRing(static_cast<struct io_uring_buf_ring*>(MAP_FAILED)),
+    m_bufferRingSize(bufferCount*sizeof(struct io_uring_buf)),
+    m_buffers(NULL),
+    m_bufferTail(0)
+{
+    memset(&m_message, 0, sizeof(m_message));
+    m_message.msg_controllen = CMSG_SPACE(sizeof(struct timespec));
+}
+
+RtpSocketBackendUring::~RtpSocketBackendUring()
+{
+    // Closing the ring cancels the receives
+    if (m_ringFd >= 0) {
+        close(m_ringFd);
+    }
+    if (m_completionEvent.is_open()) {
+        boost::system::error_code error;
+        m_completionEvent.close(error);
+    } else if (m_eventFd >= 0) {
+        close(m_eventFd);
+    }
+
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if ((m_cqRing != MAP_FAILED) && (m_cqRing != m_sqRing)) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing != MAP_FAILED) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if (m_bufferRing != MAP_FAILED) {
+        munmap(m_bufferRing, m_bufferRingSize);
+    }
+    delete[] m_buffers;
+}
+
+bool RtpSocketBackendUring::init()
+{
+    if (!kernelSupported()) {
+        qWarning()<<Q_FUNC_INFO<<"kernel too old for multishot receive";
+        return false;
+    }
+
+    // Completion queue takes a whole burst of datagrams
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2*bufferCount;
+    m_ringFd = ioUringSetup(submissionEntries, &params);
+    if (m_ringFd < 0) {
+        qWarning()<<Q_FUNC_INFO<<"io_uring_setup failed:"<<strerror(errno);
+        return false;
+    }
+
+    // Map rings, with a single mmap for both if supported
+    m_sqRingSize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = m_cqRingSize = qMax(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        qWarning()<<Q_FUNC_INFO<<"cannot map submission ring:"<<strerror(errno);
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            qWarning()<<Q_FUNC_INFO<<"cannot map completion ring:"<<strerror(errno);
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+    m_sqes = static_cast<struct io_uring_sqe*>(mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES));
+    if (m_sqes == MAP_FAILED) {
+        qWarning()<<Q_FUNC_INFO<<"cannot map submission entries:"<<strerror(errno);
+        return false;
+    }
+
+    char *sq = static_cast<char*>(m_sqRing);
+    char *cq = static_cast<char*>(m_cqRing);
+    m_sqTail = reinterpret_cast<unsigned*>(sq+params.sq_off.tail);
+    m_sqMask = reinterpret_cast<unsigned*>(sq+params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned*>(sq+params.sq_off.array);
+    m_cqHead = reinterpret_cast<unsigned*>(cq+params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(cq+params.cq_off.tail);
+    m_cqMask = reinterpret_cast<unsigned*>(cq+params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq+params.cq_off.cqes);
+
+    // Completions wake the io_service through an eventfd
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0) {
+        qWarning()<<Q_FUNC_INFO<<"eventfd failed:"<<strerror(errno);
+        return false;
+    }
+    if (ioUringRegister(m_ringFd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0) {
+        qWarning()<<Q_FUNC_INFO<<"cannot register eventfd:"<<strerror(errno);
+        return false;
+    }
+
+    // Register buffer ring, kernel picks a buffer per datagram
+    m_bufferRing = static_cast<struct io_uring_buf_ring*>(mmap(NULL, m_bufferRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+    if (m_bufferRing == MAP_FAILED) {
+        qWarning()<<Q_FUNC_INFO<<"cannot map buffer ring:"<<strerror(errno);
+        return false;
+    }
+    struct io_uring_buf_reg bufferReg;
+    memset(&bufferReg, 0, sizeof(bufferReg));
+    bufferReg.ring_addr = reinterpret_cast<quint64>(m_bufferRing);
+    bufferReg.ring_entries = bufferCount;
+    bufferReg.bgid = bufferGroup;
+    if (ioUringRegister(m_ringFd, IORING_REGISTER_PBUF_RING, &bufferReg, 1) < 0) {
+        qWarning()<<Q_FUNC_INFO<<"cannot register buffer ring:"<<strerror(errno);
+        return false;
+    }
+
+    m_buffers = new char[bufferCount*bufferSize];
+    for (uint i = 0; i < bufferCount; ++i) {
+        recycle(i);
+    }
+    __atomic_store_n(&m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE);
+
+    boost::system::error_code error;
+    m_completionEvent.assign(m_eventFd, error);
+    if (error) {
+        qWarning()<<Q_FUNC_INFO<<"cannot watch eventfd:"<<error;
+        return false;
+    }
+    return true;
+}
+
+bool RtpSocketBackendUring::start(const std::vector<udp::socket*> &sockets)
+{
+    for (udp::socket *socket : sockets) {
+        m_sockets.push_back(socket->native_handle());
+        arm(m_sockets.size()-1);
+    }
+    submit();
+    doWait();
+    return true;
+}
+
+void RtpSocketBackendUring::arm(int socket)
+{
+    // We are the only submitter, kernel only reads
+    const unsigned tail = *m_sqTail;
+    const unsigned index = tail & *m_sqMask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = m_sockets[socket];
+    sqe->addr = reinterpret_cast<quint64>(&m_message);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufferGroup;
+    sqe->user_data = socket;
+    m_sqArray[index] = index;
+
+    __atomic_store_n(m_sqTail, tail+1, __ATOMIC_RELEASE);
+    ++m_pending;
+}
+
+void RtpSocketBackendUring::submit()
+{
+    if (!m_pending) {
+        return;
+    }
+    if (ioUringEnter(m_ringFd, m_pending, 0, 0) < 0) {
+        qWarning()<<Q_FUNC_INFO<<"io_uring_enter failed:"<<strerror(errno);
+    }
+    m_pending = 0;
+}
+
+void RtpSocketBackendUring::doWait()
+{
+    m_completionEvent.async_read_some(boost::asio::null_buffers(),
+                                      boost::bind(&RtpSocketBackendUring::onCompletion, this, ph::error));
+}
+
+void RtpSocketBackendUring::onCompletion(const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted) {
+        return;
+    } else if (error) {
+        qWarning()<<Q_FUNC_INFO<<"error occurred:"<<error;
+    }
+
+    // Reset event before draining, completions after that signal again
+    quint64 events;
+    if (read(m_eventFd, &events, sizeof(events)) < 0 && (errno != EAGAIN)) {
+        qWarning()<<Q_FUNC_INFO<<"cannot read eventfd:"<<strerror(errno);
+    }
+
+    const qint64 realtimeOffset = RtpClock::realtimeOffset();
+    unsigned head = *m_cqHead;
+    unsigned tail;
+    while (head != (tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))) {
+        for (; head != tail; ++head) {
+            complete(&m_cqes[head & *m_cqMask], realtimeOffset);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        __atomic_store_n(&m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE);
+    }
+
+    submit();
+    doWait();
+}
+
+void RtpSocketBackendUring::complete(const struct io_uring_cqe *cqe, qint64 realtimeOffset)
+{
+    const int socket = cqe->user_data;
+
+    if (cqe->res < 0) {
+        // Ran out of buffers in a burst, they are back with this drain
+        if (cqe->res == -ENOBUFS) {
+            qWarning()<<Q_FUNC_INFO<<"receive buffers exhausted";
+        } else if (cqe->res != -ECANCELED) {
+            qWarning()<<Q_FUNC_INFO<<"receive failed:"<<strerror(-cqe->res);
+        }
+    } else if (cqe->flags & IORING_CQE_F_BUFFER) {
+        const quint16 bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char *buffer = m_buffers + bufferId*bufferSize;
+        const struct io_uring_recvmsg_out *out = reinterpret_cast<const struct io_uring_recvmsg_out*>(buffer);
+        char *control = buffer + sizeof(*out) + m_message.msg_namelen;
+        const char *payload = control + m_message.msg_controllen;
+
+        if (out->flags & MSG_TRUNC) {
+            qWarning()<<Q_FUNC_INFO<<"datagram truncated";
+        } else {
+            struct msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_control = control;
+            message.msg_controllen = out->controllen;
+            m_handler->onDatagram(payload, out->payloadlen, rtpArrivalTime(&message, realtimeOffset));
+        }
+        recycle(bufferId);
+    }
+
+    // Kernel ended the multishot receive, re-arm unless we cancelled it
+    if (!(cqe->flags & IORING_CQE_F_MORE) && (cqe->res != -ECANCELED)) {
+        arm(socket);
+    }
+}
+
+void RtpSocketBackendUring::recycle(quint16 bufferId)
+{
+    // Not bufs[]: its empty struct prefix takes a byte in C++, which shifts the array
+    struct io_uring_buf *buffer = reinterpret_cast<struct io_uring_buf*>(m_bufferRing) + (m_bufferTail & (bufferCount-1));
+    buffer->addr = reinterpret_cast<quint64>(m_buffers + bufferId*bufferSize);
+    buffer->len = bufferSize;
+    buffer->bid = bufferId;
+    ++m_bufferTail;
+}
@@ -0,0 +1,69 @@
+#ifndef RTPSOCKETBACKEND_URING_H
+#define RTPSOCKETBACKEND_URING_H
+
+#include "rtpsocketbackend.h"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// io_uring based: one multishot recvmsg per socket keeps receiving into a ring of
+// buffers registered with the kernel, no syscall per datagram. The kernel signals
+// completions on an eventfd, which the io_service waits for like any other descriptor.
+// Needs Linux 6.0.
+class RtpSocketBackendUring : public RtpSocketBackend
+{
+public:
+    RtpSocketBackendUring(boost::asio::io_service &ioService, Handler *handler);
+    ~RtpSocketBackendUring();
+
+    // false if the kernel does not support it
+    bool init();
+
+    const char *name() const Q_DECL_OVERRIDE { return "io_uring"; }
+    bool start(const std::vector<boost::asio::ip::udp::socket*> &sockets) Q_DECL_OVERRIDE;
+
+private:
+    // queue a multishot receive for socket
+    void arm(int socket);
+    void submit();
+    void doWait();
+    void onCompletion(const boost::system::error_code& error);
+    void complete(const struct io_uring_cqe *cqe, qint64 realtimeOffset);
+    // hand buffer back to the kernel, published with the next drain
+    void recycle(quint16 bufferId);
+
+    Handler     *m_handler;
+    boost::asio::posix::stream_descriptor   m_completionEvent;
+
+    int         m_ringFd;
+    int         m_eventFd;
+    std::vector<int>    m_sockets;
+    uint        m_pending;      // queued submissions
+
+    // Submission and completion rings, shared with the kernel
+    void        *m_sqRing;
+    size_t      m_sqRingSize;
+    void        *m_cqRing;
+    size_t      m_cqRingSize;
+    struct io_uring_sqe *m_sqes;
+    size_t      m_sqesSize;
+    unsigned    *m_sqTail;
+    unsigned    *m_sqMask;
+    unsigned    *m_sqArray;
+    unsigned    *m_cqHead;
+    unsigned    *m_cqTail;
+    unsigned    *m_cqMask;
+    struct io_uring_cqe *m_cqes;
+
+    // Provided buffers. Each holds the recvmsg header, the timestamp and the datagram.
+    struct io_uring_buf_ring    *m_bufferRing;
+    size_t      m_bufferRingSize;
+    char        *m_buffers;
+    quint16     m_bufferTail;
+
+    // Receive template: no source address, control space for the timestamp
+    struct msghdr   m_message;
+};
+
+#endif // RTPSOCKETBACKEND_URING_H
@@ -14,6 +14,10 @@ struct RtpStat {
     uint32_t flush;
     uint32_t overflow;
     uint32_t underrun;
+    uint32_t dropped;   // dropped to shrink fill
+    uint32_t inserted;  // inserted to grow fill
+    uint32_t jitter;    // interarrival jitter in microseconds
+    uint32_t maxDelay;  // max time from arrival to commit in microseconds (receive, queue, decode)
     
     void init() {
         put = 0;
@@ -26,6 +30,10 @@ struct RtpStat {
         flush = 0;
         overflow = 0;
         underrun = 0;
+        dropped = 0;
+        inserted = 0;
+        jitter = 0;
+        maxDelay = 0;
     }
     
     RtpStat() { init(); }
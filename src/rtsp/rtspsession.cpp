@@ -5,6 +5,7 @@
 #include "core/core.h"
 #include "devicecontrol/devicecontrolabstract.h"
 #include "rtp/rtpbuffer.h"
+#include "rtp/rtpclock.h"
 
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
@@ -67,14 +68,19 @@ void RtspSession::run()
 
     // Create RTP/Playback components
     RtpBuffer   rtpBuffer(airtunes::framesPerPacket, ofCore->options().latency);
-    RtpReceiver rtpReceiver(&rtpBuffer, ofCore->options().latency/10);
-    Player      player(&rtpBuffer);
+    RtpClock    rtpClock;
+    RtpReceiver rtpReceiver(&rtpBuffer, &rtpClock, ofCore->options().latency/10);
+    Player      player(&rtpBuffer, &rtpClock);
 
     // wire components
     //QObject::connect(this, &RtspSession::announce, [](){ ofCore->audioOut(); });
+    // New session reallocates the buffer, stop the player of the previous one first
+    QObject::connect(this, &RtspSession::announce, &player, &Player::teardown);
     QObject::connect(this, &RtspSession::announce, &rtpReceiver, &RtpReceiver::announce);
     QObject::connect(this, &RtspSession::senderSocketAvailable, &rtpReceiver, &RtpReceiver::setSenderSocket);
     QObject::connect(this, &RtspSession::receiverSocketRequired, &rtpReceiver, &RtpReceiver::bindSocket);
+    QObject::connect(this, &RtspSession::record, &rtpBuffer, &RtpBuffer::flush);
+    QObject::connect(this, &RtspSession::flush, &rtpBuffer, &RtpBuffer::flush);
     QObject::connect(this, &RtspSession::teardown, &rtpReceiver, &RtpReceiver::teardown);
     QObject::connect(this, &RtspSession::teardown, &player, &Player::teardown);
 
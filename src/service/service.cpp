@@ -10,6 +10,7 @@
 #include "rtsp/rtspserver.h"
 //#include "rtsp/rtspserver_threaded.h"
 #include "rtp/rtpbuffer.h"
+#include "rtp/rtpclock.h"
 #include "rtp/rtpreceiver.h"
 //#include "rtp/rtpreceiver_qt.h"
 //#include "rtp/rtpretransmissionrequester.h"
@@ -45,20 +46,28 @@ void Service::initNetwork()
 {
     // init rtsp/rtp components
     RtspServer  *rtspServer = new RtspServer();
-    RtpBuffer   *rtpBuffer = new RtpBuffer(airtunes::framesPerPacket, ofCore->options().latency);
-    RtpReceiver *rtpReceiver = new RtpReceiver(rtpBuffer, ofCore->options().latency/10);
+    RtpBuffer   *rtpBuffer = new RtpBuffer(airtunes::framesPerPacket, ofCore->options().latency, ofCore->options().minLatency, ofCore->options().maxLatency);
+    RtpClock    *rtpClock = new RtpClock();
+    RtpReceiver *rtpReceiver = new RtpReceiver(rtpBuffer, rtpClock, ofCore->options().latency/10, ofCore->options().lazyDecode);
+    if (!ofCore->options().captureFile.isEmpty()) {
+        rtpReceiver->setCaptureFile(ofCore->options().captureFile);
+    }
+    rtpReceiver->setSocketBackend(ofCore->options().socketBackend);
+    rtpReceiver->setDecodeThreads(ofCore->options().decodeThreads);
 
     // init player
-    Player      *player = new Player(rtpBuffer, this);
+    Player      *player = new Player(rtpBuffer, rtpClock, this);
 
     // wire components
     QObject::connect(rtspServer, &RtspServer::announce, [](){ ofCore->audioOut(); });
+    // New session reallocates the buffer, stop the player of the previous one first
+    QObject::connect(rtspServer, &RtspServer::announce, player, &Player::teardown);
     QObject::connect(rtspServer, &RtspServer::announce, rtpReceiver, &RtpReceiver::announce);
     QObject::connect(rtspServer, &RtspServer::senderSocketAvailable, rtpReceiver, &RtpReceiver::setSenderSocket);
     QObject::connect(rtspServer, &RtspServer::receiverSocketRequired, rtpReceiver, &RtpReceiver::bindSocket);
     //QObject::connect(rtspServer, &RtspServer::record, player, &Player::play);
-    //QObject::connect(rtspServer, SIGNAL(record(quint16)), rtpBuffer, SLOT(flush(quint16)));
-    //QObject::connect(rtspServer, SIGNAL(flush(quint16)), rtpBuffer, SLOT(flush(quint16)));
+    QObject::connect(rtspServer, &RtspServer::record, rtpBuffer, &RtpBuffer::flush);
+    QObject::connect(rtspServer, &RtspServer::flush, rtpBuffer, &RtpBuffer::flush);
     //QObject::connect(rtspServer, &RtspServer::teardown, rtpBuffer, &RtpBuffer::teardown);
     QObject::connect(rtspServer, &RtspServer::teardown, rtpReceiver, &RtpReceiver::teardown);
     QObject::connect(rtspServer, &RtspServer::teardown, player, &Player::teardown);
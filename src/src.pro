@@ -38,6 +38,8 @@ CONFIG(release, debug|release) {
 SOURCES += main.cpp \
     player.cpp \
     alac.c \
+    alac_fir.c \
+    alac_deinterlace.c \
     daemon.c \
     util.cpp \
     devicecontrol/devicecontrolfactory.cpp \
@@ -51,8 +53,16 @@ SOURCES += main.cpp \
     airtunes/airtunesserviceconfig.cpp \
     core/core.cpp \
     rtp/rtpbuffer.cpp \
+    rtp/rtpcapture.cpp \
+    rtp/rtpclock.cpp \
+    rtp/rtpconcealer.cpp \
+    rtp/rtpdatagramqueue.cpp \
+    rtp/rtpdecodepool.cpp \
+    rtp/rtpdecoder.cpp \
     rtp/rtpheader.cpp \
     rtp/rtpreceiver.cpp \
+    rtp/rtpretransmitscheduler.cpp \
+    rtp/rtpsocketbackend.cpp \
     #rtp/rtpreceiver_qt.cpp \
     #rtp/rtpretransmissionrequester.cpp \
     rtsp/rtspmessage.cpp \
@@ -67,10 +77,19 @@ unix:!macx {
     SOURCES += audioout/audioout_alsa.cpp
 }
 
+# io_uring socket backend, selected at runtime
+linux:exists(/usr/include/linux/io_uring.h) {
+    DEFINES += HAVE_IO_URING
+    SOURCES += rtp/rtpsocketbackend_uring.cpp
+    HEADERS += rtp/rtpsocketbackend_uring.h
+}
+
 
 HEADERS += \
     player.h \
     alac.h \
+    alac_fir.h \
+    alac_deinterlace.h \
     daemon.h \
     signalhandler.h \
     util.h \
@@ -86,9 +105,17 @@ HEADERS += \
     devicecontrol/devicecontrolrs232.h \
     devicecontrol/devicewatcher.h \
     rtp/rtpbuffer.h \
+    rtp/rtpcapture.h \
+    rtp/rtpclock.h \
+    rtp/rtpconcealer.h \
+    rtp/rtpdatagramqueue.h \
+    rtp/rtpdecodepool.h \
+    rtp/rtpdecoder.h \
     rtp/rtpheader.h \
     rtp/rtppacket.h \
     rtp/rtpreceiver.h \
+    rtp/rtpretransmitscheduler.h \
+    rtp/rtpsocketbackend.h \
     #rtp/rtpreceiver_qt.h \
     #rtp/rtpretransmissionrequester.h \
     rtp/rtpstat.h \
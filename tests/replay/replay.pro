@@ -0,0 +1,69 @@
+#-------------------------------------------------
+#
+# Replays a stream capture through the receive pipeline
+#
+#-------------------------------------------------
+
+QT       += testlib network
+QT       -= gui
+
+QMAKE_CXXFLAGS += -std=c++0x
+
+TARGET = tst_replaytest
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../../src
+
+macx {
+    INCLUDEPATH += "/usr/local/include/"
+    LIBS += -L/usr/local/lib
+}
+
+LIBS += -lcrypto -lboost_system
+
+SOURCES += tst_replaytest.cpp \
+    ../../src/rtp/rtpbuffer.cpp \
+    ../../src/rtp/rtpcapture.cpp \
+    ../../src/rtp/rtpclock.cpp \
+    ../../src/rtp/rtpconcealer.cpp \
+    ../../src/rtp/rtpdatagramqueue.cpp \
+    ../../src/rtp/rtpdecodepool.cpp \
+    ../../src/rtp/rtpdecoder.cpp \
+    ../../src/rtp/rtpheader.cpp \
+    ../../src/rtp/rtpreceiver.cpp \
+    ../../src/rtp/rtpretransmitscheduler.cpp \
+    ../../src/rtp/rtpsocketbackend.cpp \
+    ../../src/rtsp/rtspmessage.cpp \
+    ../../src/alac.c \
+    ../../src/alac_fir.c \
+    ../../src/alac_deinterlace.c \
+    ../../src/util.cpp
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
+
+HEADERS += \
+    ../../src/rtp/rtpbuffer.h \
+    ../../src/rtp/rtpcapture.h \
+    ../../src/rtp/rtpclock.h \
+    ../../src/rtp/rtpconcealer.h \
+    ../../src/rtp/rtpdatagramqueue.h \
+    ../../src/rtp/rtpdecodepool.h \
+    ../../src/rtp/rtpdecoder.h \
+    ../../src/rtp/rtpheader.h \
+    ../../src/rtp/rtppacket.h \
+    ../../src/rtp/rtpreceiver.h \
+    ../../src/rtp/rtpretransmitscheduler.h \
+    ../../src/rtp/rtpsocketbackend.h \
+    ../../src/rtsp/rtspmessage.h \
+    ../../src/alac.h \
+    ../../src/alac_fir.h \
+    ../../src/alac_deinterlace.h \
+    ../../src/util.h
+
+linux:exists(/usr/include/linux/io_uring.h) {
+    DEFINES += HAVE_IO_URING
+    SOURCES += ../../src/rtp/rtpsocketbackend_uring.cpp
+    HEADERS += ../../src/rtp/rtpsocketbackend_uring.h
+}
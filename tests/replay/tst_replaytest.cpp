@@ -0,0 +1,422 @@
+#include <QString>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtTest>
+#include <QUdpSocket>
+
+#include <airtunes/airtunesconstants.h>
+#include <rtp/rtpbuffer.h>
+#include <rtp/rtpcapture.h>
+#include <rtp/rtpclock.h>
+#include <rtp/rtpdecoder.h>
+#include <rtp/rtppacket.h>
+#include <rtp/rtpreceiver.h>
+#include <rtp/rtpsocketbackend.h>
+
+#include <atomic>
+#include <math.h>
+#include <openssl/evp.h>
+#include <sys/resource.h>
+
+// Replays a stream capture (see RtpCapture, omnifunken --capture) through the receive
+// pipeline and reports the time spent per stage, for each socket backend.
+//
+// OMNIFUNKEN_CAPTURE      capture file to replay. Without it a synthetic stream is generated,
+//                         whose decoded audio is verified.
+// OMNIFUNKEN_REPLAY_FAST  send datagrams as fast as possible instead of in real time
+// OMNIFUNKEN_REPLAY_LAZY  replay with lazy decode
+// OMNIFUNKEN_REPLAY_DECODE_THREADS  decode bursts with additional threads
+
+static const uint latency = 500;
+static const quint16 firstSequence = 65000;     // we want to wrap
+static const int syntheticPackets = 3*airtunes::sampleRate/airtunes::framesPerPacket;
+
+// 441 Hz sine, inverted on right channel
+static void syntheticFrames(int packet, qint16 *samples)
+{
+    for (uint i = 0; i < airtunes::framesPerPacket; ++i) {
+        const int frame = packet*airtunes::framesPerPacket+i;
+        const qint16 value = qint16(8000.0*sin(2.0*M_PI*(frame%100)/100.0));
+        samples[2*i] = value;
+        samples[2*i+1] = -value;
+    }
+}
+
+// Uncompressed stereo ALAC frame: 23 header bits followed by 16 bit samples, MSB first
+static QByteArray alacFrame(const qint16 *samples, int frames)
+{
+    QByteArray frame((23+frames*32+7)/8, 0);
+    int bit = 0;
+    auto put = [&](quint32 value, int bits) {
+        for (int i = bits-1; i >= 0; --i, ++bit) {
+            if ((value >> i) & 1) {
+                frame[bit/8] = frame[bit/8] | char(0x80 >> (bit%8));
+            }
+        }
+    };
+    put(1, 3);      // stereo
+    put(0, 16);     // unknown
+    put(0, 1);      // no sample count
+    put(0, 2);      // no uncompressed bytes
+    put(1, 1);      // not compressed
+    for (int i = 0; i < frames*2; ++i) {
+        put(quint16(samples[i]), 16);
+    }
+    return frame;
+}
+
+static RtspMessage::Announcement syntheticAnnouncement()
+{
+    RtspMessage::Announcement announcement;
+    announcement.fmtp = "96 352 0 16 40 10 14 2 255 0 0 44100";
+    for (char i = 0; i < 16; ++i) {
+        announcement.rsaAesKey.append(char(0x10+i));
+        announcement.aesIv.append(char(0x80+i));
+    }
+    return announcement;
+}
+
+// AES-128-CBC like the sender, trailing partial block stays plain
+static void encrypt(const RtspMessage::Announcement &announcement, char *data, int size)
+{
+    unsigned char *buffer = reinterpret_cast<unsigned char*>(data);
+    int length = 0;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL,
+                       reinterpret_cast<const unsigned char*>(announcement.rsaAesKey.constData()),
+                       reinterpret_cast<const unsigned char*>(announcement.aesIv.constData()));
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_EncryptUpdate(ctx, buffer, &length, buffer, size & ~0xf);
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+static void writeSyntheticCapture(const QString &fileName)
+{
+    RtpCapture capture(fileName);
+    QVERIFY(capture.openWrite());
+    const RtspMessage::Announcement announcement = syntheticAnnouncement();
+    capture.writeAnnouncement(announcement);
+
+    const qint64 start = 1000000000LL;
+    qint16 samples[airtunes::framesPerPacket*airtunes::channels];
+    for (int i = 0; i < syntheticPackets; ++i) {
+        const quint16 sequenceNumber = firstSequence+i;
+        const quint32 timestamp = i*airtunes::framesPerPacket;
+        const qint64 arrival = start + (qint64(timestamp)*1000000000LL)/airtunes::sampleRate;
+
+        // Sync every second: this frame is presented at once
+        if ((i%(airtunes::sampleRate/airtunes::framesPerPacket)) == 0) {
+            char sync[20];
+            memset(sync, 0, sizeof(sync));
+            sync[0] = (i == 0) ? 0x90 : 0x80;
+            sync[1] = airtunes::Sync|0x80;
+            *(quint16*)(sync+2) = qToBigEndian(quint16(7));
+            *(quint32*)(sync+4) = qToBigEndian(timestamp);
+            *(quint64*)(sync+8) = qToBigEndian(RtpClock::toNtp(arrival));
+            *(quint32*)(sync+16) = qToBigEndian(timestamp);
+            capture.writeDatagram(sync, sizeof(sync), arrival);
+        }
+
+        syntheticFrames(i, samples);
+        QByteArray datagram(12, 0);
+        datagram[0] = char(0x80);
+        datagram[1] = char((i == 0) ? (airtunes::AudioData|0x80) : airtunes::AudioData);
+        *(quint16*)(datagram.data()+2) = qToBigEndian(sequenceNumber);
+        *(quint32*)(datagram.data()+4) = qToBigEndian(timestamp);
+        datagram.append(alacFrame(samples, airtunes::framesPerPacket));
+        encrypt(announcement, datagram.data()+12, datagram.size()-12);
+        capture.writeDatagram(datagram.constData(), datagram.size(), arrival);
+    }
+}
+
+// Time statistics of one pipeline stage
+class StageStat
+{
+public:
+    explicit StageStat(const char *name) : m_name(name), m_count(0), m_sum(0), m_max(0) {}
+
+    void add(qint64 nsecs)
+    {
+        ++m_count;
+        m_sum += nsecs;
+        m_max = qMax(m_max, nsecs);
+    }
+
+    void report() const
+    {
+        qDebug("%-20s packets: %6d  mean: %10.1f us  max: %10.1f us", m_name, m_count,
+               m_count ? m_sum/(1000.0*m_count) : 0.0, m_max/1000.0);
+    }
+
+private:
+    const char  *m_name;
+    int         m_count;
+    qint64      m_sum;
+    qint64      m_max;
+};
+
+// Takes packets like the player, without audio output
+class Consumer : public QThread
+{
+public:
+    Consumer(RtpBuffer *rtpBuffer, const qint64 *sent, bool verify) :
+        m_rtpBuffer(rtpBuffer),
+        m_sent(sent),
+        m_verify(verify),
+        m_finish(false),
+        m_taken(0),
+        m_late(0),
+        m_corrupt(0),
+        m_network("send to arrival"),
+        m_receive("arrival to commit"),
+        m_buffer("commit to take")
+    {
+    }
+
+    void finish() { m_finish.store(true); }
+
+    int taken() const { return m_taken; }
+    int late() const { return m_late; }
+    int corrupt() const { return m_corrupt; }
+
+    void report() const
+    {
+        m_network.report();
+        m_receive.report();
+        m_buffer.report();
+    }
+
+private:
+    void run()
+    {
+        qint16 expected[airtunes::framesPerPacket*airtunes::channels];
+        while (true) {
+            RtpBuffer::TakeStatus status;
+            const RtpPacket *packet = m_rtpBuffer->takePacket(100, &status);
+            const qint64 now = RtpClock::now();
+            if (status == RtpBuffer::TakeOk) {
+                ++m_taken;
+                m_network.add(packet->arrival-m_sent[packet->sequenceNumber]);
+                m_receive.add(packet->committed-packet->arrival);
+                m_buffer.add(now-packet->committed);
+                if (m_verify) {
+                    syntheticFrames(quint16(packet->sequenceNumber-firstSequence), expected);
+                    if ((packet->payloadSize != int(sizeof(expected))) || memcmp(m_rtpBuffer->payload(packet), expected, sizeof(expected))) {
+                        ++m_corrupt;
+                    }
+                }
+            } else if (status == RtpBuffer::TakeLate) {
+                ++m_late;
+            } else if (m_finish.load() || (status == RtpBuffer::TakeEnded)) {
+                break;
+            }
+        }
+    }
+
+    RtpBuffer       *m_rtpBuffer;
+    const qint64    *m_sent;
+    const bool      m_verify;
+    std::atomic<bool>   m_finish;
+
+    int         m_taken;
+    int         m_late;
+    int         m_corrupt;
+    StageStat   m_network;
+    StageStat   m_receive;
+    StageStat   m_buffer;
+};
+
+class ReplayTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    ReplayTest();
+
+private Q_SLOTS:
+    void initTestCase();
+    void decode();
+    void replay_data();
+    void replay();
+
+private:
+    QTemporaryDir   m_dir;
+    QString         m_captureFile;
+    bool            m_synthetic;
+};
+
+ReplayTest::ReplayTest() :
+    m_synthetic(false)
+{
+}
+
+void ReplayTest::initTestCase()
+{
+    m_captureFile = qgetenv("OMNIFUNKEN_CAPTURE");
+    if (m_captureFile.isEmpty()) {
+        m_captureFile = m_dir.path()+"/synthetic.ofc";
+        m_synthetic = true;
+        writeSyntheticCapture(m_captureFile);
+    }
+    qDebug()<<"capture:"<<m_captureFile;
+}
+
+void ReplayTest::decode()
+{
+    // Decoder alone, as fast as possible
+    RtpCapture capture(m_captureFile);
+    QVERIFY(capture.openRead());
+
+    RtpDecoder *decoder = NULL;
+    QByteArray out;
+    StageStat decrypt("decrypt");
+    StageStat decode("decode");
+    int corrupt = 0;
+    qint16 expected[airtunes::framesPerPacket*airtunes::channels];
+
+    RtpCapture::Record record;
+    while ((record = capture.read()) != RtpCapture::None) {
+        if (record == RtpCapture::Announcement) {
+            delete decoder;
+            decoder = new RtpDecoder(capture.announcement());
+            out.resize(decoder->framesPerPacket()*airtunes::channels*sizeof(qint16));
+            continue;
+        }
+
+        QByteArray datagram = capture.datagram();
+        const int type = datagram.size() > 1 ? (datagram.at(1) & 0x7f) : 0;
+        const int offset = (type == airtunes::AudioData) ? 12 : ((type == airtunes::RetransmitResponse) ? 16 : 0);
+        if (!decoder || !offset || (datagram.size() < offset)) {
+            continue;
+        }
+
+        char *payload = datagram.data()+offset;
+        const int size = datagram.size()-offset;
+        const qint64 begin = RtpClock::now();
+        decoder->decrypt(payload, size);
+        const qint64 decrypted = RtpClock::now();
+        const int outSize = decoder->decode(payload, size, out.data(), true);
+        decrypt.add(decrypted-begin);
+        decode.add(RtpClock::now()-decrypted);
+
+        if (m_synthetic) {
+            const quint16 sequenceNumber = qFromBigEndian(*((quint16*)(datagram.constData()+2)));
+            syntheticFrames(quint16(sequenceNumber-firstSequence), expected);
+            if ((outSize != int(sizeof(expected))) || memcmp(out.constData(), expected, sizeof(expected))) {
+                ++corrupt;
+            }
+        }
+    }
+    delete decoder;
+
+    decrypt.report();
+    decode.report();
+    QCOMPARE(corrupt, 0);
+}
+
+void ReplayTest::replay_data()
+{
+    QTest::addColumn<QString>("socketBackend");
+    for (const QString &name : RtpSocketBackend::names()) {
+        QTest::newRow(name.toLatin1().constData()) << name;
+    }
+}
+
+void ReplayTest::replay()
+{
+    QFETCH(QString, socketBackend);
+    const bool fast = !qgetenv("OMNIFUNKEN_REPLAY_FAST").isEmpty();
+    const bool lazyDecode = !qgetenv("OMNIFUNKEN_REPLAY_LAZY").isEmpty();
+    const int decodeThreads = qgetenv("OMNIFUNKEN_REPLAY_DECODE_THREADS").toInt();
+
+    RtpCapture capture(m_captureFile);
+    QVERIFY(capture.openRead());
+
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, latency);
+    RtpClock rtpClock;
+    RtpReceiver rtpReceiver(&rtpBuffer, &rtpClock, latency/10, lazyDecode);
+    rtpReceiver.setSocketBackend(socketBackend);
+    rtpReceiver.setDecodeThreads(decodeThreads);
+    QUdpSocket sender;
+    QVERIFY(sender.bind(QHostAddress::LocalHost, 0));
+
+    // Send time per sequence number
+    QVector<qint64> sent(65536, 0);
+    Consumer consumer(&rtpBuffer, sent.constData(), m_synthetic && !fast);
+    consumer.start();
+
+    // Context switches and CPU time of the whole process, receiving dominates them
+    struct rusage begin;
+    getrusage(RUSAGE_SELF, &begin);
+
+    quint16 audioPort = 0;
+    quint16 controlPort = 0;
+    quint16 timingPort = 0;
+    qint64 firstArrival = -1;
+    qint64 start = 0;
+    int audioPackets = 0;
+
+    RtpCapture::Record record;
+    while ((record = capture.read()) != RtpCapture::None) {
+        if (record == RtpCapture::Announcement) {
+            // We are the sender, timing is not replayed
+            RtspMessage::Announcement announcement = capture.announcement();
+            announcement.senderAddress = QHostAddress(QHostAddress::LocalHost);
+            rtpReceiver.announce(announcement);
+            rtpReceiver.setSenderSocket(airtunes::RetransmitRequest, sender.localPort());
+            rtpReceiver.bindSocket(airtunes::AudioData, &audioPort);
+            rtpReceiver.bindSocket(airtunes::RetransmitResponse, &controlPort);
+            rtpReceiver.bindSocket(airtunes::TimingResponse, &timingPort);
+            continue;
+        }
+
+        const QByteArray &datagram = capture.datagram();
+        const int type = datagram.size() > 1 ? (datagram.at(1) & 0x7f) : 0;
+        if (!audioPort || (type == airtunes::TimingRequest) || (type == airtunes::TimingResponse)) {
+            continue;
+        }
+
+        // Keep the captured pace
+        if (firstArrival < 0) {
+            firstArrival = capture.arrival();
+            start = RtpClock::now();
+        }
+        const qint64 due = start+capture.arrival()-firstArrival;
+        while (!fast && (RtpClock::now() < due)) {
+            QThread::usleep(qMax((due-RtpClock::now())/1000, qint64(1)));
+        }
+
+        if (type == airtunes::AudioData) {
+            sent[qFromBigEndian(*((quint16*)(datagram.constData()+2)))] = RtpClock::now();
+            ++audioPackets;
+        }
+        sender.writeDatagram(datagram, QHostAddress::LocalHost, (type == airtunes::AudioData) ? audioPort : controlPort);
+    }
+
+    // Consumer takes what is left
+    QThread::msleep(2*latency);
+    consumer.finish();
+    consumer.wait();
+    rtpReceiver.teardown();
+
+    struct rusage end;
+    getrusage(RUSAGE_SELF, &end);
+    const long contextSwitches = (end.ru_nvcsw-begin.ru_nvcsw)+(end.ru_nivcsw-begin.ru_nivcsw);
+    const qint64 cpuTime = (end.ru_utime.tv_sec-begin.ru_utime.tv_sec)*1000000LL + (end.ru_utime.tv_usec-begin.ru_utime.tv_usec)
+                         + (end.ru_stime.tv_sec-begin.ru_stime.tv_sec)*1000000LL + (end.ru_stime.tv_usec-begin.ru_stime.tv_usec);
+    qDebug()<<"backend:"<<socketBackend<<"context switches:"<<contextSwitches<<"cpu time:"<<cpuTime/1000<<"ms";
+
+    qDebug()<<"sent:"<<audioPackets<<"taken:"<<consumer.taken()<<"late:"<<consumer.late()<<(fast ? "(fast)" : "(real time)")<<(lazyDecode ? "(lazy decode)" : "")<<"decode threads:"<<decodeThreads;
+    consumer.report();
+
+    if (m_synthetic && !fast) {
+        QCOMPARE(audioPackets, syntheticPackets);
+        QCOMPARE(consumer.taken(), syntheticPackets);
+        QCOMPARE(consumer.late(), 0);
+        QCOMPARE(consumer.corrupt(), 0);
+    }
+}
+
+QTEST_MAIN(ReplayTest)
+
+#include "tst_replaytest.moc"
@@ -22,11 +22,22 @@ macx {
     LIBS += -L/usr/local/lib
 }
 
-LIBS += -lao
+LIBS += -lao -lcrypto
 
 SOURCES += tst_rtptest.cpp \
     ../../src/rtp/rtpbuffer.cpp \
+    ../../src/rtp/rtpcapture.cpp \
+    ../../src/rtp/rtpclock.cpp \
+    ../../src/rtp/rtpconcealer.cpp \
+    ../../src/rtp/rtpdatagramqueue.cpp \
+    ../../src/rtp/rtpdecodepool.cpp \
+    ../../src/rtp/rtpdecoder.cpp \
     ../../src/rtp/rtpheader.cpp \
+    ../../src/rtp/rtpretransmitscheduler.cpp \
+    ../../src/rtsp/rtspmessage.cpp \
+    ../../src/alac.c \
+    ../../src/alac_fir.c \
+    ../../src/alac_deinterlace.c \
     ../../src/util.cpp \
     ../../src/audioout/audioout_ao.cpp \
     ../../src/audioout/audiooutfactory.cpp
@@ -34,8 +45,19 @@ DEFINES += SRCDIR=\\\"$$PWD/\\\"
 
 HEADERS += \
     ../../src/rtp/rtpbuffer.h \
+    ../../src/rtp/rtpcapture.h \
+    ../../src/rtp/rtpclock.h \
+    ../../src/rtp/rtpconcealer.h \
+    ../../src/rtp/rtpdatagramqueue.h \
+    ../../src/rtp/rtpdecodepool.h \
+    ../../src/rtp/rtpdecoder.h \
     ../../src/rtp/rtpheader.h \
     ../../src/rtp/rtppacket.h \
+    ../../src/rtp/rtpretransmitscheduler.h \
+    ../../src/rtsp/rtspmessage.h \
+    ../../src/alac.h \
+    ../../src/alac_fir.h \
+    ../../src/alac_deinterlace.h \
     ../../src/util.h \
     ../../src/audioout/audioout_ao.h \
     ../../src/audioout/audiooutfactory.h
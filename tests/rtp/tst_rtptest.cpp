@@ -7,13 +7,38 @@
 
 #include <audioout/audioout_ao.h>
 #include <airtunes/airtunesconstants.h>
+#include <alac_deinterlace.h>
+#include <alac_fir.h>
 #include <rtp/rtpbuffer.h>
+#include <rtp/rtpcapture.h>
+#include <rtp/rtpclock.h>
+#include <rtp/rtpdatagramqueue.h>
+#include <rtp/rtpdecodepool.h>
+#include <rtp/rtpdecoder.h>
 #include <rtp/rtpheader.h>
 #include <rtp/rtppacket.h>
+#include <rtp/rtpretransmitscheduler.h>
+
+#include <openssl/aes.h>
+#include <openssl/evp.h>
 
 const uint numPacketsPerSecond = 44100/airtunes::framesPerPacket;
 const quint16 initSeqNo = 65000;    // we want to wrap the buffer
 
+static void putPacket(RtpBuffer *rtpBuffer, quint16 sequenceNumber, airtunes::PayloadType payloadType = airtunes::AudioData)
+{
+    RtpHeader header;
+    header.payloadType = payloadType;
+    header.sequenceNumber = sequenceNumber;
+    header.timestamp = sequenceNumber*airtunes::framesPerPacket;
+
+    RtpPacket *rtpPacket = rtpBuffer->obtainPacket(header);
+    if (rtpPacket) {
+        rtpPacket->payloadSize = airtunes::framesPerPacket*4;
+        rtpBuffer->commitPacket(rtpPacket);
+    }
+}
+
 class Producer : public QThread
 {
 public:
@@ -30,12 +55,14 @@ private:
         std::srand(std::time(0));
         for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+(numPacketsPerSecond*10)); ++i) {
             RtpHeader header;
+            header.payloadType = airtunes::AudioData;
             header.sequenceNumber = i;
+            header.timestamp = i*airtunes::framesPerPacket;
 
             QThread::msleep(m_interval);
             RtpPacket *rtpPacket = m_rtpBuffer->obtainPacket(header);
             for (uint j = 0; j < airtunes::framesPerPacket; ++j) {
-                *(((int*)(rtpPacket->payload)+j)) = std::rand();
+                *(((int*)(m_rtpBuffer->payload(rtpPacket))+j)) = std::rand();
             }
             rtpPacket->payloadSize = airtunes::framesPerPacket*4;
             rtpPacket->sequenceNumber = i;
@@ -48,6 +75,28 @@ private:
     uint    m_interval;
 };
 
+class DelayedProducer : public QThread
+{
+public:
+    DelayedProducer(RtpBuffer *rtpBuffer, quint16 sequenceNumber, uint delay) :
+        m_rtpBuffer(rtpBuffer),
+        m_sequenceNumber(sequenceNumber),
+        m_delay(delay)
+    {
+    }
+
+private:
+    void run()
+    {
+        QThread::msleep(m_delay);
+        putPacket(m_rtpBuffer, m_sequenceNumber);
+    }
+
+    RtpBuffer   *m_rtpBuffer;
+    quint16     m_sequenceNumber;
+    uint        m_delay;
+};
+
 class Consumer : public QThread
 {
 public:
@@ -77,7 +126,7 @@ private:
                 qWarning()<<Q_FUNC_INFO<< "no packet from buffer. Stopping playback.";
                 break;
             }
-            m_audioOut->play(packet->payload, packet->payloadSize);
+            m_audioOut->play(m_rtpBuffer->payload(packet), packet->payloadSize);
         } // while
 
         // Add silence after playback
@@ -105,9 +154,41 @@ private Q_SLOTS:
     void regular_data();
     void slowProducer();
     void fastProducer();
-    //void highJitter();
-    //void singleLoss();
-    //void burstLoss();
+    void highJitter();
+    void arrivalTime();
+    void retransmitHeader();
+    void adaptiveInsert();
+    void singleLoss();
+    void burstLoss();
+    void concealment();
+    void blockingTake();
+    void heldPacket();
+    void heldPacketGap();
+    void targetedFlush();
+    void variablePacketSize();
+    void stateTransitions();
+    void retransmitScheduler();
+    void retransmitDeadline();
+    void clockEstimation();
+    void presentationTime();
+    void datagramQueue();
+    void decrypt();
+    void capture();
+    void decodePool();
+    void lazyDecode();
+    void entropyDecode();
+    void planarFloat();
+    void specialisedDecoder();
+    void decodeBenchmark_data();
+    void decodeBenchmark();
+    void firPredictor_data();
+    void firPredictor();
+    void firPredictorBenchmark_data();
+    void firPredictorBenchmark();
+    void deinterlace_data();
+    void deinterlace();
+    void decryptBenchmark_data();
+    void decryptBenchmark();
 };
 
 RtpTest::RtpTest()
@@ -148,6 +229,1251 @@ void RtpTest::fastProducer()
     qApp->exec();
 }
 
+void RtpTest::highJitter()
+{
+    // Adaptive latency between 100 and 1000 ms, start at minimum
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100, 100, 1000);
+    const uint initialLatency = rtpBuffer.latency();
+
+    std::srand(std::time(0));
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+(numPacketsPerSecond*3)); ++i) {
+        RtpHeader header;
+        header.payloadType = airtunes::AudioData;
+        header.sequenceNumber = i;
+        header.timestamp = i*airtunes::framesPerPacket;
+
+        // 0-16 ms interarrival time, 8 ms on average
+        QThread::msleep(std::rand()%17);
+        RtpPacket *rtpPacket = rtpBuffer.obtainPacket(header);
+        if (rtpPacket) {
+            rtpPacket->payloadSize = airtunes::framesPerPacket*4;
+            rtpBuffer.commitPacket(rtpPacket);
+        }
+    }
+
+    QVERIFY(rtpBuffer.latency() > initialLatency);
+    QVERIFY(rtpBuffer.latency() <= 1000);
+}
+
+void RtpTest::arrivalTime()
+{
+    // Packets are inserted in a burst, jitter only depends on the given arrival times
+    RtpBuffer steady(airtunes::framesPerPacket, 100, 100, 1000);
+    RtpBuffer jittery(airtunes::framesPerPacket, 100, 100, 1000);
+    const uint initialLatency = steady.latency();
+
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+(numPacketsPerSecond*3)); ++i) {
+        RtpHeader header;
+        header.payloadType = airtunes::AudioData;
+        header.sequenceNumber = i;
+        header.timestamp = i*airtunes::framesPerPacket;
+
+        // On time, or alternately 6 ms early and late
+        const qint64 arrival = 1000000000LL + (qint64(quint16(i-initSeqNo))*airtunes::framesPerPacket*1000000000LL)/airtunes::sampleRate;
+        RtpPacket *rtpPacket = steady.obtainPacket(header, arrival);
+        QVERIFY(rtpPacket);
+        QCOMPARE(rtpPacket->arrival, arrival);
+        rtpPacket->payloadSize = airtunes::framesPerPacket*4;
+        steady.commitPacket(rtpPacket);
+
+        rtpPacket = jittery.obtainPacket(header, arrival + ((i%2) ? 6000000 : -6000000));
+        QVERIFY(rtpPacket);
+        rtpPacket->payloadSize = airtunes::framesPerPacket*4;
+        jittery.commitPacket(rtpPacket);
+    }
+
+    QCOMPARE(steady.latency(), initialLatency);
+    QVERIFY(jittery.latency() > initialLatency);
+}
+
+void RtpTest::retransmitHeader()
+{
+    // Audio datagram as sent, then wrapped into a retransmit response on the control port
+    QByteArray audio;
+    QDataStream stream(&audio, QIODevice::WriteOnly);
+    stream << quint8(0x80) << quint8(airtunes::AudioData) << quint16(4711) << quint32(0x12345678) << quint32(0xcafe);
+    stream.writeRawData("payload", 7);
+
+    QByteArray retransmit;
+    QDataStream retransmitStream(&retransmit, QIODevice::WriteOnly);
+    retransmitStream << quint8(0x80) << quint8(0x80 | airtunes::RetransmitResponse) << quint16(1);
+    retransmitStream.writeRawData(audio.constData(), audio.size());
+
+    RtpHeader header;
+    QCOMPARE(readAudioHeader(audio.constData(), audio.size(), &header), 12);
+    QCOMPARE(header.payloadType, airtunes::AudioData);
+    QCOMPARE(header.sequenceNumber, quint16(4711));
+    QCOMPARE(header.timestamp, quint32(0x12345678));
+
+    RtpHeader retransmitted;
+    QCOMPARE(readAudioHeader(retransmit.constData(), retransmit.size(), &retransmitted), 16);
+    QCOMPARE(retransmitted.payloadType, airtunes::RetransmitResponse);
+    QCOMPARE(retransmitted.sequenceNumber, header.sequenceNumber);
+    QCOMPARE(retransmitted.timestamp, header.timestamp);
+    QCOMPARE(QByteArray(retransmit.constData()+16, 7), QByteArray("payload"));
+
+    // Truncated response carries no audio
+    QCOMPARE(readAudioHeader(retransmit.constData(), 15, &retransmitted), 0);
+}
+
+void RtpTest::adaptiveInsert()
+{
+    // Consumer runs below target fill, adaptive buffer inserts a packet, fixed one does not.
+    // No sequence wrap here, timestamps are contiguous.
+    RtpBuffer adaptive(airtunes::framesPerPacket, 100, 100, 1000);
+    RtpBuffer fixed(airtunes::framesPerPacket, 100, 100, 1000);
+    fixed.setAdaptiveFill(false);
+    for (quint16 i = 1000; i != 1015; ++i) {
+        putPacket(&adaptive, i);
+        putPacket(&fixed, i);
+    }
+
+    // Inserted packet continues the previous one, the next packet has the same timestamp
+    QList<quint32> timestamps;
+    while (const RtpPacket *packet = adaptive.takePacket()) {
+        timestamps.append(packet->timestamp);
+    }
+    QCOMPARE(timestamps.size(), 16);
+    int inserted = 0;
+    for (int i = 1; i < timestamps.size(); ++i) {
+        if (timestamps.at(i) == timestamps.at(i-1)) {
+            ++inserted;
+        } else {
+            QCOMPARE(timestamps.at(i), timestamps.at(i-1)+airtunes::framesPerPacket);
+        }
+    }
+    QCOMPARE(inserted, 1);
+
+    quint32 timestamp = 1000*airtunes::framesPerPacket;
+    int taken = 0;
+    while (const RtpPacket *packet = fixed.takePacket()) {
+        QCOMPARE(packet->timestamp, timestamp);
+        timestamp += airtunes::framesPerPacket;
+        ++taken;
+    }
+    QCOMPARE(taken, 15);
+}
+
+void RtpTest::singleLoss()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 500);
+
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+20); ++i) {
+        if (i != (quint16)(initSeqNo+10)) {
+            putPacket(&rtpBuffer, i);
+        }
+    }
+
+    QList<RtpBuffer::Sequence> missing = rtpBuffer.missingSequences();
+    QCOMPARE(missing.size(), 1);
+    QCOMPARE(missing.at(0).first, (quint16)(initSeqNo+10));
+    QCOMPARE(missing.at(0).count, (quint16)1);
+
+    // Retransmission fills the gap
+    putPacket(&rtpBuffer, initSeqNo+10, airtunes::RetransmitResponse);
+    QVERIFY(rtpBuffer.missingSequences().isEmpty());
+}
+
+void RtpTest::burstLoss()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 500);
+
+    // Lose packets 10-14 (wrapping sequence numbers) and 17
+    for (quint16 i = 65530; i != 30; ++i) {
+        if ((i != 17) && ((quint16)(i-10) >= 5)) {
+            putPacket(&rtpBuffer, i);
+        }
+    }
+
+    QList<RtpBuffer::Sequence> missing = rtpBuffer.missingSequences();
+    QCOMPARE(missing.size(), 2);
+    QCOMPARE(missing.at(0).first, (quint16)10);
+    QCOMPARE(missing.at(0).count, (quint16)5);
+    QCOMPARE(missing.at(1).first, (quint16)17);
+    QCOMPARE(missing.at(1).count, (quint16)1);
+
+    // Retransmission of middle packet splits the burst
+    putPacket(&rtpBuffer, 12, airtunes::RetransmitResponse);
+    missing = rtpBuffer.missingSequences();
+    QCOMPARE(missing.size(), 3);
+    QCOMPARE(missing.at(0).first, (quint16)10);
+    QCOMPARE(missing.at(0).count, (quint16)2);
+    QCOMPARE(missing.at(1).first, (quint16)13);
+    QCOMPARE(missing.at(1).count, (quint16)2);
+}
+
+void RtpTest::concealment()
+{
+    // 441 Hz sine, 100 frames per period
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    const quint16 lost = initSeqNo+10;
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+20); ++i) {
+        if (i == lost) {
+            continue;
+        }
+        RtpHeader header;
+        header.payloadType = airtunes::AudioData;
+        header.sequenceNumber = i;
+        header.timestamp = i*airtunes::framesPerPacket;
+        RtpPacket *rtpPacket = rtpBuffer.obtainPacket(header);
+        QVERIFY(rtpPacket);
+        qint16 *samples = (qint16*)rtpBuffer.payload(rtpPacket);
+        for (uint f = 0; f < airtunes::framesPerPacket; ++f) {
+            const uint t = (quint16)(i-initSeqNo)*airtunes::framesPerPacket+f;
+            samples[2*f] = samples[2*f+1] = 10000*sin(2*M_PI*t/100);
+        }
+        rtpPacket->payloadSize = airtunes::framesPerPacket*4;
+        rtpBuffer.commitPacket(rtpPacket);
+    }
+
+    qint16 last = 0;
+    while (const RtpPacket *packet = rtpBuffer.takePacket()) {
+        const qint16 *samples = (const qint16*)rtpBuffer.payload(packet);
+        if (packet->sequenceNumber == lost) {
+            // Continues the waveform instead of silence
+            QCOMPARE(packet->payloadSize, (int)airtunes::framesPerPacket*4);
+            QVERIFY(qAbs(samples[0]-last) < 1000);
+            double energy = 0.0;
+            for (uint f = 0; f < airtunes::framesPerPacket; ++f) {
+                energy += samples[2*f]*samples[2*f];
+            }
+            QVERIFY(sqrt(energy/airtunes::framesPerPacket) > 5000.0);
+        }
+        last = samples[2*(packet->payloadSize/4-1)];
+    }
+}
+
+void RtpTest::blockingTake()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+20); ++i) {
+        putPacket(&rtpBuffer, i);
+    }
+
+    RtpBuffer::TakeStatus status;
+    for (int i = 0; i < 20; ++i) {
+        QVERIFY(rtpBuffer.takePacket(0, &status));
+        QCOMPARE(status, RtpBuffer::TakeOk);
+    }
+    QVERIFY(!rtpBuffer.takePacket(10, &status));
+    QCOMPARE(status, RtpBuffer::TakeUnderrun);
+
+    // Consumer resumes as soon as next packet arrives, no refill
+    DelayedProducer producer(&rtpBuffer, initSeqNo+20, 20);
+    QElapsedTimer timer;
+    timer.start();
+    producer.start();
+    const RtpPacket *packet = rtpBuffer.takePacket(1000, &status);
+    QVERIFY(packet);
+    QCOMPARE(status, RtpBuffer::TakeOk);
+    QCOMPARE(packet->sequenceNumber, (quint16)(initSeqNo+20));
+    QVERIFY(timer.elapsed() < 500);
+    producer.wait();
+
+    // Teardown wakes consumer
+    timer.restart();
+    rtpBuffer.teardown();
+    QVERIFY(!rtpBuffer.takePacket(1000, &status));
+    QCOMPARE(status, RtpBuffer::TakeEnded);
+    QVERIFY(timer.elapsed() < 500);
+}
+
+void RtpTest::heldPacket()
+{
+    // Payload bytes are the low byte of the sequence number
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    auto put = [&](quint16 sequenceNumber) {
+        RtpHeader header;
+        header.payloadType = airtunes::AudioData;
+        header.sequenceNumber = sequenceNumber;
+        header.timestamp = sequenceNumber*airtunes::framesPerPacket;
+        RtpPacket *rtpPacket = rtpBuffer.obtainPacket(header);
+        if (rtpPacket) {
+            rtpPacket->payloadSize = airtunes::framesPerPacket*4;
+            memset(rtpBuffer.payload(rtpPacket), sequenceNumber & 0xff, rtpPacket->payloadSize);
+            rtpBuffer.commitPacket(rtpPacket);
+        }
+    };
+    auto intact = [&](const RtpPacket *packet, quint16 sequenceNumber) {
+        const char *payload = rtpBuffer.payload(packet);
+        for (int i = 0; i < packet->payloadSize; ++i) {
+            if (payload[i] != char(sequenceNumber & 0xff)) {
+                return false;
+            }
+        }
+        return (packet->sequenceNumber == sequenceNumber) && (packet->payloadSize == int(airtunes::framesPerPacket*4));
+    };
+
+    for (quint16 i = 1000; i != 1020; ++i) {
+        put(i);
+    }
+    const RtpPacket *held = rtpBuffer.takePacket();
+    QVERIFY(held);
+    QVERIFY(intact(held, 1000));
+
+    // Producer overflows and wraps around the ring, the packet landing on the held slot is dropped
+    for (quint16 i = 1020; i != 1100; ++i) {
+        put(i);
+    }
+    QVERIFY(intact(held, 1000));
+
+    // Flush does not release the held slot either
+    rtpBuffer.flush(1100);
+    for (quint16 i = 1100; i != 1120; ++i) {
+        put(i);
+    }
+    QVERIFY(intact(held, 1000));
+
+    // Next take releases it and continues with the new stream
+    const RtpPacket *packet = rtpBuffer.takePacket();
+    QVERIFY(packet);
+    QVERIFY(intact(packet, 1100));
+}
+
+void RtpTest::heldPacketGap()
+{
+    // Capacity is 32 packets, an early packet 32 after the held one lands on its slot
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    for (quint16 i = 1000; i != 1026; ++i) {
+        putPacket(&rtpBuffer, i);
+    }
+    QVERIFY(rtpBuffer.takePacket());
+
+    // Dropped packet leaves no gap behind, the next one records it once
+    putPacket(&rtpBuffer, 1032);
+    QVERIFY(rtpBuffer.missingSequences().isEmpty());
+    putPacket(&rtpBuffer, 1033);
+    QList<RtpBuffer::Sequence> missing = rtpBuffer.missingSequences();
+    QCOMPARE(missing.size(), 1);
+    QCOMPARE(quint16(missing.at(0).first+missing.at(0).count), quint16(1033));
+}
+
+void RtpTest::targetedFlush()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+20); ++i) {
+        putPacket(&rtpBuffer, i);
+    }
+    RtpBuffer::TakeStatus status;
+    for (int i = 0; i < 5; ++i) {
+        QVERIFY(rtpBuffer.takePacket(0, &status));
+    }
+
+    // New stream starts at 15, old stream stops immediately
+    const quint16 flushSequence = initSeqNo+15;
+    rtpBuffer.flush(flushSequence);
+    QVERIFY(!rtpBuffer.takePacket(0, &status));
+    QCOMPARE(status, RtpBuffer::TakeUnderrun);
+
+    // Delayed packet of old stream is dropped
+    RtpHeader header;
+    header.payloadType = airtunes::AudioData;
+    header.sequenceNumber = initSeqNo+12;
+    header.timestamp = header.sequenceNumber*airtunes::framesPerPacket;
+    QVERIFY(!rtpBuffer.obtainPacket(header));
+
+    // Refill and continue with packets of new stream that already arrived
+    for (quint16 i = initSeqNo+20; i != (quint16)(initSeqNo+40); ++i) {
+        putPacket(&rtpBuffer, i);
+    }
+    const RtpPacket *packet = rtpBuffer.takePacket(0, &status);
+    QVERIFY(packet);
+    QCOMPARE(status, RtpBuffer::TakeOk);
+    QCOMPARE(packet->sequenceNumber, flushSequence);
+}
+
+void RtpTest::variablePacketSize()
+{
+    // 100 ms = 4410 frames, packets of 352 and 100 frames
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    quint32 timestamp = 1000;
+    quint32 frames = 0;
+    for (quint16 i = initSeqNo; frames < 4410; ++i) {
+        const quint32 packetFrames = (i%2) ? airtunes::framesPerPacket : 100;
+        RtpHeader header;
+        header.payloadType = airtunes::AudioData;
+        header.sequenceNumber = i;
+        header.timestamp = timestamp;
+        RtpPacket *rtpPacket = rtpBuffer.obtainPacket(header);
+        QVERIFY(rtpPacket);
+        rtpPacket->payloadSize = packetFrames*4;
+        rtpBuffer.commitPacket(rtpPacket);
+
+        // Ready exactly when fill reaches latency
+        timestamp += packetFrames;
+        frames += packetFrames;
+        RtpBuffer::TakeStatus status;
+        const RtpPacket *packet = rtpBuffer.takePacket(0, &status);
+        QCOMPARE(packet != NULL, frames >= 4410);
+        if (packet) {
+            QCOMPARE(packet->timestamp, (quint32)1000);
+            QCOMPARE(packet->payloadSize, (int)((initSeqNo%2) ? airtunes::framesPerPacket : 100)*4);
+        }
+    }
+}
+
+void RtpTest::stateTransitions()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    QSignalSpy readySpy(&rtpBuffer, SIGNAL(ready()));
+    QSignalSpy stateSpy(&rtpBuffer, SIGNAL(stateChanged(RtpBuffer::State)));
+
+    // Filling, then ready once
+    for (quint16 i = initSeqNo; i != (quint16)(initSeqNo+40); ++i) {
+        putPacket(&rtpBuffer, i);
+    }
+    QCOMPARE(readySpy.count(), 1);
+    QCOMPARE(stateSpy.count(), 2);
+    QCOMPARE(stateSpy.at(0).at(0).value<RtpBuffer::State>(), RtpBuffer::Filling);
+    QCOMPARE(stateSpy.at(1).at(0).value<RtpBuffer::State>(), RtpBuffer::Ready);
+
+    // Draining on underrun, back to ready with next packet without another ready()
+    while (rtpBuffer.takePacket()) {}
+    QCOMPARE(stateSpy.count(), 3);
+    QCOMPARE(stateSpy.at(2).at(0).value<RtpBuffer::State>(), RtpBuffer::Draining);
+    // Packet the consumer already passed neither ends draining nor counts another underrun
+    putPacket(&rtpBuffer, initSeqNo+39);
+    putPacket(&rtpBuffer, initSeqNo+38, airtunes::RetransmitResponse);
+    QCOMPARE(stateSpy.count(), 3);
+    QVERIFY(!rtpBuffer.takePacket());
+    QCOMPARE(stateSpy.count(), 3);
+    putPacket(&rtpBuffer, initSeqNo+40);
+    QCOMPARE(stateSpy.count(), 4);
+    QCOMPARE(stateSpy.at(3).at(0).value<RtpBuffer::State>(), RtpBuffer::Ready);
+    QCOMPARE(readySpy.count(), 1);
+    const RtpPacket *packet = rtpBuffer.takePacket();
+    QVERIFY(packet);
+    QCOMPARE(packet->sequenceNumber, (quint16)(initSeqNo+40));
+}
+
+void RtpTest::retransmitScheduler()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 500);
+    RtpRetransmitScheduler scheduler(&rtpBuffer, 20);
+    QCOMPARE(scheduler.nextTimeout(0), -1);
+
+    // Lose 5, 6 and 8, which are requested at once
+    for (quint16 i = 0; i < 20; ++i) {
+        if ((i != 5) && (i != 6) && (i != 8)) {
+            putPacket(&rtpBuffer, i);
+        }
+    }
+    QList<RtpBuffer::Sequence> requests = scheduler.requests(0);
+    QCOMPARE(requests.size(), 1);
+    QCOMPARE(requests.at(0).first, (quint16)5);
+    QCOMPARE(requests.at(0).count, (quint16)4);
+
+    // No repeated request before timeout
+    QVERIFY(scheduler.requests(10).isEmpty());
+    QCOMPARE(scheduler.nextTimeout(10), 10);
+
+    // Response yields rtt of 15 ms, timeout is 15+4*7 ms then
+    scheduler.responseReceived(5, 15);
+    putPacket(&rtpBuffer, 5, airtunes::RetransmitResponse);
+    QCOMPARE(scheduler.rtt(), (uint)15);
+    QVERIFY(scheduler.requests(20).isEmpty());
+    requests = scheduler.requests(43);
+    QCOMPARE(requests.size(), 1);
+    QCOMPARE(requests.at(0).first, (quint16)6);
+    QCOMPARE(requests.at(0).count, (quint16)3);
+
+    // Backoff doubles timeout, scheduler is idle when gaps are filled
+    QCOMPARE(scheduler.nextTimeout(100), 29);
+    putPacket(&rtpBuffer, 6, airtunes::RetransmitResponse);
+    putPacket(&rtpBuffer, 8, airtunes::RetransmitResponse);
+    QVERIFY(scheduler.requests(200).isEmpty());
+    QCOMPARE(scheduler.nextTimeout(200), -1);
+}
+
+void RtpTest::retransmitDeadline()
+{
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    RtpRetransmitScheduler scheduler(&rtpBuffer, 20);
+
+    for (quint16 i = 0; i < 20; ++i) {
+        if (i != 13) {
+            putPacket(&rtpBuffer, i);
+        }
+    }
+    QCOMPARE(scheduler.requests(0).size(), 1);
+    scheduler.responseReceived(13, 30);
+    QCOMPARE(scheduler.rtt(), (uint)30);
+
+    // 13 is played in less than 8 ms, a retransmission would be too late
+    for (int i = 0; i < 12; ++i) {
+        QVERIFY(rtpBuffer.takePacket());
+    }
+    QVERIFY(scheduler.requests(100).isEmpty());
+    QCOMPARE(scheduler.nextTimeout(100), -1);
+}
+
+void RtpTest::clockEstimation()
+{
+    // NTP conversion is exact to a nanosecond
+    const qint64 time = 3600*1000000000LL + 123456789;
+    QVERIFY(qAbs(RtpClock::fromNtp(RtpClock::toNtp(time))-time) <= 1);
+
+    // Sender is 5 s ahead and runs 20 ppm fast. Every other exchange is delayed by
+    // 30 ms on the way to the sender, which must not disturb the estimate.
+    RtpClock rtpClock;
+    QVERIFY(!rtpClock.isValid());
+    const qint64 offset = 5000000000LL;
+    const double drift = 20e-6;
+    qint64 local = 1000000000LL;
+    for (int i = 0; i < 16; ++i) {
+        const qint64 queueing = (i%2) ? 30000000 : 0;
+        const qint64 remoteReceive = local+1000000+queueing;
+        const qint64 remoteSend = remoteReceive+100000;
+        const qint64 localReceive = remoteSend+1000000;
+        rtpClock.addSample(local, remoteReceive+offset+qint64(drift*remoteReceive), remoteSend+offset+qint64(drift*remoteSend), localReceive);
+        local += 3000000000LL;
+    }
+    QVERIFY(rtpClock.isValid());
+    QVERIFY(qAbs(rtpClock.rtt()-2000000) < 10);
+    QVERIFY(qAbs(rtpClock.drift()-drift) < 1e-6);
+    QVERIFY(qAbs(rtpClock.offset(local)-(offset+qint64(drift*local))) < 100000);
+    QVERIFY(qAbs(rtpClock.toLocal(rtpClock.toRemote(local))-local) < 1000);
+}
+
+void RtpTest::presentationTime()
+{
+    // Sender is 5 s ahead
+    RtpClock rtpClock;
+    const qint64 offset = 5000000000LL;
+    qint64 local;
+    rtpClock.setSync(1000, RtpClock::toNtp(offset+10000000000LL));
+    QVERIFY(!rtpClock.presentationTime(1000, &local));
+    rtpClock.addSample(1000000000LL, offset+1001000000LL, offset+1001000000LL, 1002000000LL);
+
+    // Sync frame at local 10 s, one second of frames later at 11 s
+    QVERIFY(rtpClock.presentationTime(1000, &local));
+    QVERIFY(qAbs(local-10000000000LL) < 1000);
+    QVERIFY(rtpClock.presentationTime(1000+airtunes::sampleRate, &local));
+    QVERIFY(qAbs(local-11000000000LL) < 1000);
+}
+
+static RtspMessage::Announcement announcement()
+{
+    RtspMessage::Announcement announcement;
+    announcement.fmtp = "96 352 0 16 40 10 14 2 255 0 0 44100";
+    for (char i = 0; i < 16; ++i) {
+        announcement.rsaAesKey.append(char(0x10+i));
+        announcement.aesIv.append(char(0x80+i));
+    }
+    return announcement;
+}
+
+// AES-128-CBC like the sender, trailing partial block stays plain
+static QByteArray encrypt(const RtspMessage::Announcement &announcement, const QByteArray &plain)
+{
+    QByteArray encrypted = plain;
+    unsigned char *data = reinterpret_cast<unsigned char*>(encrypted.data());
+    int length = 0;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL,
+                       reinterpret_cast<const unsigned char*>(announcement.rsaAesKey.constData()),
+                       reinterpret_cast<const unsigned char*>(announcement.aesIv.constData()));
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_EncryptUpdate(ctx, data, &length, data, plain.size() & ~0xf);
+    EVP_CIPHER_CTX_free(ctx);
+    return encrypted;
+}
+
+// Uncompressed stereo ALAC frame of random samples: 23 header bits followed by 16 bit samples
+static QByteArray uncompressedFrame(int frames)
+{
+    QByteArray frame((23+frames*32+7)/8, 0);
+    int bit = 0;
+    auto put = [&](quint32 value, int bits) {
+        for (int i = bits-1; i >= 0; --i, ++bit) {
+            if ((value >> i) & 1) {
+                frame[bit/8] = frame[bit/8] | char(0x80 >> (bit%8));
+            }
+        }
+    };
+    put(1, 3);      // stereo
+    put(0, 16);     // unknown
+    put(0, 1);      // no sample count
+    put(0, 2);      // no uncompressed bytes
+    put(1, 1);      // not compressed
+    for (int i = 0; i < frames*2; ++i) {
+        put(quint16(qrand()), 16);
+    }
+    return frame;
+}
+
+// Compressed stereo frame of the given residuals: no prediction, no interlacing,
+// so they decode as they are. Rice coding mirrors entropy_rice_decode, with
+// escapes for large values and runs of zeros while the history is low.
+static QByteArray compressedFrame(const QVector<qint16> &left, const QVector<qint16> &right)
+{
+    QByteArray frame(64+(left.size()+right.size())*5, 0);
+    int bit = 0;
+    auto put = [&](quint32 value, int bits) {
+        for (int i = bits-1; i >= 0; --i, ++bit) {
+            if ((value >> i) & 1) {
+                frame[bit/8] = frame[bit/8] | char(0x80 >> (bit%8));
+            }
+        }
+    };
+    // value x with parameter k, escaped as size bits
+    auto putValue = [&](quint32 x, int k, int size, quint32 mask) {
+        const quint32 m = (k == 1) ? 1 : (((1u << k) - 1) & mask);
+        const quint32 q = x / m;
+        if (q > 8) {
+            put(0x1ff, 9);
+            put(x, size);
+            return;
+        }
+        put((1u << q) - 1, q);
+        put(0, 1);
+        if (k != 1) {
+            const quint32 r = x % m;
+            if (r) {
+                put(r+1, k);
+            } else {
+                put(0, k-1);
+            }
+        }
+    };
+    // fmtp of announcement(): history mult 40, initial history 10, k modifier 14
+    auto putChannel = [&](const QVector<qint16> &samples) {
+        int history = 10;
+        quint32 signModifier = 0;
+        for (int i = 0; i < samples.size(); ++i) {
+            int k = 31 - 14 - __builtin_clz((history >> 9) + 3);
+            k = (k < 0) ? k + 14 : 14;
+            const quint32 value = (samples[i] >= 0) ? 2*samples[i] : -2*samples[i]-1;
+            putValue(value - signModifier, k, 17, 0xffffffff);
+            signModifier = 0;
+            history += (value*40) - ((history*40) >> 9);
+            if (value > 0xffff) {
+                history = 0xffff;
+            }
+            if ((history < 128) && (i+1 < samples.size())) {
+                int zeros = 0;
+                while ((i+1+zeros < samples.size()) && !samples[i+1+zeros]) {
+                    ++zeros;
+                }
+                putValue(zeros, __builtin_clz(history) + ((history + 16) / 64) - 24, 16, (1 << 14) - 1);
+                i += zeros;
+                signModifier = 1;
+                history = 0;
+            }
+        }
+    };
+    put(1, 3);      // stereo
+    put(0, 16);     // unknown
+    put(0, 1);      // no sample count
+    put(0, 2);      // no uncompressed bytes
+    put(0, 1);      // compressed
+    put(0, 8);      // interlacing shift
+    put(0, 8);      // interlacing left weight
+    for (int channel = 0; channel < 2; ++channel) {
+        put(0, 4);  // adaptive fir
+        put(9, 4);  // quantitization
+        put(4, 3);  // rice modifier
+        put(0, 5);  // no coefficients
+    }
+    putChannel(left);
+    putChannel(right);
+    frame.resize((bit+7)/8);
+    return frame;
+}
+
+static QByteArray randomPayload(int size)
+{
+    QByteArray payload(size, 0);
+    for (int i = 0; i < size; ++i) {
+        payload[i] = char(qrand());
+    }
+    return payload;
+}
+
+// ALAC state as RtpDecoder::initAlac sets it up for announcement()
+static alac_file *raopAlac()
+{
+    alac_file *alac = alac_create(16, 2);
+    alac->setinfo_max_samples_per_frame = 352;
+    alac->setinfo_sample_size = 16;
+    alac->setinfo_rice_historymult = 40;
+    alac->setinfo_rice_initialhistory = 10;
+    alac->setinfo_rice_kmodifier = 14;
+    alac->setinfo_7f = 2;
+    alac->setinfo_80 = 255;
+    alac->setinfo_8a_rate = 44100;
+    alac_allocate_buffers(alac);
+    return alac;
+}
+
+// Noise of the given amplitude, 0 is silence
+static QByteArray noiseFrame(int frames, int amplitude)
+{
+    QVector<qint16> channels[2];
+    for (int i = 0; i < frames; ++i) {
+        for (QVector<qint16> &samples : channels) {
+            samples.append(amplitude ? qint16((qrand()%(2*amplitude))-amplitude) : 0);
+        }
+    }
+    return compressedFrame(channels[0], channels[1]);
+}
+
+void RtpTest::datagramQueue()
+{
+    RtpDatagramQueue queue(5);
+    QCOMPARE(queue.capacity(), 8);
+
+    // Full queue drops
+    char data[100];
+    for (int i = 0; i < 8; ++i) {
+        data[0] = i;
+        QVERIFY(queue.push(data, 10+i, i));
+    }
+    QVERIFY(!queue.push(data, 1, 0));
+    QCOMPARE(queue.dropped(), 1u);
+    QCOMPARE(queue.size(), 8);
+    QCOMPARE(queue.maxSize(), 8);
+
+    // Datagrams come out in order
+    RtpDatagramQueue::Datagram datagrams[4];
+    QCOMPARE(queue.front(datagrams, 4), 4);
+    for (int i = 0; i < 4; ++i) {
+        QCOMPARE(int(datagrams[i].data[0]), i);
+        QCOMPARE(datagrams[i].size, 10+i);
+        QCOMPARE(datagrams[i].arrival, qint64(i));
+    }
+    queue.pop(4);
+    QCOMPARE(queue.size(), 4);
+    QVERIFY(queue.wait(10));
+    queue.pop(queue.front(datagrams, 4));
+    QCOMPARE(queue.size(), 0);
+
+    // Empty queue times out, producer in other thread wakes consumer
+    QVERIFY(!queue.wait(20));
+    class Producer : public QThread {
+    public:
+        Producer(RtpDatagramQueue *queue) : m_queue(queue) {}
+        void run() { QThread::msleep(20); char c = 42; m_queue->push(&c, 1, 0); }
+        RtpDatagramQueue *m_queue;
+    } producer(&queue);
+    producer.start();
+    QVERIFY(queue.wait(5000));
+    QCOMPARE(queue.front(datagrams, 4), 1);
+    QCOMPARE(int(datagrams[0].data[0]), 42);
+    producer.wait();
+}
+
+void RtpTest::decrypt()
+{
+    const RtspMessage::Announcement a = announcement();
+    RtpDecoder decoder(a);
+
+    // Sizes with and without partial block
+    const int sizes[] = { 16, 100, 1024, 1455 };
+    QList<QByteArray> plains;
+    QList<QByteArray> payloads;
+    for (int size : sizes) {
+        const QByteArray plain = randomPayload(size);
+        const QByteArray encrypted = encrypt(a, plain);
+        QVERIFY(encrypted.left(size & ~0xf) != plain.left(size & ~0xf));
+        QCOMPARE(encrypted.mid(size & ~0xf), plain.mid(size & ~0xf));
+
+        QByteArray payload = encrypted;
+        decoder.decrypt(payload.data(), payload.size());
+        QCOMPARE(payload, plain);
+
+        plains.append(plain);
+        payloads.append(encrypted);
+    }
+
+    // Burst gives same result, IV is reset for each payload
+    char *data[4];
+    int dataSizes[4];
+    for (int i = 0; i < payloads.size(); ++i) {
+        data[i] = payloads[i].data();
+        dataSizes[i] = payloads[i].size();
+    }
+    decoder.decrypt(data, dataSizes, payloads.size());
+    for (int i = 0; i < payloads.size(); ++i) {
+        QCOMPARE(payloads[i], plains[i]);
+    }
+}
+
+
+void RtpTest::capture()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path()+"/capture.ofc";
+    RtspMessage::Announcement a = announcement();
+
+    // Two sessions, second one appends
+    {
+        RtpCapture capture(fileName);
+        QVERIFY(capture.openWrite());
+        capture.writeAnnouncement(a);
+        capture.writeDatagram("\x80\xe0\x00\x01", 4, 1000);
+        capture.writeDatagram("\x80\x60\x00\x02", 4, 2000);
+    }
+    {
+        RtpCapture capture(fileName);
+        QVERIFY(capture.openWrite());
+        a.fmtp = "96 4096 0 16 40 10 14 2 255 0 0 44100";
+        capture.writeAnnouncement(a);
+        capture.writeDatagram("\x80\x60\x00\x03", 4, 3000);
+    }
+
+    RtpCapture capture(fileName);
+    QVERIFY(capture.openRead());
+    QCOMPARE(capture.read(), RtpCapture::Announcement);
+    QCOMPARE(capture.announcement().fmtp, QByteArray("96 352 0 16 40 10 14 2 255 0 0 44100"));
+    QCOMPARE(capture.announcement().rsaAesKey, a.rsaAesKey);
+    QCOMPARE(capture.announcement().aesIv, a.aesIv);
+    QCOMPARE(capture.read(), RtpCapture::Datagram);
+    QCOMPARE(capture.datagram(), QByteArray("\x80\xe0\x00\x01", 4));
+    QCOMPARE(capture.arrival(), qint64(1000));
+    QCOMPARE(capture.read(), RtpCapture::Datagram);
+    QCOMPARE(capture.arrival(), qint64(2000));
+    QCOMPARE(capture.read(), RtpCapture::Announcement);
+    QCOMPARE(capture.announcement().fmtp, a.fmtp);
+    QCOMPARE(capture.read(), RtpCapture::Datagram);
+    QCOMPARE(capture.datagram(), QByteArray("\x80\x60\x00\x03", 4));
+    QCOMPARE(capture.read(), RtpCapture::None);
+}
+
+void RtpTest::decodePool()
+{
+    const RtspMessage::Announcement a = announcement();
+    RtpDecoder decoder(a);
+    RtpDecoder reference(a);
+    RtpDecodePool pool(a, &decoder, 3);
+    QCOMPARE(pool.threads(), 3);
+
+    // Bursts of any size decode like one packet at a time
+    static const int burst = 32;
+    const int outSize = airtunes::framesPerPacket*airtunes::channels*sizeof(qint16);
+    QByteArray out(burst*outSize, 0);
+    QByteArray expected(outSize, 0);
+    for (int round = 0; round < 50; ++round) {
+        const int count = 1+(round%burst);
+        QList<QByteArray> plains;
+        QList<QByteArray> payloads;
+        RtpDecodePool::Job jobs[burst];
+        for (int i = 0; i < count; ++i) {
+            plains.append(uncompressedFrame(airtunes::framesPerPacket));
+            payloads.append(encrypt(a, plains[i]));
+            jobs[i].payload = payloads[i].data();
+            jobs[i].size = payloads[i].size();
+            jobs[i].out = out.data()+i*outSize;
+            jobs[i].outSize = 0;
+        }
+
+        pool.decode(jobs, count);
+        for (int i = 0; i < count; ++i) {
+            QByteArray payload = encrypt(a, plains[i]);
+            QCOMPARE(reference.decode(payload.data(), payload.size(), expected.data()), outSize);
+            QCOMPARE(jobs[i].outSize, outSize);
+            QCOMPARE(out.mid(i*outSize, outSize), expected);
+        }
+    }
+}
+
+void RtpTest::lazyDecode()
+{
+    // Arena holds max fill of 12 packets, plus the held and the incoming one
+    const RtspMessage::Announcement a = announcement();
+    RtpDecoder reference(a);
+    RtpBuffer rtpBuffer(airtunes::framesPerPacket, 100);
+    rtpBuffer.setDecoder(new RtpDecoder(a));
+
+    QMap<quint16, QByteArray> plains;
+    auto put = [&](quint16 sequenceNumber, const QByteArray &plain) {
+        RtpHeader header;
+        header.payloadType = airtunes::AudioData;
+        header.sequenceNumber = sequenceNumber;
+        header.timestamp = sequenceNumber*airtunes::framesPerPacket;
+        RtpPacket *rtpPacket = rtpBuffer.obtainPacket(header);
+        if (!rtpPacket) {
+            return false;
+        }
+        const QByteArray encrypted = encrypt(a, plain);
+        memcpy(rtpBuffer.payload(rtpPacket), encrypted.constData(), encrypted.size());
+        rtpPacket->payloadSize = encrypted.size();
+        rtpBuffer.commitPacket(rtpPacket);
+        plains.insert(sequenceNumber, plain);
+        return true;
+    };
+    auto decoded = [&](const RtpPacket *packet) {
+        QByteArray payload = encrypt(a, plains.value(packet->sequenceNumber));
+        QByteArray expected(airtunes::framesPerPacket*airtunes::channels*sizeof(qint16), 0);
+        const int size = reference.decode(payload.data(), payload.size(), expected.data());
+        return (packet->payloadSize == size) && !memcmp(rtpBuffer.payload(packet), expected.constData(), size);
+    };
+
+    // Uncompressed frames are the largest payloads, arena overflows before the ring
+    for (quint16 i = 1000; i != 1014; ++i) {
+        QVERIFY(put(i, uncompressedFrame(airtunes::framesPerPacket)));
+    }
+    QVERIFY(!put(1014, uncompressedFrame(airtunes::framesPerPacket)));
+
+    // Held packet keeps its payload until next take
+    RtpBuffer::TakeStatus status;
+    const RtpPacket *packet = rtpBuffer.takePacket(0, &status);
+    QVERIFY(packet);
+    QCOMPARE(packet->sequenceNumber, quint16(1000));
+    QCOMPARE(status, RtpBuffer::TakeOk);
+    QVERIFY(decoded(packet));
+    QVERIFY(!put(1015, uncompressedFrame(airtunes::framesPerPacket)));
+    packet = rtpBuffer.takePacket(0, &status);
+    QVERIFY(packet);
+    QCOMPARE(packet->sequenceNumber, quint16(1001));
+    QVERIFY(decoded(packet));
+    QVERIFY(put(1015, uncompressedFrame(airtunes::framesPerPacket)));
+    const QList<RtpBuffer::Sequence> missing = rtpBuffer.missingSequences();
+    QCOMPARE(missing.size(), 1);
+    QCOMPARE(missing.at(0).first, quint16(1014));
+    QCOMPARE(missing.at(0).count, quint16(1));
+
+    // Mixed payload sizes wrap around the arena several times
+    for (quint16 i = 0; i < 60; ++i) {
+        packet = rtpBuffer.takePacket(0, &status);
+        QVERIFY(packet);
+        QCOMPARE(packet->sequenceNumber, quint16(1002+i));
+        if (packet->sequenceNumber == 1014) {
+            QCOMPARE(status, RtpBuffer::TakeLate);
+        } else {
+            QCOMPARE(status, RtpBuffer::TakeOk);
+            // Packet after concealment fades in
+            if (packet->sequenceNumber != 1015) {
+                QVERIFY(decoded(packet));
+            }
+        }
+        QVERIFY(put(1016+i, (i%2) ? uncompressedFrame(airtunes::framesPerPacket) : noiseFrame(airtunes::framesPerPacket, 1000)));
+    }
+}
+
+void RtpTest::entropyDecode()
+{
+    const RtspMessage::Announcement a = announcement();
+    RtpDecoder decoder(a);
+    const int frames = airtunes::framesPerPacket;
+    QByteArray out(frames*airtunes::channels*sizeof(qint16), 0);
+
+    // From silence (runs of zeros) to full scale (escaped values), then
+    // silence and full scale mixed within a packet.
+    for (int amplitude : { 0, 1, 4, 60, 1000, 20000, 32768, -1 }) {
+        for (int round = 0; round < 20; ++round) {
+            QVector<qint16> channels[2];
+            QByteArray expected;
+            for (int i = 0; i < frames; ++i) {
+                for (QVector<qint16> &samples : channels) {
+                    const int range = (amplitude < 0) ? (((i/32)%2) ? 32768 : 0) : amplitude;
+                    samples.append(range ? qint16((qrand()%(2*range))-range) : 0);
+                    expected.append(reinterpret_cast<const char*>(&samples.last()), sizeof(qint16));
+                }
+            }
+
+            QByteArray payload = compressedFrame(channels[0], channels[1]);
+            QCOMPARE(decoder.decode(payload.data(), payload.size(), out.data(), true), out.size());
+            QCOMPARE(out, expected);
+        }
+    }
+}
+
+void RtpTest::planarFloat()
+{
+    const RtspMessage::Announcement a = announcement();
+    RtpDecoder interleaved(a);
+    RtpDecoder planar(a, RtpDecoder::PlanarFloat);
+    QCOMPARE(planar.bytesPerFrame(), int(airtunes::channels*sizeof(float)));
+
+    // Same packets both ways, 16 bit samples are exact in float
+    const int frames = airtunes::framesPerPacket;
+    QByteArray out(frames*interleaved.bytesPerFrame(), 0);
+    QByteArray planes(frames*planar.bytesPerFrame(), 0);
+    for (int amplitude : { 0, 60, 20000, 32768 }) {
+        QByteArray payload = noiseFrame(frames, amplitude);
+        QByteArray copy = payload;
+        QCOMPARE(interleaved.decode(payload.data(), payload.size(), out.data(), true), out.size());
+        QCOMPARE(planar.decode(copy.data(), copy.size(), planes.data(), true), planes.size());
+
+        const qint16 *samples = reinterpret_cast<const qint16*>(out.constData());
+        const float *left = reinterpret_cast<const float*>(planes.constData());
+        const float *right = left+frames;
+        for (int i = 0; i < frames; ++i) {
+            QCOMPARE(left[i], samples[2*i]/32768.0f);
+            QCOMPARE(right[i], samples[2*i+1]/32768.0f);
+        }
+    }
+}
+
+void RtpTest::specialisedDecoder()
+{
+    alac_file *alac = raopAlac();
+    const alac_decode_frame_fn decodeFrame = alac_select_decoder(alac);
+    QVERIFY(decodeFrame != alac_decode_frame);
+
+    // Same as the generic decoder, for compressed frames and for the
+    // uncompressed ones it hands over to the generic decoder.
+    const int frames = airtunes::framesPerPacket;
+    QByteArray expected(frames*4, 0), out(frames*4, 0);
+    for (int round = 0; round < 200; ++round) {
+        static const int amplitudes[] = { 0, 1, 60, 1000, 20000, 32768 };
+        QByteArray payload = (round%7 == 0) ? uncompressedFrame(frames) : noiseFrame(frames, amplitudes[round%6]);
+        int expectedSize = 0;
+        int size = 0;
+        alac_decode_frame(alac, reinterpret_cast<unsigned char*>(payload.data()), payload.size(), expected.data(), &expectedSize);
+        decodeFrame(alac, reinterpret_cast<unsigned char*>(payload.data()), payload.size(), out.data(), &size);
+        QCOMPARE(size, expectedSize);
+        QCOMPARE(out, expected);
+    }
+
+    // Other profiles take the generic decoder
+    alac->setinfo_sample_size = 24;
+    QVERIFY(alac_select_decoder(alac) == alac_decode_frame);
+    alac_free(alac);
+}
+
+void RtpTest::decodeBenchmark_data()
+{
+    QTest::addColumn<bool>("specialised");
+    QTest::newRow("generic") << false;
+    QTest::newRow("specialised") << true;
+}
+
+void RtpTest::decodeBenchmark()
+{
+    QFETCH(bool, specialised);
+
+    alac_file *alac = raopAlac();
+    const alac_decode_frame_fn decodeFrame = specialised ? alac_select_decoder(alac) : alac_decode_frame;
+
+    // Typical music level
+    QByteArray payload = noiseFrame(airtunes::framesPerPacket, 3000);
+    QByteArray out(airtunes::framesPerPacket*4, 0);
+    int size = 0;
+
+    QBENCHMARK {
+        decodeFrame(alac, reinterpret_cast<unsigned char*>(payload.data()), payload.size(), out.data(), &size);
+    }
+    alac_free(alac);
+}
+
+void RtpTest::firPredictor_data()
+{
+    QTest::addColumn<int>("kernel");
+
+    alac_fir_kernel kernels[4];
+    const int count = alac_fir_kernels(kernels, 4);
+    for (int i = 0; i < count; ++i) {
+        QTest::newRow(kernels[i].name) << i;
+    }
+}
+
+void RtpTest::firPredictor()
+{
+    QFETCH(int, kernel);
+
+    alac_fir_kernel kernels[4];
+    alac_fir_kernels(kernels, 4);
+    const alac_fir_run_fn run = kernels[kernel].run;
+
+    // Bit exact against the reference, output and adapted coefficients, for every
+    // order and sizes of errors from tiny (frequent ties) to full range (overflows).
+    static const int frames = 600;
+    QVector<qint32> errors(frames);
+    QVector<qint32> expected(frames);
+    QVector<qint32> out(frames);
+    for (int round = 0; round < 2000; ++round) {
+        const int order = round%32;
+        const int sampleSize = (round & 1) ? 24 : 16;
+        const int quantitization = 1+(qrand()%15);
+        const int range = (round/32)%4;
+        const int size = 1+(qrand()%frames);
+        for (int i = 0; i < size; ++i) {
+            switch (range) {
+            case 0: errors[i] = (qrand()%9)-4; break;
+            case 1: errors[i] = (qrand()%4001)-2000; break;
+            case 2: errors[i] = (qrand()%400001)-200000; break;
+            default: errors[i] = qint32(quint32(qrand()) << 16 ^ quint32(qrand())); break;
+            }
+        }
+        int16_t coefs[32];
+        int16_t expectedCoefs[32];
+        for (int i = 0; i < 32; ++i) {
+            coefs[i] = (range == 3) ? int16_t(qrand()) : int16_t((qrand()%2001)-1000);
+            expectedCoefs[i] = coefs[i];
+        }
+
+        alac_fir_predict_reference(errors.data(), expected.data(), size, sampleSize, expectedCoefs, order, quantitization);
+        alac_fir_predict(run, errors.data(), out.data(), size, sampleSize, coefs, order, quantitization);
+        QVERIFY2(memcmp(out.constData(), expected.constData(), size*sizeof(qint32)) == 0, qPrintable(QString("order %1").arg(order)));
+        QVERIFY2(memcmp(coefs, expectedCoefs, sizeof(coefs)) == 0, qPrintable(QString("order %1").arg(order)));
+    }
+}
+
+void RtpTest::firPredictorBenchmark_data()
+{
+    QTest::addColumn<int>("kernel");
+    QTest::addColumn<int>("order");
+
+    alac_fir_kernel kernels[4];
+    const int count = alac_fir_kernels(kernels, 4);
+    QTest::newRow("reference, order 8") << -1 << 8;
+    for (int i = 0; i < count; ++i) {
+        // 4 and 8 are what encoders typically use
+        for (int order : { 4, 8, 16, 30 }) {
+            QTest::newRow(qPrintable(QString("%1, order %2").arg(kernels[i].name).arg(order))) << i << order;
+        }
+    }
+}
+
+void RtpTest::firPredictorBenchmark()
+{
+    QFETCH(int, kernel);
+    QFETCH(int, order);
+
+    alac_fir_kernel kernels[4];
+    alac_fir_kernels(kernels, 4);
+
+    // One channel of a packet, residuals of a 16 bit stream
+    QVector<qint32> errors(airtunes::framesPerPacket);
+    QVector<qint32> out(airtunes::framesPerPacket);
+    for (int i = 0; i < errors.size(); ++i) {
+        errors[i] = (qrand()%2001)-1000;
+    }
+    int16_t coefs[32];
+
+    QBENCHMARK {
+        for (int i = 0; i < 32; ++i) {
+            coefs[i] = int16_t((i*37)%200-100);
+        }
+        if (kernel < 0) {
+            alac_fir_predict_reference(errors.data(), out.data(), out.size(), 16, coefs, order, 9);
+        } else {
+            alac_fir_predict(kernels[kernel].run, errors.data(), out.data(), out.size(), 16, coefs, order, 9);
+        }
+    }
+}
+
+void RtpTest::deinterlace_data()
+{
+    QTest::addColumn<int>("kernel");
+
+    alac_deinterlace_kernel kernels[4];
+    const int count = alac_deinterlace_kernels(kernels, 4);
+    for (int i = 0; i < count; ++i) {
+        QTest::newRow(kernels[i].name) << i;
+    }
+}
+
+void RtpTest::deinterlace()
+{
+    QFETCH(int, kernel);
+
+    alac_deinterlace_kernel kernels[4];
+    alac_deinterlace_kernels(kernels, 4);
+
+    // Bit exact against the reference, for lengths with and without a scalar tail
+    // and unaligned output. The guard bytes behind the output must stay untouched.
+    static const int frames = 40;
+    static const int guard = 8;
+    QVector<qint32> a(frames), b(frames), uncompressedA(frames), uncompressedB(frames);
+    QByteArray expected(frames*6+guard+1, 0), out(frames*6+guard+1, 0);
+    QVector<float> expectedPlanes(2*frames+guard), planes(2*frames+guard);
+    for (int round = 0; round < 2000; ++round) {
+        const int sampleSize = (round & 1) ? 24 : 16;
+        const int size = qrand()%(frames+1);
+        const int offset = (sampleSize == 16) ? 2*(qrand()%2) : qrand()%4;
+        const int uncompressedBytes = (sampleSize == 24) ? qrand()%3 : 0;
+        const uint8_t shift = qrand()%32;
+        const uint8_t leftWeight = (round%3 == 0) ? 0 : qrand()%128;
+        const int range = 1 << (sampleSize - uncompressedBytes*8);
+        for (int i = 0; i < size; ++i) {
+            a[i] = (qrand()%range)-range/2;
+            b[i] = (qrand()%range)-range/2;
+            uncompressedA[i] = qrand();
+            uncompressedB[i] = qrand();
+        }
+        expected.fill(char(0xaa));
+        out.fill(char(0xaa));
+
+        if (sampleSize == 16) {
+            alac_deinterlace_16_reference(a.constData(), b.constData(), (int16_t*)(expected.data()+offset), 2, size, shift, leftWeight);
+            kernels[kernel].deinterlace_16(a.constData(), b.constData(), (int16_t*)(out.data()+offset), size, shift, leftWeight);
+        } else {
+            alac_deinterlace_24_reference(a.constData(), b.constData(), uncompressedBytes, uncompressedA.constData(), uncompressedB.constData(),
+                                          expected.data()+offset, 2, size, shift, leftWeight);
+            kernels[kernel].deinterlace_24(a.constData(), b.constData(), uncompressedBytes, uncompressedA.constData(), uncompressedB.constData(),
+                                           (uint8_t*)(out.data()+offset), size, shift, leftWeight);
+        }
+        QVERIFY2(out == expected, qPrintable(QString("%1 bit, %2 frames").arg(sampleSize).arg(size)));
+
+        // Planar float, planes start anywhere
+        const float scale = 1.0f/(1 << (sampleSize-1));
+        const int planeOffset = qrand()%4;
+        expectedPlanes.fill(0.0f);
+        planes.fill(0.0f);
+        alac_deinterlace_float_reference(a.constData(), b.constData(), uncompressedBytes, uncompressedA.constData(), uncompressedB.constData(),
+                                         expectedPlanes.data()+planeOffset, expectedPlanes.data()+planeOffset+size, size, shift, leftWeight, scale);
+        kernels[kernel].deinterlace_float(a.constData(), b.constData(), uncompressedBytes, uncompressedA.constData(), uncompressedB.constData(),
+                                          planes.data()+planeOffset, planes.data()+planeOffset+size, size, shift, leftWeight, scale);
+        QVERIFY2(planes == expectedPlanes, qPrintable(QString("float, %1 bit, %2 frames").arg(sampleSize).arg(size)));
+    }
+}
+
+void RtpTest::decryptBenchmark_data()
+{
+    QTest::addColumn<int>("method");
+    QTest::newRow("AES_cbc_encrypt with copy") << 0;
+    QTest::newRow("EVP in place") << 1;
+    QTest::newRow("EVP in place, burst") << 2;
+}
+
+void RtpTest::decryptBenchmark()
+{
+    QFETCH(int, method);
+
+    // A burst of typical payloads, encrypted once, decrypted over and over
+    static const int burst = 32;
+    const RtspMessage::Announcement a = announcement();
+    RtpDecoder decoder(a);
+    QList<QByteArray> payloads;
+    char *data[burst];
+    int sizes[burst];
+    for (int i = 0; i < burst; ++i) {
+        payloads.append(encrypt(a, randomPayload(1024)));
+        data[i] = payloads[i].data();
+        sizes[i] = payloads[i].size();
+    }
+
+    AES_KEY aesKey;
+    AES_set_decrypt_key(reinterpret_cast<const unsigned char*>(a.rsaAesKey.constData()), 128, &aesKey);
+    unsigned char out[2048];
+
+    QBENCHMARK {
+        switch (method) {
+        case 0:
+            // Previous receiver: software AES into a copy
+            for (int i = 0; i < burst; ++i) {
+                unsigned char iv[16];
+                const int encryptedSize = sizes[i] & ~0xf;
+                memcpy(iv, a.aesIv.constData(), sizeof(iv));
+                AES_cbc_encrypt(reinterpret_cast<const unsigned char*>(data[i]), out, encryptedSize, &aesKey, iv, AES_DECRYPT);
+                memcpy(out+encryptedSize, data[i]+encryptedSize, sizes[i]-encryptedSize);
+            }
+            break;
+        case 1:
+            for (int i = 0; i < burst; ++i) {
+                decoder.decrypt(data[i], sizes[i]);
+            }
+            break;
+        case 2:
+            decoder.decrypt(data, sizes, burst);
+            break;
+        }
+    }
+}
+
 QTEST_MAIN(RtpTest)
 
 #include "tst_rtptest.moc"
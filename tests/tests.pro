@@ -2,6 +2,7 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     #audioout \
+    replay \
     rtp \
     rtsp
 